@@ -20,29 +20,268 @@
 #include "conf.hpp"
 #include "util.hpp"
 #include "alg.hpp"
+#include "alg_simd.hpp"
 #include "draw.hpp"
 #include "logger.hpp"
 
 #define MAX2(x, y) ((x) > (y) ? (x) : (y))
+#define MIN2(x, y) ((x) < (y) ? (x) : (y))
 #define MAX3(x, y, z) ((x) > (y) ? ((x) > (z) ? (x) : (z)) : ((y) > (z) ? (y) : (z)))
 #define NORM               100
 #define ABS(x)             ((x) < 0 ? -(x) : (x))
 #define DIFF(x, y)         (ABS((x)-(y)))
 #define NDIFF(x, y)        (ABS(x) * NORM / (ABS(x) + 2 * DIFF(x, y)))
-#define MAXS 10000               /* max depth of stack */
 #define EXCLUDE_LEVEL_PERCENT 20
-/* Increment for *smartmask_buffer in alg_diff_standard. */
-#define SMARTMASK_SENSITIVITY_INCR 5
+#define SAMPLE_POINTS 4         /* Points sampled in each block, at most 4 */
+#define SAMPLE_AUDIT_FRAMES 100
+#define LIGHTSWITCH_BAND   16       /* Luma levels of each band compared for the lightswitch */
 
 typedef struct {
-    short y, xl, xr, dy;
-} Segment;
+    unsigned char *smartmask_final;
+    unsigned short *smartmask_buffer;
+} DiffMasks;
+
+typedef struct {
+    int64_t count;
+    int64_t sum_x;
+    int64_t sum_y;
+    int64_t sum_xx;
+    int64_t sum_yy;
+    int64_t sum_xy;
+} LocationMoments;
+
+/*
+ * The detection pool splits the image into strips of whole block rows so
+ * that no two strips count into the same blocks.  Strip 0 is run on the
+ * motion loop thread and each of the other strips on a worker thread.
+ * A strip only writes its own rows.  The filters that read the rows just
+ * outside of the strip take them from the other page of motion_bits or
+ * from the halo rows copied into the strip buffer before the job.
+ */
+static void *alg_pool_worker(void *arg)
+{
+    struct ctx_detect_strip *strip = (struct ctx_detect_strip *)arg;
+    struct ctx_detect_pool *pool = strip->pool;
+    int indx = (int)(strip - pool->strip);
+    int job_nbr = 0;
+
+    mythreadname_set("dt", pool->cam->threadnr, pool->cam->conf->camera_name.c_str());
+
+    pthread_mutex_lock(&pool->mutex);
+    while (TRUE) {
+        while (!pool->finish && (pool->job_nbr == job_nbr)) {
+            pthread_cond_wait(&pool->cond_start, &pool->mutex);
+        }
+        if (pool->finish) {
+            break;
+        }
+        job_nbr = pool->job_nbr;
+        if (indx < pool->strip_cnt) {
+            pthread_mutex_unlock(&pool->mutex);
+            pool->job(pool->cam, strip, pool->job_arg);
+            pthread_mutex_lock(&pool->mutex);
+            pool->pending--;
+            if (pool->pending == 0) {
+                pthread_cond_signal(&pool->cond_done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/* Run the job over every strip and wait for all of them to finish */
+static void alg_pool_run(struct ctx_cam *cam, detect_job job, void *arg)
+{
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    int indx;
+
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        pool->strip[indx].count = 0;
+        pool->strip[indx].count_pos = 0;
+        pool->strip[indx].sum = 0;
+    }
+
+    if (pool->strip_cnt == 1) {
+        job(cam, &pool->strip[0], arg);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->job_arg = arg;
+    pool->pending = pool->strip_cnt - 1;
+    pool->job_nbr++;
+    pthread_cond_broadcast(&pool->cond_start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    job(cam, &pool->strip[0], arg);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->cond_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Add up the counts of the strips from the last job */
+static int alg_pool_count(struct ctx_cam *cam, int *count_pos)
+{
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    int indx, count;
+
+    count = 0;
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        count += pool->strip[indx].count;
+        if (count_pos) {
+            *count_pos += pool->strip[indx].count_pos;
+        }
+    }
+
+    return count;
+}
+
+/* Copy the rows of img just above and below each strip into its buffer */
+static void alg_pool_halo(struct ctx_cam *cam, unsigned char *img)
+{
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    struct ctx_detect_strip *strip;
+    int indx, width;
+
+    width = cam->imgs.width;
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        strip = &pool->strip[indx];
+        if (strip->row_start > 0) {
+            memcpy(strip->buffer + (3 * width), img + ((strip->row_start - 1) * width), width);
+        }
+        if (strip->row_end < cam->imgs.height) {
+            memcpy(strip->buffer + (4 * width), img + (strip->row_end * width), width);
+        }
+    }
+}
+
+void alg_pool_init(struct ctx_cam *cam)
+{
+    struct ctx_detect_pool *pool;
+    int indx, strip_cnt, block_rows;
+
+    pool = (struct ctx_detect_pool *)mymalloc(sizeof(struct ctx_detect_pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_start, NULL);
+    pthread_cond_init(&pool->cond_done, NULL);
+    pool->cam = cam;
+
+    block_rows = cam->imgs.block_rows;
+    strip_cnt = MIN2(cam->conf->detection_threads, DETECT_STRIPS_MAX);
+    strip_cnt = MAX2(MIN2(strip_cnt, block_rows), 1);
+
+    for (indx = 0; indx < DETECT_STRIPS_MAX; indx++) {
+        pool->strip[indx].pool = pool;
+    }
+
+    for (indx = 0; indx < strip_cnt; indx++) {
+        pool->strip[indx].buffer =(unsigned char*) mymalloc(5 * cam->imgs.width);
+        pool->strip[indx].histogram =(int*) mymalloc(256 * sizeof(*pool->strip[indx].histogram));
+    }
+
+    for (indx = 1; indx < strip_cnt; indx++) {
+        if (pthread_create(&pool->thread[indx], NULL
+                , alg_pool_worker, &pool->strip[indx]) != 0) {
+            MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+                , _("Unable to start detection thread %d"), indx);
+            break;
+        }
+        pool->thread_cnt++;
+    }
+    pool->strip_cnt = pool->thread_cnt + 1;
+
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        pool->strip[indx].row_start = MIN2(((block_rows * indx) / pool->strip_cnt)
+            * MOTION_BLOCK_SIZE, cam->imgs.height);
+        pool->strip[indx].row_end = MIN2(((block_rows * (indx + 1)) / pool->strip_cnt)
+            * MOTION_BLOCK_SIZE, cam->imgs.height);
+        /* No row can have more than (width + 1) / 2 runs */
+        pool->strip[indx].label_start = 2 +
+            (pool->strip[indx].row_start * ((cam->imgs.width + 1) / 2));
+    }
+
+    cam->detect_pool = pool;
+}
+
+void alg_pool_deinit(struct ctx_cam *cam)
+{
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    int indx;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->finish = TRUE;
+    pthread_cond_broadcast(&pool->cond_start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (indx = 1; indx <= pool->thread_cnt; indx++) {
+        pthread_join(pool->thread[indx], NULL);
+    }
+
+    for (indx = 0; indx < DETECT_STRIPS_MAX; indx++) {
+        free(pool->strip[indx].buffer);
+        free(pool->strip[indx].histogram);
+    }
+
+    pthread_cond_destroy(&pool->cond_done);
+    pthread_cond_destroy(&pool->cond_start);
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool);
+    cam->detect_pool = NULL;
+}
+
+/*
+ * Set the pixel bounds of a block of the motion grid and return whether
+ * it may hold changed pixels.  Despeckle dilation can spread the changes
+ * into neighbouring blocks so any block within block_radius of a block
+ * with changes is included.
+ */
+static int alg_block_bounds(struct ctx_images *imgs, int bx, int by
+    , int *xmin, int *xmax, int *ymin, int *ymax)
+{
+    int x, y, x1, x2, y1, y2, active;
+
+    x1 = MAX2(bx - imgs->block_radius, 0);
+    x2 = MIN2(bx + imgs->block_radius, imgs->block_cols - 1);
+    y1 = MAX2(by - imgs->block_radius, 0);
+    y2 = MIN2(by + imgs->block_radius, imgs->block_rows - 1);
+
+    active = FALSE;
+    for (y = y1; (y <= y2) && !active; y++) {
+        for (x = x1; x <= x2; x++) {
+            if (imgs->block_diffs[y * imgs->block_cols + x]) {
+                active = TRUE;
+                break;
+            }
+        }
+    }
+
+    *xmin = bx * MOTION_BLOCK_SIZE;
+    *xmax = MIN2(*xmin + MOTION_BLOCK_SIZE, imgs->width);
+    *ymin = by * MOTION_BLOCK_SIZE;
+    *ymax = MIN2(*ymin + MOTION_BLOCK_SIZE, imgs->height);
+
+    return active;
+}
 
 void alg_locate_center_size(struct ctx_images *imgs, int width, int height, struct ctx_coord *cent)
 {
     unsigned char *out = imgs->image_motion.image_norm;
     int *labels = imgs->labels;
     int x, y, centc = 0, xdist = 0, ydist = 0;
+    int bx, by, xmin, xmax, ymin, ymax;
+
+    alg_motion_unpack(imgs);
 
     cent->x = 0;
     cent->y = 0;
@@ -54,24 +293,38 @@ void alg_locate_center_size(struct ctx_images *imgs, int width, int height, stru
     /* If Labeling enabled - locate center of largest labelgroup. */
     if (imgs->labelsize_max) {
         /* Locate largest labelgroup */
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(labels++) & 32768) {
-                    cent->x += x;
-                    cent->y += y;
-                    centc++;
+        for (by = 0; by < imgs->block_rows; by++) {
+            for (bx = 0; bx < imgs->block_cols; bx++) {
+                if (!alg_block_bounds(imgs, bx, by, &xmin, &xmax, &ymin, &ymax)) {
+                    continue;
+                }
+                for (y = ymin; y < ymax; y++) {
+                    for (x = xmin; x < xmax; x++) {
+                        if (labels[y * width + x] & 32768) {
+                            cent->x += x;
+                            cent->y += y;
+                            centc++;
+                        }
+                    }
                 }
             }
         }
 
     } else {
         /* Locate movement */
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(out++)) {
-                    cent->x += x;
-                    cent->y += y;
-                    centc++;
+        for (by = 0; by < imgs->block_rows; by++) {
+            for (bx = 0; bx < imgs->block_cols; bx++) {
+                if (!alg_block_bounds(imgs, bx, by, &xmin, &xmax, &ymin, &ymax)) {
+                    continue;
+                }
+                for (y = ymin; y < ymax; y++) {
+                    for (x = xmin; x < xmax; x++) {
+                        if (out[y * width + x]) {
+                            cent->x += x;
+                            cent->y += y;
+                            centc++;
+                        }
+                    }
                 }
             }
         }
@@ -85,50 +338,61 @@ void alg_locate_center_size(struct ctx_images *imgs, int width, int height, stru
 
     /* Now we find the size of the Motion. */
 
-    /* First reset pointers back to initial value. */
     centc = 0;
-    labels = imgs->labels;
-    out = imgs->image_motion.image_norm;
 
     /* If Labeling then we find the area around largest labelgroup instead. */
     if (imgs->labelsize_max) {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(labels++) & 32768) {
-                    if (x > cent->x) {
-                        xdist += x - cent->x;
-                    } else if (x < cent->x) {
-                        xdist += cent->x - x;
-                    }
-
-                    if (y > cent->y) {
-                        ydist += y - cent->y;
-                    } else if (y < cent->y) {
-                        ydist += cent->y - y;
+        for (by = 0; by < imgs->block_rows; by++) {
+            for (bx = 0; bx < imgs->block_cols; bx++) {
+                if (!alg_block_bounds(imgs, bx, by, &xmin, &xmax, &ymin, &ymax)) {
+                    continue;
+                }
+                for (y = ymin; y < ymax; y++) {
+                    for (x = xmin; x < xmax; x++) {
+                        if (labels[y * width + x] & 32768) {
+                            if (x > cent->x) {
+                                xdist += x - cent->x;
+                            } else if (x < cent->x) {
+                                xdist += cent->x - x;
+                            }
+
+                            if (y > cent->y) {
+                                ydist += y - cent->y;
+                            } else if (y < cent->y) {
+                                ydist += cent->y - y;
+                            }
+
+                            centc++;
+                        }
                     }
-
-                    centc++;
                 }
             }
         }
 
     } else {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(out++)) {
-                    if (x > cent->x) {
-                        xdist += x - cent->x;
-                    } else if (x < cent->x) {
-                        xdist += cent->x - x;
-                    }
-
-                    if (y > cent->y) {
-                        ydist += y - cent->y;
-                    } else if (y < cent->y) {
-                        ydist += cent->y - y;
+        for (by = 0; by < imgs->block_rows; by++) {
+            for (bx = 0; bx < imgs->block_cols; bx++) {
+                if (!alg_block_bounds(imgs, bx, by, &xmin, &xmax, &ymin, &ymax)) {
+                    continue;
+                }
+                for (y = ymin; y < ymax; y++) {
+                    for (x = xmin; x < xmax; x++) {
+                        if (out[y * width + x]) {
+                            if (x > cent->x) {
+                                xdist += x - cent->x;
+                            } else if (x < cent->x) {
+                                xdist += cent->x - x;
+                            }
+
+                            if (y > cent->y) {
+                                ydist += y - cent->y;
+                            } else if (y < cent->y) {
+                                ydist += cent->y - y;
+                            }
+
+                            centc++;
+                        }
                     }
-
-                    centc++;
                 }
             }
         }
@@ -189,41 +453,136 @@ void alg_locate_center_size(struct ctx_images *imgs, int width, int height, stru
 
 }
 
-void alg_noise_tune(struct ctx_cam *cam, unsigned char *new_var)
+/* Count the luma of a strip into its histogram along with the differences for the noise */
+static void alg_histogram_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
 {
-    struct ctx_images *imgs = &cam->imgs;
-    int i;
-    unsigned char *ref = imgs->ref;
-    int diff, sum = 0, count = 0;
-    unsigned char *mask = imgs->mask;
-    unsigned char *smartmask = imgs->smartmask_final;
+    ctx_images *imgs = &cam->imgs;
+    int offset = strip->row_start * imgs->width;
 
-    i = imgs->motionsize;
+    (void)arg;
 
-    for (; i > 0; i--) {
-        diff = ABS(*ref - *new_var);
+    memset(strip->histogram, 0, 256 * sizeof(*strip->histogram));
+    algsimd_histogram(imgs->ref + offset, imgs->image_vprvcy + offset
+        , (imgs->mask ? imgs->mask + offset : NULL)
+        , imgs->smartmask_final + offset
+        , (strip->row_end - strip->row_start) * imgs->width
+        , strip->histogram, &strip->sum, &strip->count);
+}
 
-        if (mask) {
-            diff = ((diff * *mask++) / 255);
-        }
+/* Add or with sign -1 take away the noise differences of the rows from the sum */
+static void alg_noise_rows(struct ctx_cam *cam, int row_start, int row_end, int sign)
+{
+    ctx_images *imgs = &cam->imgs;
+    int offset = row_start * imgs->width;
+    int histogram[256];
+    int64_t sum;
+    int count;
+
+    memset(histogram, 0, sizeof(histogram));
+    sum = 0;
+    count = 0;
+    algsimd_histogram(imgs->ref + offset, imgs->image_vprvcy + offset
+        , (imgs->mask ? imgs->mask + offset : NULL)
+        , imgs->smartmask_final + offset
+        , (row_end - row_start) * imgs->width
+        , histogram, &sum, &count);
+
+    imgs->noise_sum += sign * sum;
+    imgs->noise_count += sign * count;
+}
+
+/* Run the histogram pass over the strips and add up the differences for the noise */
+static void alg_histogram_pass(struct ctx_cam *cam)
+{
+    ctx_images *imgs = &cam->imgs;
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    int indx;
+
+    alg_pool_run(cam, alg_histogram_strip, NULL);
+
+    imgs->noise_sum = 0;
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        imgs->noise_sum += pool->strip[indx].sum;
+    }
+    imgs->noise_count = alg_pool_count(cam, NULL);
+    imgs->noise_valid = TRUE;
+}
+
+/*
+ * Take the luma histogram, mean and variance of image_vprvcy in one pass
+ * before the diff.  The same pass adds up the differences from the
+ * reference that alg_noise_tune works from, unless the smart mask tuning
+ * changes the mask before then.
+ */
+void alg_histogram(struct ctx_cam *cam)
+{
+    ctx_images *imgs = &cam->imgs;
+    struct ctx_detect_pool *pool = cam->detect_pool;
+    int64_t sum, sum_sq;
+    double mean;
+    int indx, level;
+
+    memcpy(imgs->histogram_prev, imgs->histogram, sizeof(imgs->histogram));
+    memset(imgs->histogram, 0, sizeof(imgs->histogram));
 
-        if (*smartmask) {
-            sum += diff + 1;
-            count++;
+    alg_histogram_pass(cam);
+
+    for (indx = 0; indx < pool->strip_cnt; indx++) {
+        for (level = 0; level < 256; level++) {
+            imgs->histogram[level] += pool->strip[indx].histogram[level];
         }
+    }
 
-        ref++;
-        new_var++;
-        smartmask++;
+    sum = 0;
+    sum_sq = 0;
+    for (level = 0; level < 256; level++) {
+        sum += (int64_t)level * imgs->histogram[level];
+        sum_sq += (int64_t)level * level * imgs->histogram[level];
     }
+    mean = (double)sum / imgs->motionsize;
+    imgs->luma_mean = (int)mean;
+    imgs->luma_variance = (int)(((double)sum_sq / imgs->motionsize) - (mean * mean));
 
-    if (count > 3)  {
+    if (imgs->histogram_frames < 2) {
+        imgs->histogram_frames++;
+    }
+}
+
+/*
+ * Keep the histogram of the last image for the next one to compare with
+ * on an image that does not take the histogram.  When skip is set, as for
+ * the frames skipped after a lightswitch, the histogram before is taken
+ * as the last one.  Otherwise the next image has nothing to compare with.
+ */
+void alg_histogram_roll(struct ctx_cam *cam, int skip)
+{
+    ctx_images *imgs = &cam->imgs;
+
+    if (skip) {
+        memcpy(imgs->histogram_prev, imgs->histogram, sizeof(imgs->histogram));
+    } else {
+        imgs->histogram_frames = 0;
+    }
+}
+
+void alg_noise_tune(struct ctx_cam *cam)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    int64_t sum;
+
+    /* The sum from the histogram pass is only used when the reference and smart mask are still the same */
+    if (!imgs->noise_valid) {
+        alg_histogram_pass(cam);
+    }
+
+    sum = imgs->noise_sum;
+    if (imgs->noise_count > 3)  {
         /* Avoid divide by zero. */
-        sum /= count / 3;
+        sum /= imgs->noise_count / 3;
     }
 
     /* 5: safe, 4: regular, 3: more sensitive */
-    cam->noise = 4 + (cam->noise + sum) / 2;
+    cam->noise = 4 + (cam->noise + (int)sum) / 2;
 }
 
 void alg_threshold_tune(struct ctx_cam *cam, int diffs, int motion)
@@ -268,304 +627,454 @@ void alg_threshold_tune(struct ctx_cam *cam, int diffs, int motion)
 }
 
 /*
- * Labeling by Joerg Weber. Based on an idea from Hubert Mara.
- * Floodfill enhanced by Ian McConnel based on code from
- * http://www.acm.org/pubs/tog/GraphicsGems/
- * http://www.codeproject.com/gdi/QuickFill.asp
-
- * Filled horizontal segment of scanline y for xl <= x <= xr.
- * Parent segment was on line y - dy.  dy = 1 or -1
+ * The despeckle filters work on motion_bits which packs the luma of
+ * image_motion into one bit per pixel.  Bit n of each word is pixel n of
+ * that run of 64 pixels and the bits past the width of the image are
+ * kept unset.  Pixels outside the image are treated as unset.
  */
-#define PUSH(Y, XL, XR, DY)     /* push new segment on stack */  \
-        if (sp<stack+MAXS && Y+(DY) >= 0 && Y+(DY) < height)     \
-        {sp->y = Y; sp->xl = XL; sp->xr = XR; sp->dy = DY; sp++;}
-
-#define POP(Y, XL, XR, DY)      /* pop segment off stack */      \
-        {sp--; Y = sp->y+(DY = sp->dy); XL = sp->xl; XR = sp->xr;}
 
-static int alg_iflood(int x, int y, int width, int height,
-        unsigned char *out, int *labels, int newvalue, int oldvalue)
+/* Pixel x-1 of the row moved into the bit for pixel x */
+static inline uint64_t alg_bits_left(const uint64_t *row, int indx)
 {
-    int l, x1, x2, dy;
-    Segment stack[MAXS], *sp = stack; /* Stack of filled segments. */
-    int count = 0;
+    if (indx == 0) {
+        return row[indx] << 1;
+    }
+    return (row[indx] << 1) | (row[indx - 1] >> 63);
+}
 
-    if (x < 0 || x >= width || y < 0 || y >= height) {
-        return 0;
+/* Pixel x+1 of the row moved into the bit for pixel x */
+static inline uint64_t alg_bits_right(const uint64_t *row, int indx, int words)
+{
+    if (indx == (words - 1)) {
+        return row[indx] >> 1;
     }
+    return (row[indx] >> 1) | (row[indx + 1] << 63);
+}
 
-    PUSH(y, x, x, 1);      /* Needed in some cases. */
-    PUSH(y + 1, x, x, -1); /* Seed segment (popped 1st). */
+/* Return the first pixel from x onwards in the packed row that is set or unset */
+static int alg_bits_next(const uint64_t *row, int width, int x, int set)
+{
+    int indx, words;
+    uint64_t val;
 
-    while (sp > stack) {
-        /* Pop segment off stack and fill a neighboring scan line. */
-        POP(y, x1, x2, dy);
-        /*
-         * Segment of scan line y-dy for x1<=x<=x2 was previously filled,
-         * now explore adjacent pixels in scan line y
-         */
-        for (x = x1; x >= 0 && out[y * width + x] != 0 && labels[y * width + x] == oldvalue; x--) {
-            labels[y * width + x] = newvalue;
-            count++;
-        }
+    if (x >= width) {
+        return width;
+    }
 
-        if (x >= x1) {
-            goto skip;
+    words = (width + 63) / 64;
+    indx = x / 64;
+    val = (set ? row[indx] : ~row[indx]) & (~(uint64_t)0 << (x % 64));
+    while (val == 0) {
+        if (++indx == words) {
+            return width;
         }
+        val = (set ? row[indx] : ~row[indx]);
+    }
 
-        l = x + 1;
+    return MIN2((indx * 64) + __builtin_ctzll(val), width);
+}
 
-        if (l < x1) {
-            PUSH(y, l, x1 - 1, -dy); /* Leak on left? */
+/* Pack the luma of image_motion into motion_bits for the rows of a strip */
+static void alg_bits_pack_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    unsigned char *out;
+    uint64_t *row, val, bytes;
+    int *blocks;
+    int x, y, indx, bit, words, blk, blk_cnt;
+
+    (void)arg;
+
+    words = imgs->motion_bits_stride;
+    blk_cnt = 64 / MOTION_BLOCK_SIZE;
+
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        out = imgs->image_motion.image_norm + (y * imgs->width);
+        row = imgs->motion_bits + (y * words);
+        blocks = imgs->block_diffs + ((y / MOTION_BLOCK_SIZE) * imgs->block_cols);
+        for (indx = 0; indx < words; indx++) {
+            row[indx] = 0;
+            /* Blocks without changes have nothing to pack */
+            for (blk = indx * blk_cnt; blk < MIN2((indx + 1) * blk_cnt, imgs->block_cols); blk++) {
+                if (blocks[blk]) {
+                    break;
+                }
+            }
+            if (blk == MIN2((indx + 1) * blk_cnt, imgs->block_cols)) {
+                continue;
+            }
+            val = 0;
+            bit = 0;
+            x = indx * 64;
+        #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+            /* Set the top bit of each non zero byte and gather them eight at a time */
+            for (; (bit < 64) && ((x + 8) <= imgs->width); bit += 8, x += 8) {
+                memcpy(&bytes, out + x, sizeof(bytes));
+                bytes = (((bytes & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | bytes) &
+                    0x8080808080808080ULL;
+                val |= (((bytes >> 7) * 0x0102040810204080ULL) >> 56) << bit;
+            }
+        #endif
+            for (; (bit < 64) && (x < imgs->width); bit++, x++) {
+                if (out[x]) {
+                    val |= ((uint64_t)1 << bit);
+                }
+            }
+            row[indx] = val;
         }
+    }
 
-        x = x1 + 1;
+}
 
-        do {
-            for (; x < width && out[y * width + x] != 0 && labels[y * width + x] == oldvalue; x++) {
-                labels[y * width + x] = newvalue;
-                count++;
-            }
+static void alg_bits_pack(struct ctx_cam *cam)
+{
+    alg_pool_run(cam, alg_bits_pack_strip, NULL);
+}
 
-            PUSH(y, l, x - 1, dy);
+/*
+ * Write motion_bits back into the luma of image_motion when it has been
+ * changed by the despeckle filters.  Pixels that are set take the value
+ * from image_vprvcy as the difference does.
+ */
+void alg_motion_unpack(struct ctx_images *imgs)
+{
+    unsigned char *out, *img;
+    uint64_t *row, val;
+    int *blocks;
+    int x, y, indx, bit, words, blk, blk_cnt;
 
-            if (x > x2 + 1) {
-                PUSH(y, x2 + 1, x - 1, -dy); /* Leak on right? */
-            }
+    if (!imgs->motion_packed) {
+        return;
+    }
 
-        skip:
-            for (x++; x <= x2 && !(out[y * width + x] != 0 && labels[y * width + x] == oldvalue); x++);
-            l = x;
-        } while (x <= x2);
+    words = imgs->motion_bits_stride;
+    blk_cnt = 64 / MOTION_BLOCK_SIZE;
+
+    for (y = 0; y < imgs->height; y++) {
+        out = imgs->image_motion.image_norm + (y * imgs->width);
+        img = imgs->image_vprvcy + (y * imgs->width);
+        row = imgs->motion_bits + (y * words);
+        blocks = imgs->block_diffs + ((y / MOTION_BLOCK_SIZE) * imgs->block_cols);
+        for (indx = 0; indx < words; indx++) {
+            val = row[indx];
+            /* Blocks without changes are already zero in image_motion */
+            if (val == 0) {
+                for (blk = indx * blk_cnt; blk < MIN2((indx + 1) * blk_cnt, imgs->block_cols); blk++) {
+                    if (blocks[blk]) {
+                        break;
+                    }
+                }
+                if (blk == MIN2((indx + 1) * blk_cnt, imgs->block_cols)) {
+                    continue;
+                }
+            }
+            for (bit = 0, x = indx * 64; (bit < 64) && (x < imgs->width); bit++, x++) {
+                if ((val >> bit) & 1) {
+                    out[x] = MAX2(img[x], 1);
+                } else {
+                    out[x] = 0;
+                }
+            }
+        }
     }
-    return count;
+
+    imgs->motion_packed = FALSE;
 }
 
-static int alg_labeling(struct ctx_cam *cam)
+/* Return whether the pixel is in motion from whichever of the images is current */
+static int alg_motion_pixel(struct ctx_images *imgs, int indx)
 {
-    struct ctx_images *imgs = &cam->imgs;
-    unsigned char *out = imgs->image_motion.image_norm;
-    int *labels = imgs->labels;
-    int ix, iy, pixelpos;
-    int width = imgs->width;
-    int height = imgs->height;
-    int labelsize = 0;
-    int current_label = 2;
-    /* Keep track of the area just under the threshold.  */
-    int max_under = 0;
+    int x, y;
 
-    cam->current_image->total_labels = 0;
-    imgs->labelsize_max = 0;
-    /* ALL labels above threshold are counted as labelgroup. */
-    imgs->labelgroup_max = 0;
-    imgs->labels_above = 0;
+    if (!imgs->motion_packed) {
+        return (imgs->image_motion.image_norm[indx] != 0);
+    }
 
-    /* Init: 0 means no label set / not checked. */
-    memset(labels, 0, width * height * sizeof(*labels));
-    pixelpos = 0;
+    y = indx / imgs->width;
+    x = indx % imgs->width;
 
-    for (iy = 0; iy < height - 1; iy++) {
-        for (ix = 0; ix < width - 1; ix++, pixelpos++) {
-            /* No motion - no label */
-            if (out[pixelpos] == 0) {
-                labels[pixelpos] = 1;
-                continue;
-            }
-
-            /* Already visited by alg_iflood */
-            if (labels[pixelpos] > 0) {
-                continue;
-            }
-
-            labelsize = alg_iflood(ix, iy, width, height, out, labels, current_label, 0);
+    return (imgs->motion_bits[(y * imgs->motion_bits_stride) + (x / 64)] >> (x % 64)) & 1;
+}
 
-            if (labelsize > 0) {
-                /* Label above threshold? Mark it again (add 32768 to labelnumber). */
-                if (labelsize > cam->threshold) {
-                    labelsize = alg_iflood(ix, iy, width, height, out, labels, current_label + 32768, current_label);
-                    imgs->labelgroup_max += labelsize;
-                    imgs->labels_above++;
-                } else if(max_under < labelsize) {
-                    max_under = labelsize;
+/*
+ * Apply one of the despeckle filters to the rows of a strip of motion_bits.
+ * E and e erode a 3x3 box and a + shape, D and d dilate them.  The first
+ * and last columns are cleared as the byte filters did.  The filtered rows
+ * are written to motion_bits_work and the count of pixels left set is
+ * kept in the strip.
+ */
+static void alg_bits_filter_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    char filter = *(char *)arg;
+    uint64_t *src, *dst, *row, *row_up, *row_dn;
+    uint64_t val, up, dn, prev, next, mask_up, mask_dn, mask_first, mask_last;
+    int x, y, words, sum;
+
+    words = imgs->motion_bits_stride;
+    src = imgs->motion_bits;
+    dst = imgs->motion_bits_work;
+
+    /* The first and last columns of the image are always cleared */
+    mask_first = ~(uint64_t)1;
+    mask_last = ~(uint64_t)0 >> (63 - ((imgs->width - 1) % 64));
+    mask_last &= ~((uint64_t)1 << ((imgs->width - 1) % 64));
+
+    sum = 0;
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        row = src + (y * words);
+        row_up = (y > 0) ? (row - words) : row;
+        row_dn = (y < (imgs->height - 1)) ? (row + words) : row;
+        mask_up = (y > 0) ? ~(uint64_t)0 : 0;
+        mask_dn = (y < (imgs->height - 1)) ? ~(uint64_t)0 : 0;
+
+        for (x = 0; x < words; x++) {
+            switch (filter) {
+            case 'E':
+                val = row[x] & alg_bits_left(row, x) & alg_bits_right(row, x, words);
+                up = row_up[x] & alg_bits_left(row_up, x) & alg_bits_right(row_up, x, words);
+                dn = row_dn[x] & alg_bits_left(row_dn, x) & alg_bits_right(row_dn, x, words);
+                val &= (up & mask_up) & (dn & mask_dn);
+                break;
+            case 'e':
+                val = row[x] & alg_bits_left(row, x) & alg_bits_right(row, x, words);
+                val &= (row_up[x] & mask_up) & (row_dn[x] & mask_dn);
+                break;
+            case 'D':
+                /* Combine the three rows and then dilate across */
+                val = row[x] | (row_up[x] & mask_up) | (row_dn[x] & mask_dn);
+                prev = 0;
+                next = 0;
+                if (x > 0) {
+                    prev = row[x - 1] | (row_up[x - 1] & mask_up) | (row_dn[x - 1] & mask_dn);
                 }
-
-                if (imgs->labelsize_max < labelsize) {
-                    imgs->labelsize_max = labelsize;
-                    imgs->largest_label = current_label;
+                if (x < (words - 1)) {
+                    next = row[x + 1] | (row_up[x + 1] & mask_up) | (row_dn[x + 1] & mask_dn);
                 }
-
-                cam->current_image->total_labels++;
-                current_label++;
+                val |= (val << 1) | (prev >> 63) | (val >> 1) | (next << 63);
+                break;
+            case 'd':
+                val = row[x] | alg_bits_left(row, x) | alg_bits_right(row, x, words);
+                val |= (row_up[x] & mask_up) | (row_dn[x] & mask_dn);
+                break;
+            default:
+                val = row[x];
+                break;
             }
+            if (x == 0) {
+                val &= mask_first;
+            }
+            if (x == (words - 1)) {
+                val &= mask_last;
+            }
+            dst[(y * words) + x] = val;
+            sum += __builtin_popcountll(val);
         }
-        pixelpos++; /* Compensate for ix < width - 1 */
     }
 
-    /* Return group of significant labels or if that's none, the next largest
-     * group (which is under the threshold, but especially for setup gives an
-     * idea how close it was).
-     */
-    return imgs->labelgroup_max ? imgs->labelgroup_max : max_under;
+    strip->count = sum;
 }
 
-/**  Dilates a 3x3 box. */
-static int alg_dilate9(unsigned char *img, int width, int height, void *buffer)
+/*
+ * Apply one of the despeckle filters to motion_bits.
+ * Returns the number of pixels left set.
+ */
+static int alg_bits_filter(struct ctx_cam *cam, char filter)
 {
-    /*
-     * - row1, row2 and row3 represent lines in the temporary buffer.
-     * - Window is a sliding window containing max values of the columns
-     *   in the 3x3 matrix.
-     * - width is an index into the sliding window (this is faster than
-     *   doing modulo 3 on i).
-     * - blob keeps the current max value.
-     */
-    int y, i, sum = 0, widx;
-    unsigned char *row1, *row2, *row3, *rowTemp, *yp;
-    unsigned char window[3], blob, latest;
+    uint64_t *src;
 
-    /* Set up row pointers in the temporary buffer. */
-    row1 = (unsigned char *)buffer;
-    row2 = row1 + width;
-    row3 = row2 + width;
+    alg_pool_run(cam, alg_bits_filter_strip, &filter);
 
-    /* Init rows 2 and 3. */
-    memset(row2, 0, width);
-    memcpy(row3, img, width);
+    src = cam->imgs.motion_bits;
+    cam->imgs.motion_bits = cam->imgs.motion_bits_work;
+    cam->imgs.motion_bits_work = src;
 
-    /* Pointer to the current row in img. */
-    yp = img;
+    return alg_pool_count(cam, NULL);
+}
 
-    for (y = 0; y < height; y++) {
-        /* Move down one step; row 1 becomes the previous row 2 and so on. */
-        rowTemp = row1;
-        row1 = row2;
-        row2 = row3;
-        row3 = rowTemp;
+/*
+ * Labeling is done in two passes over runs of set pixels in motion_bits.  The first
+ * pass gives every run a provisional label and joins it with the runs it
+ * touches in the row above.  The second pass resolves the provisional
+ * labels into the final label numbers.  The rows may be split into strips
+ * which are labeled by separate threads and then joined along the first
+ * row of each strip.  Each strip uses its own range of provisional labels.
+ */
+static int alg_label_find(int *parent, int label)
+{
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
 
-        /* If we're at the last row, fill with zeros, otherwise copy from img. */
-        if (y == height - 1) {
-            memset(row3, 0, width);
-        } else {
-            memcpy(row3, yp + width, width);
-        }
+/* Join two labels.  The lower label is always kept as the root. */
+static void alg_label_union(int *parent, int *labelsize, int label1, int label2)
+{
+    label1 = alg_label_find(parent, label1);
+    label2 = alg_label_find(parent, label2);
 
-        /* Init slots 0 and 1 in the moving window. */
-        window[0] = MAX3(row1[0], row2[0], row3[0]);
-        window[1] = MAX3(row1[1], row2[1], row3[1]);
+    if (label1 == label2) {
+        return;
+    }
 
-        /* Init blob to the current max, and set window index. */
-        blob = MAX2(window[0], window[1]);
-        widx = 2;
+    if (label1 < label2) {
+        parent[label2] = label1;
+        labelsize[label1] += labelsize[label2];
+    } else {
+        parent[label1] = label2;
+        labelsize[label2] += labelsize[label1];
+    }
+}
 
-        /*
-         * Iterate over the current row; index i is off by one to eliminate
-         * a lot of +1es in the loop.
-         */
-        for (i = 2; i <= width - 1; i++) {
-            /* Get the max value of the next column in the 3x3 matrix. */
-            latest = window[widx] = MAX3(row1[i], row2[i], row3[i]);
-
-            /*
-             * If the value is larger than the current max, use it. Otherwise,
-             * calculate a new max (because the new value may not be the max.
-             */
-            if (latest >= blob) {
-                blob = latest;
-            } else {
-                blob = MAX3(window[0], window[1], window[2]);
-            }
+/* First pass over the rows of a strip */
+static void alg_label_runs(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    int *labels = imgs->labels;
+    int *parent = imgs->labelparent;
+    int *labelsize = imgs->labelsize;
+    int width = imgs->width;
+    int x, y, indx, xstart, label, prev_label;
+    int *row, *row_prev;
+    uint64_t *bits_row;
 
-            /* Write the max value (blob) to the image. */
-            if (blob != 0) {
-                *(yp + i - 1) = blob;
-                sum++;
+    (void)arg;
+
+    strip->label_next = strip->label_start;
+
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        bits_row = imgs->motion_bits + (y * imgs->motion_bits_stride);
+        row = labels + (y * width);
+        row_prev = (y > strip->row_start) ? (row - width) : NULL;
+
+        x = 0;
+        while (x < width) {
+            xstart = alg_bits_next(bits_row, width, x, TRUE);
+            memset(row + x, 0, (xstart - x) * sizeof(*row));
+            if (xstart == width) {
+                break;
             }
+            x = alg_bits_next(bits_row, width, xstart, FALSE);
 
-            /* Wrap around the window index if necessary. */
-            if (++widx == 3) {
-                widx = 0;
+            label = strip->label_next++;
+            parent[label] = label;
+            for (indx = xstart; indx < x; indx++) {
+                row[indx] = label;
+            }
+            labelsize[label] = x - xstart;
+
+            if (row_prev != NULL) {
+                prev_label = 0;
+                for (indx = xstart; indx < x; indx++) {
+                    if (row_prev[indx] && (row_prev[indx] != prev_label)) {
+                        prev_label = row_prev[indx];
+                        alg_label_union(parent, labelsize, label, prev_label);
+                    }
+                }
             }
         }
-
-        /* Store zeros in the vertical sides. */
-        *yp = *(yp + width - 1) = 0;
-        yp += width;
     }
-
-    return sum;
 }
 
-/**  Dilates a + shape. */
-static int alg_dilate5(unsigned char *img, int width, int height, void *buffer)
+/* Join the first row of a strip with the last row of the strip above */
+static void alg_label_join(struct ctx_images *imgs, int y)
 {
-    /*
-     * - row1, row2 and row3 represent lines in the temporary buffer.
-     * - mem holds the max value of the overlapping part of two + shapes.
-     */
-    int y, i, sum = 0;
-    unsigned char *row1, *row2, *row3, *rowTemp, *yp;
-    unsigned char blob, mem, latest;
-
-    /* Set up row pointers in the temporary buffer. */
-    row1 = (unsigned char *)buffer;
-    row2 = row1 + width;
-    row3 = row2 + width;
-
-    /* Init rows 2 and 3. */
-    memset(row2, 0, width);
-    memcpy(row3, img, width);
+    int *row = imgs->labels + (y * imgs->width);
+    int *row_prev = row - imgs->width;
+    int x, label, prev_label;
+
+    label = 0;
+    prev_label = 0;
+    for (x = 0; x < imgs->width; x++) {
+        if (row[x] && row_prev[x] &&
+            ((row[x] != label) || (row_prev[x] != prev_label))) {
+            label = row[x];
+            prev_label = row_prev[x];
+            alg_label_union(imgs->labelparent, imgs->labelsize, label, prev_label);
+        }
+    }
+}
 
-    /* Pointer to the current row in img. */
-    yp = img;
+static int alg_labeling(struct ctx_cam *cam)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    int *labels = imgs->labels;
+    int *parent = imgs->labelparent;
+    int *labelsize = imgs->labelsize;
+    struct ctx_detect_strip *strip = cam->detect_pool->strip;
+    int strip_cnt = cam->detect_pool->strip_cnt;
+    int indx, label, labelvalue;
+    int current_label = 2;
+    /* Keep track of the area just under the threshold.  */
+    int max_under = 0;
 
-    for (y = 0; y < height; y++) {
-        /* Move down one step; row 1 becomes the previous row 2 and so on. */
-        rowTemp = row1;
-        row1 = row2;
-        row2 = row3;
-        row3 = rowTemp;
+    cam->current_image->total_labels = 0;
+    imgs->labelsize_max = 0;
+    /* ALL labels above threshold are counted as labelgroup. */
+    imgs->labelgroup_max = 0;
+    imgs->labels_above = 0;
 
-        /* If we're at the last row, fill with zeros, otherwise copy from img. */
-        if (y == height - 1) {
-            memset(row3, 0, width);
-        } else {
-            memcpy(row3, yp + width, width);
-        }
+    alg_pool_run(cam, alg_label_runs, NULL);
 
-        /* Init mem and set blob to force an evaluation of the entire + shape. */
-        mem = MAX2(row2[0], row2[1]);
-        blob = 1; /* dummy value, must be > 0 */
+    for (indx = 1; indx < strip_cnt; indx++) {
+        alg_label_join(imgs, strip[indx].row_start);
+    }
 
-        for (i = 1; i < width - 1; i++) {
-            /* Get the max value of the "right edge" of the + shape. */
-            latest = MAX3(row1[i], row2[i + 1], row3[i]);
+    /*
+     * Resolve the provisional labels in order.  A root is always lower than
+     * the labels joined to it so it has been resolved before them and its
+     * labelsize entry is replaced with the final label value.
+     */
+    for (indx = 0; indx < strip_cnt; indx++) {
+        for (label = strip[indx].label_start; label < strip[indx].label_next; label++) {
+            if (parent[label] != label) {
+                parent[label] = parent[parent[label]];
+                labelsize[label] = labelsize[parent[label]];
+                continue;
+            }
 
-            if (blob == 0) {
-                /* In case the last blob is zero, only latest matters. */
-                blob = latest;
-                mem = row2[i + 1];
-            } else {
-                /* Otherwise, we have to check both latest and mem. */
-                blob = MAX2(mem, latest);
-                mem = MAX2(row2[i], row2[i + 1]);
+            labelvalue = current_label;
+            /* Label above threshold? Mark it (add 32768 to labelnumber). */
+            if (labelsize[label] > cam->threshold) {
+                labelvalue += 32768;
+                imgs->labelgroup_max += labelsize[label];
+                imgs->labels_above++;
+            } else if(max_under < labelsize[label]) {
+                max_under = labelsize[label];
             }
 
-            /* Write the max value (blob) to the image. */
-            if (blob != 0) {
-                *(yp + i) = blob;
-                sum++;
+            if (imgs->labelsize_max < labelsize[label]) {
+                imgs->labelsize_max = labelsize[label];
+                imgs->largest_label = current_label;
             }
+
+            cam->current_image->total_labels++;
+            current_label++;
+            labelsize[label] = labelvalue;
         }
+    }
 
-        /* Store zeros in the vertical sides. */
-        *yp = *(yp + width - 1) = 0;
-        yp += width;
+    /* Provisional labels start at 2 so entry 0 keeps unchanged pixels at 0 */
+    labelsize[0] = 0;
+    for (indx = 0; indx < imgs->motionsize; indx++) {
+        labels[indx] = labelsize[labels[indx]];
     }
-    return sum;
+
+    /* Return group of significant labels or if that's none, the next largest
+     * group (which is under the threshold, but especially for setup gives an
+     * idea how close it was).
+     */
+    return imgs->labelgroup_max ? imgs->labelgroup_max : max_under;
 }
 
-/**  Erodes a 3x3 box. */
-static int alg_erode9(unsigned char *img, int width, int height, void *buffer, unsigned char flag)
+/*
+ * Erodes a 3x3 box over the rows of a strip.  The buffer holds the three
+ * working rows followed by the rows just above and below the strip.
+ */
+static int alg_erode9(unsigned char *img, int width, int height
+    , int row_start, int row_end, unsigned char *buffer, unsigned char flag)
 {
     int y, i, sum = 0;
     char *Row1, *Row2, *Row3;
@@ -573,15 +1082,21 @@ static int alg_erode9(unsigned char *img, int width, int height, void *buffer, u
     Row1 = (char *)buffer;
     Row2 = Row1 + width;
     Row3 = Row1 + 2 * width;
-    memset(Row2, flag, width);
-    memcpy(Row3, img, width);
+    if (row_start == 0) {
+        memset(Row2, flag, width);
+    } else {
+        memcpy(Row2, buffer + 3 * width, width);
+    }
+    memcpy(Row3, img + row_start * width, width);
 
-    for (y = 0; y < height; y++) {
+    for (y = row_start; y < row_end; y++) {
         memcpy(Row1, Row2, width);
         memcpy(Row2, Row3, width);
 
         if (y == height - 1) {
             memset(Row3, flag, width);
+        } else if (y == row_end - 1) {
+            memcpy(Row3, buffer + 4 * width, width);
         } else {
             memcpy(Row3, img + (y + 1) * width, width);
         }
@@ -607,8 +1122,9 @@ static int alg_erode9(unsigned char *img, int width, int height, void *buffer, u
     return sum;
 }
 
-/* Erodes in a + shape. */
-static int alg_erode5(unsigned char *img, int width, int height, void *buffer, unsigned char flag)
+/* Erodes in a + shape over the rows of a strip. */
+static int alg_erode5(unsigned char *img, int width, int height
+    , int row_start, int row_end, unsigned char *buffer, unsigned char flag)
 {
     int y, i, sum = 0;
     char *Row1, *Row2, *Row3;
@@ -616,15 +1132,21 @@ static int alg_erode5(unsigned char *img, int width, int height, void *buffer, u
     Row1 = (char *)buffer;
     Row2 = Row1 + width;
     Row3 = Row1 + 2 * width;
-    memset(Row2, flag, width);
-    memcpy(Row3, img, width);
+    if (row_start == 0) {
+        memset(Row2, flag, width);
+    } else {
+        memcpy(Row2, buffer + 3 * width, width);
+    }
+    memcpy(Row3, img + row_start * width, width);
 
-    for (y = 0; y < height; y++) {
+    for (y = row_start; y < row_end; y++) {
         memcpy(Row1, Row2, width);
         memcpy(Row2, Row3, width);
 
         if (y == height - 1) {
             memset(Row3, flag, width);
+        } else if (y == row_end - 1) {
+            memcpy(Row3, buffer + 4 * width, width);
         } else {
             memcpy(Row3, img + (y + 1) * width, width);
         }
@@ -648,8 +1170,7 @@ static int alg_erode5(unsigned char *img, int width, int height, void *buffer, u
 
 void alg_despeckle(struct ctx_cam *cam)
 {
-    int diffs, width, height, done, i, len;
-    unsigned char *out, *common_buffer;
+    int diffs, done, i, len, dilates;
 
     if ((cam->conf->despeckle_filter == "") || cam->current_image->diffs <= 0) {
         if (cam->imgs.labelsize_max) cam->imgs.labelsize_max = 0;
@@ -657,34 +1178,29 @@ void alg_despeckle(struct ctx_cam *cam)
     }
 
     diffs = 0;
-    out = cam->imgs.image_motion.image_norm;
-    width = cam->imgs.width;
-    height = cam->imgs.height;
     done = 0;
+    dilates = 0;
     len = cam->conf->despeckle_filter.length();
-    common_buffer = cam->imgs.common_buffer;
     cam->current_image->total_labels = 0;
     cam->imgs.largest_label = 0;
     cam->olddiffs = cam->current_image->diffs;
 
+    /* The filters and labeling work on the packed copy of the image */
+    alg_bits_pack(cam);
+    cam->imgs.motion_packed = TRUE;
+
     for (i = 0; i < len; i++) {
         switch (cam->conf->despeckle_filter[i]) {
         case 'E':
-            diffs = alg_erode9(out, width, height, common_buffer, 0);
-            if (diffs == 0) i = len;
-            done = 1;
-            break;
         case 'e':
-            diffs = alg_erode5(out, width, height, common_buffer, 0);
+            diffs = alg_bits_filter(cam, cam->conf->despeckle_filter[i]);
             if (diffs == 0) i = len;
             done = 1;
             break;
         case 'D':
-            diffs = alg_dilate9(out, width, height, common_buffer);
-            done = 1;
-            break;
         case 'd':
-            diffs = alg_dilate5(out, width, height, common_buffer);
+            diffs = alg_bits_filter(cam, cam->conf->despeckle_filter[i]);
+            dilates++;
             done = 1;
             break;
         /* No further despeckle after labeling! */
@@ -696,6 +1212,9 @@ void alg_despeckle(struct ctx_cam *cam)
         }
     }
 
+    /* Each dilation can move the changes one pixel into the next block */
+    cam->imgs.block_radius = (dilates + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+
     /* If conf.despeckle_filter contains any valid action EeDdl */
     if (done) {
         if (done != 2) cam->imgs.labelsize_max = 0; // Disable Labeling
@@ -708,22 +1227,17 @@ void alg_despeckle(struct ctx_cam *cam)
     return;
 }
 
-void alg_tune_smartmask(struct ctx_cam *cam)
+/* Update the smart mask for the rows of a strip */
+static void alg_tune_smartmask_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
 {
     int i, diff;
-    int motionsize = cam->imgs.motionsize;
+    int indx_end = strip->row_end * cam->imgs.width;
     unsigned char *smartmask = cam->imgs.smartmask;
     unsigned char *smartmask_final = cam->imgs.smartmask_final;
-    int *smartmask_buffer = cam->imgs.smartmask_buffer;
-    int sensitivity = cam->lastrate * (11 - cam->smartmask_speed);
-
-    if (!cam->smartmask_speed ||
-        (cam->event_nr == cam->prev_event) ||
-        (--cam->smartmask_count)) {
-        return;
-    }
+    unsigned short *smartmask_buffer = cam->imgs.smartmask_buffer;
+    int sensitivity = *(int *)arg;
 
-    for (i = 0; i < motionsize; i++) {
+    for (i = strip->row_start * cam->imgs.width; i < indx_end; i++) {
         /* Decrease smart_mask sensitivity every 5*speed seconds only. */
         if (smartmask[i] > 0)
             smartmask[i]--;
@@ -745,232 +1259,396 @@ void alg_tune_smartmask(struct ctx_cam *cam)
             smartmask_final[i] = 255;
         }
     }
-    /* Further expansion (here:erode due to inverted logic!) of the mask. */
-    diff = alg_erode9(smartmask_final, cam->imgs.width, cam->imgs.height,
-                      cam->imgs.common_buffer, 255);
-    diff = alg_erode5(smartmask_final, cam->imgs.width, cam->imgs.height,
-                      cam->imgs.common_buffer, 255);
-    cam->smartmask_count = cam->smartmask_ratio;
 }
 
-/* Increment for *smartmask_buffer in alg_diff_standard. */
-#define SMARTMASK_SENSITIVITY_INCR 5
+static void alg_tune_smartmask_erode9(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    (void)arg;
+    alg_erode9(cam->imgs.smartmask_final, cam->imgs.width, cam->imgs.height
+        , strip->row_start, strip->row_end, strip->buffer, 255);
+}
+
+static void alg_tune_smartmask_erode5(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    (void)arg;
+    alg_erode5(cam->imgs.smartmask_final, cam->imgs.width, cam->imgs.height
+        , strip->row_start, strip->row_end, strip->buffer, 255);
+}
 
-static int alg_diff_nomask(struct ctx_cam *cam, unsigned char *new_var)
+/*
+ * Tune the band of rows of the smart mask for this frame of the period so
+ * that all of it is tuned once every smartmask_ratio frames.  The erodes
+ * need the raw mask of the two rows on each side of the band, so those are
+ * rebuilt from smartmask into common_buffer along with the band.
+ */
+static void alg_tune_smartmask_band(struct ctx_cam *cam, int sensitivity)
 {
-    unsigned char *ref = cam->imgs.ref;
-    unsigned char *out = cam->imgs.image_motion.image_norm;
-
-    int i, curdiff;
-    int imgsz = cam->imgs.motionsize;
-    int diffs = 0;
-    int noise = cam->noise;
-
-    memset(out + imgsz, 128, (imgsz / 2));
-    memset(out, 0, imgsz);
-
-    for (i = 0; i < imgsz; i++) {
-        curdiff = abs(*ref - *new_var);
-        if (curdiff > noise) {
-            *out = *new_var;
-            diffs++;
-        }
-        out++;
-        ref++;
-        new_var++;
+    ctx_images *imgs = &cam->imgs;
+    struct ctx_detect_strip band;
+    unsigned char *scratch, *buffer;
+    int frame, row_start, row_end, row_lo, row_hi, rows, indx, width;
+
+    width = imgs->width;
+    frame = cam->smartmask_ratio - cam->smartmask_count;
+    row_start = (frame * imgs->height) / cam->smartmask_ratio;
+    row_end = ((frame + 1) * imgs->height) / cam->smartmask_ratio;
+    if (row_start == row_end) {
+        return;
     }
 
-    struct timespec ts2;
+    band.row_start = row_start;
+    band.row_end = row_end;
+    alg_tune_smartmask_strip(cam, &band, &sensitivity);
+
+    row_lo = MAX2(row_start - 2, 0);
+    row_hi = MIN2(row_end + 2, imgs->height);
+    rows = row_hi - row_lo;
+    scratch = imgs->common_buffer;
+    buffer = scratch + (rows * width);
+
+    for (indx = 0; indx < (rows * width); indx++) {
+        scratch[indx] = (imgs->smartmask[(row_lo * width) + indx] > 20) ? 0 : 255;
+    }
 
-    clock_gettime(CLOCK_REALTIME, &ts2);
+    /* Rows past the edges of the scratch rows only change the two extra rows */
+    alg_erode9(scratch, width, rows, 0, rows, buffer, 255);
+    alg_erode5(scratch, width, rows, 0, rows, buffer, 255);
 
-    return diffs;
+    /* Keep the noise sum from before the diff in step with the rows that change */
+    if (imgs->noise_valid) {
+        alg_noise_rows(cam, row_start, row_end, -1);
+    }
+    memcpy(imgs->smartmask_final + (row_start * width)
+        , scratch + ((row_start - row_lo) * width), (row_end - row_start) * width);
+    if (imgs->noise_valid) {
+        alg_noise_rows(cam, row_start, row_end, 1);
+    }
 }
 
-static int alg_diff_mask(struct ctx_cam *cam, unsigned char *new_img)
+void alg_tune_smartmask(struct ctx_cam *cam)
 {
-    unsigned char *ref  = cam->imgs.ref;
-    unsigned char *out  = cam->imgs.image_motion.image_norm;
-    unsigned char *mask = cam->imgs.mask;
-
-    int i, curdiff;
-    int imgsz = cam->imgs.motionsize;
-    int diffs = 0;
-    int noise = cam->noise;
-
-    memset(out + imgsz, 128, (imgsz / 2));
-    memset(out, 0, imgsz);
-
-    for (i = 0; i < imgsz; i++) {
-        curdiff = abs(*ref - *new_img);
-        if (mask) {
-            curdiff = ((curdiff * *mask) / 255);
-            mask++;
-        }
+    int sensitivity = cam->lastrate * (11 - cam->smartmask_speed);
+
+    if (!cam->smartmask_speed || (cam->smartmask_ratio <= 0) ||
+        (cam->event_nr == cam->prev_event)) {
+        return;
+    }
 
-        if (curdiff > noise) {
-            *out = *new_img;
-            diffs++;
+    if ((cam->smartmask_count <= 0) || (cam->smartmask_count > cam->smartmask_ratio)) {
+        cam->smartmask_count = cam->smartmask_ratio;
+    }
+
+    if (cam->conf->smart_mask_incremental) {
+        alg_tune_smartmask_band(cam, sensitivity);
+        if (--cam->smartmask_count == 0) {
+            cam->smartmask_count = cam->smartmask_ratio;
         }
-        out++;
-        ref++;
-        new_img++;
+        return;
     }
 
-    return diffs;
-}
+    if (--cam->smartmask_count) {
+        return;
+    }
 
-static int alg_diff_smart(struct ctx_cam *cam, unsigned char *new_img)
-{
+    /* The noise sum from before the diff is not for the tuned mask */
+    cam->imgs.noise_valid = FALSE;
+    alg_pool_run(cam, alg_tune_smartmask_strip, &sensitivity);
 
-    unsigned char *ref  = cam->imgs.ref;
-    unsigned char *out  = cam->imgs.image_motion.image_norm;
-    unsigned char *smartmask_final = cam->imgs.smartmask_final;
+    /* Further expansion (here:erode due to inverted logic!) of the mask. */
+    alg_pool_halo(cam, cam->imgs.smartmask_final);
+    alg_pool_run(cam, alg_tune_smartmask_erode9, NULL);
+    alg_pool_halo(cam, cam->imgs.smartmask_final);
+    alg_pool_run(cam, alg_tune_smartmask_erode5, NULL);
+
+    cam->smartmask_count = cam->smartmask_ratio;
+}
 
-    int i, curdiff;
-    int imgsz = cam->imgs.motionsize;
-    int diffs = 0;
-    int noise = cam->noise;
-    int smartmask_speed = cam->smartmask_speed;
-    int *smartmask_buffer = cam->imgs.smartmask_buffer;
-
-    imgsz = cam->imgs.motionsize;
-    memset(out + imgsz, 128, (imgsz / 2));
-    memset(out, 0, imgsz);
-
-    for (i = 0; i < imgsz; i++) {
-        curdiff = abs(*ref - *new_img);
-        if (smartmask_speed) {
-            if (curdiff > noise) {
-                if (cam->event_nr != cam->prev_event) {
-                    (*smartmask_buffer) += SMARTMASK_SENSITIVITY_INCR;
+/*
+ * Estimate the part of the image that changed from SAMPLE_POINTS pixels of
+ * each block of the motion grid.  The points fall in different rows and
+ * columns of the block and move each frame so that each pixel of the block
+ * is sampled once every 64 frames.  The estimate is raised by three standard
+ * errors (or three samples when none changed) to give the bound.
+ * Returns TRUE when the bound reaches max_n_changes and a full diff is needed.
+ */
+static int alg_diff_sample(struct ctx_cam *cam, int max_n_changes)
+{
+    struct ctx_images *imgs = &cam->imgs;
+    unsigned char *ref = imgs->ref;
+    unsigned char *new_img = imgs->image_vprvcy;
+    int bx, by, pt, indx, x, y, count, changed;
+    double frac, bound;
+
+    count = 0;
+    changed = 0;
+    for (by = 0; by < imgs->block_rows; by++) {
+        for (bx = 0; bx < imgs->block_cols; bx++) {
+            for (pt = 0; pt < SAMPLE_POINTS; pt++) {
+                /* One point in each column and row of 4x4 cells */
+                x = (bx * MOTION_BLOCK_SIZE) + (pt * 4) + ((imgs->sample_seq / 4) % 4);
+                y = (by * MOTION_BLOCK_SIZE) + (((pt + imgs->sample_seq) % 4) * 4)
+                    + ((imgs->sample_seq / 16) % 4);
+                if ((x >= imgs->width) || (y >= imgs->height)) {
+                    continue;
                 }
-                if (!*smartmask_final) {
-                    curdiff = 0;
+                indx = (y * imgs->width) + x;
+                if (abs(ref[indx] - new_img[indx]) > cam->noise) {
+                    changed++;
                 }
+                count++;
             }
-            smartmask_final++;
-            smartmask_buffer++;
-        }
-        /* Pixel still in motion after all the masks? */
-        if (curdiff > noise) {
-            *out = *new_img;
-            diffs++;
         }
+    }
+    imgs->sample_seq = (imgs->sample_seq + 1) % 64;
 
-        out++;
-        ref++;
-        new_img++;
+    if (count == 0) {
+        return TRUE;
     }
 
-    return diffs;
+    frac = (double)changed / count;
+    bound = frac + MAX2(3.0 * sqrt(frac * (1.0 - frac) / count), 3.0 / count);
+    imgs->sample_estimate = (int)(frac * imgs->motionsize);
+
+    return ((bound * imgs->motionsize) >= max_n_changes);
 }
 
-static int alg_diff_masksmart(struct ctx_cam *cam, unsigned char *new_img)
+/* Restore the constant chroma of the motion image if an overlay changed it */
+static void alg_motion_chroma(struct ctx_cam *cam)
 {
-    unsigned char *ref = cam->imgs.ref;
-    unsigned char *out = cam->imgs.image_motion.image_norm;
-    unsigned char *mask = cam->imgs.mask;
-    unsigned char *smartmask_final = cam->imgs.smartmask_final;
 
-    int i, curdiff;
-    int imgsz = cam->imgs.motionsize;
-    int diffs = 0;
-    int noise = cam->noise;
-    int smartmask_speed = cam->smartmask_speed;
-    int *smartmask_buffer = cam->imgs.smartmask_buffer;
-
-    imgsz= cam->imgs.motionsize;
-    memset(out + imgsz, 128, (imgsz / 2));
-    memset(out, 0, imgsz);
-
-    for (i = 0; i < imgsz; i++) {
-        curdiff = abs(*ref - *new_img);
-        if (mask) {
-            curdiff = ((curdiff * *mask) / 255);
-            mask++;
-        }
+    if (cam->imgs.motion_chroma_dirty) {
+        memset(cam->imgs.image_motion.image_norm + cam->imgs.motionsize
+            , 128, (cam->imgs.motionsize / 2));
+        cam->imgs.motion_chroma_dirty = FALSE;
+    }
+
+}
 
-        if (smartmask_speed) {
-            if (curdiff > noise) {
-                if (cam->event_nr != cam->prev_event) {
-                    (*smartmask_buffer) += SMARTMASK_SENSITIVITY_INCR;
+/* Average each scale x scale box of the luma into one pixel of dst */
+static void alg_downscale(unsigned char *src, unsigned char *dst
+    , int width, int height, int scale)
+{
+    int x, y, xb, yb, sum, half;
+    unsigned char *row;
+
+    half = (scale * scale) / 2;
+    for (y = 0; y < height; y += scale) {
+        for (x = 0; x < width; x += scale) {
+            sum = 0;
+            for (yb = 0; yb < scale; yb++) {
+                row = src + ((y + yb) * width) + x;
+                for (xb = 0; xb < scale; xb++) {
+                    sum += row[xb];
                 }
-                if (!*smartmask_final) curdiff = 0;
             }
-            smartmask_final++;
-            smartmask_buffer++;
+            *dst++ = (sum + half) / (scale * scale);
         }
-        /* Pixel still in motion after all the masks? */
-        if (curdiff > noise) {
-            *out = *new_img;
-            diffs++;
+    }
+}
+
+/*
+ * Compare the new image and the reference at 1/detection_scale of the size
+ * and mark the blocks of the motion grid that changed along with their
+ * neighbours in block_coarse.  A change over part of a reduced pixel is
+ * averaged down so half the noise level is used.
+ * Returns the number of blocks to compare at the full size.
+ */
+static int alg_diff_coarse(struct ctx_cam *cam)
+{
+    ctx_images *imgs = &cam->imgs;
+    int scale = cam->conf->detection_scale;
+    int width = imgs->width / scale;
+    int height = imgs->height / scale;
+    int cols = imgs->block_cols;
+    int rows = imgs->block_rows;
+    int x, y, bx, by, indx, noise, cnt;
+
+    alg_downscale(imgs->image_vprvcy, imgs->image_coarse, imgs->width, imgs->height, scale);
+    alg_downscale(imgs->ref, imgs->ref_coarse, imgs->width, imgs->height, scale);
+
+    memset(imgs->block_coarse, 0, cols * rows);
+
+    noise = cam->noise / 2;
+    indx = 0;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++, indx++) {
+            if (abs(imgs->image_coarse[indx] - imgs->ref_coarse[indx]) > noise) {
+                imgs->block_coarse[((y * scale) / MOTION_BLOCK_SIZE) * cols +
+                    ((x * scale) / MOTION_BLOCK_SIZE)] = 1;
+            }
         }
+    }
 
-        out++;
-        ref++;
-        new_img++;
+    /* Include the neighbours for changes that cross into the next block */
+    cnt = 0;
+    for (by = 0; by < rows; by++) {
+        for (bx = 0; bx < cols; bx++) {
+            if (imgs->block_coarse[by * cols + bx] != 1) {
+                continue;
+            }
+            for (y = MAX2(by - 1, 0); y <= MIN2(by + 1, rows - 1); y++) {
+                for (x = MAX2(bx - 1, 0); x <= MIN2(bx + 1, cols - 1); x++) {
+                    if (imgs->block_coarse[y * cols + x] == 0) {
+                        imgs->block_coarse[y * cols + x] = 2;
+                    }
+                }
+            }
+        }
+    }
+    for (indx = 0; indx < (cols * rows); indx++) {
+        if (imgs->block_coarse[indx]) {
+            cnt++;
+        }
     }
 
-    return diffs;
+    return cnt;
 }
 
-
-static char alg_diff_fast(struct ctx_cam *cam, int max_n_changes, unsigned char *new_var)
+/* Run the difference kernel over each row of a strip */
+static void alg_diff_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
 {
-    struct ctx_images *imgs = &cam->imgs;
-    int i;
-    int diffs = 0;
-    int step = cam->imgs.motionsize / 10000;
-    int noise = cam->noise;
-    unsigned char *ref = imgs->ref;
-    int curdiff;
+    ctx_images *imgs = &cam->imgs;
+    DiffMasks *masks = (DiffMasks *)arg;
+    unsigned char *smartmask_final = masks->smartmask_final;
+    unsigned short *smartmask_buffer = masks->smartmask_buffer;
+    unsigned char *coarse;
+    int y, offset, bx, bx_end, xstart, xend;
+
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        offset = y * imgs->width;
+        if (cam->conf->detection_scale <= 1) {
+            strip->count += algsimd_diff(imgs->ref + offset, imgs->image_vprvcy + offset
+                , imgs->image_motion.image_norm + offset
+                , (imgs->mask ? imgs->mask + offset : NULL)
+                , (smartmask_final ? smartmask_final + offset : NULL)
+                , (smartmask_buffer ? smartmask_buffer + offset : NULL)
+                , cam->noise, imgs->width, &strip->count_pos
+                , imgs->block_diffs + (y / MOTION_BLOCK_SIZE) * imgs->block_cols);
+            continue;
+        }
+
+        /* Compare each run of marked blocks across the row */
+        coarse = imgs->block_coarse + (y / MOTION_BLOCK_SIZE) * imgs->block_cols;
+        bx = 0;
+        while (bx < imgs->block_cols) {
+            bx_end = bx;
+            while ((bx_end < imgs->block_cols) && ((coarse[bx_end] != 0) == (coarse[bx] != 0))) {
+                bx_end++;
+            }
+            xstart = offset + (bx * MOTION_BLOCK_SIZE);
+            xend = offset + MIN2(bx_end * MOTION_BLOCK_SIZE, imgs->width);
+            if (coarse[bx]) {
+                strip->count += algsimd_diff(imgs->ref + xstart, imgs->image_vprvcy + xstart
+                    , imgs->image_motion.image_norm + xstart
+                    , (imgs->mask ? imgs->mask + xstart : NULL)
+                    , (smartmask_final ? smartmask_final + xstart : NULL)
+                    , (smartmask_buffer ? smartmask_buffer + xstart : NULL)
+                    , cam->noise, xend - xstart, &strip->count_pos
+                    , imgs->block_diffs + (y / MOTION_BLOCK_SIZE) * imgs->block_cols + bx);
+            } else {
+                memset(imgs->image_motion.image_norm + xstart, 0, xend - xstart);
+            }
+            bx = bx_end;
+        }
+    }
+}
 
-    if (!step % 2) step++;
+/*
+ * Run the difference kernel over each row of the image so that the
+ * changed pixels are also counted into the blocks of the motion grid.
+ * When detection_scale is set only the blocks that changed at the reduced
+ * size are compared and the rest of the motion image is cleared.
+ */
+static int alg_diff_blocks(struct ctx_cam *cam, unsigned char *smartmask_final
+    , unsigned short *smartmask_buffer, int *diffs_pos)
+{
+    ctx_images *imgs = &cam->imgs;
+    DiffMasks masks;
 
-    max_n_changes /= step;
+    memset(imgs->block_diffs, 0
+        , imgs->block_cols * imgs->block_rows * sizeof(*imgs->block_diffs));
+    imgs->block_radius = 0;
+    imgs->motion_packed = FALSE;
 
-    i = imgs->motionsize;
+    if ((cam->conf->detection_scale > 1) && (alg_diff_coarse(cam) == 0)) {
+        memset(imgs->image_motion.image_norm, 0, imgs->motionsize);
+        return 0;
+    }
 
-    for (; i > 0; i -= step) {
-        curdiff = abs(*ref - *new_var); /* Using a temp variable is 12% faster. */
-        if (curdiff >  noise) {
-            diffs++;
-            if (diffs > max_n_changes){
+    masks.smartmask_final = smartmask_final;
+    masks.smartmask_buffer = smartmask_buffer;
+    alg_pool_run(cam, alg_diff_strip, &masks);
 
-                //MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
-                //,"Lots of fast diffs %d detected.", diffs);
+    return alg_pool_count(cam, diffs_pos);
+}
 
-                return 1;
-            }
+/*
+ * Compute the motion image and diffs in a single pass over the frame.
+ * The mask, smart mask and the update of the smartmask_buffer are all
+ * applied within the same kernel.
+ */
+static void alg_diff_standard(struct ctx_cam *cam)
+{
+    unsigned short *smartmask_buffer;
+    unsigned char *smartmask_final;
+
+    smartmask_final = NULL;
+    smartmask_buffer = NULL;
+    if (cam->smartmask_speed) {
+        smartmask_final = cam->imgs.smartmask_final;
+        if (cam->event_nr != cam->prev_event) {
+            smartmask_buffer = cam->imgs.smartmask_buffer;
         }
-        ref += step;
-        new_var += step;
     }
 
-    //MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
-    //    ,"Fast Diffs %d detected.", diffs);
+    alg_motion_chroma(cam);
+
+    cam->current_image->diffs = alg_diff_blocks(cam, smartmask_final
+        , smartmask_buffer, NULL);
 
-    return 0;
 }
 
-static void alg_diff_standard(struct ctx_cam *cam)
+/*
+ * Keep count of how often the samples were right.  Frames the samples
+ * passed to the full diff are checked for little change, and every
+ * SAMPLE_AUDIT_FRAMES skipped frame is run through the full diff anyway
+ * to check that the skip did not miss any motion.
+ */
+static void alg_diff_audit(struct ctx_cam *cam, int max_n_changes, int needed)
 {
+    ctx_images *imgs = &cam->imgs;
 
-    if (cam->smartmask_speed == 0){
-        if (cam->imgs.mask == NULL) {
-            cam->current_image->diffs = alg_diff_nomask(cam, cam->imgs.image_vprvcy);
-        } else {
-            cam->current_image->diffs = alg_diff_mask(cam, cam->imgs.image_vprvcy);
-        }
-    } else {
-        if (cam->imgs.mask == NULL) {
-            cam->current_image->diffs = alg_diff_smart(cam, cam->imgs.image_vprvcy);
-        } else {
-            cam->current_image->diffs = alg_diff_masksmart(cam, cam->imgs.image_vprvcy);
+    if (needed) {
+        imgs->sample_runs++;
+        alg_diff_standard(cam);
+        if (cam->current_image->diffs < max_n_changes) {
+            imgs->sample_false++;
         }
+        return;
+    }
+
+    imgs->sample_skips++;
+    if ((imgs->sample_skips % SAMPLE_AUDIT_FRAMES) != 0) {
+        cam->current_image->diffs = 0;
+        memset(imgs->block_diffs, 0, imgs->block_cols *
+            imgs->block_rows * sizeof(*imgs->block_diffs));
+        imgs->motion_packed = FALSE;
+        return;
+    }
+
+    alg_diff_standard(cam);
+    imgs->sample_audits++;
+    if (cam->current_image->diffs >= max_n_changes) {
+        imgs->sample_misses++;
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+            , _("Sampled estimate %d missed %d diffs")
+            , imgs->sample_estimate, cam->current_image->diffs);
     }
 
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+        , _("Samples skipped %d frames, audited %d with %d missed, passed %d with %d false")
+        , imgs->sample_skips, imgs->sample_audits, imgs->sample_misses
+        , imgs->sample_runs, imgs->sample_false);
 }
 
 void alg_diff(struct ctx_cam *cam)
@@ -979,28 +1657,188 @@ void alg_diff(struct ctx_cam *cam)
     if (cam->detecting_motion || cam->motapp->setup_mode) {
         alg_diff_standard(cam);
     } else {
-        if (alg_diff_fast(cam, cam->conf->threshold / 2, cam->imgs.image_vprvcy)) {
-            alg_diff_standard(cam);
-        } else {
-            cam->current_image->diffs = 0;
+        alg_diff_audit(cam, cam->conf->threshold / 2
+            , alg_diff_sample(cam, cam->conf->threshold / 2));
+    }
+}
+
+/* Treat the image as a lightswitch.  Skip the next images and take this one as the reference */
+static void alg_lightswitch_set(struct ctx_cam *cam)
+{
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO, _("Lightswitch detected, luma mean %d variance %d")
+        , cam->imgs.luma_mean, cam->imgs.luma_variance);
+    if (cam->frame_skip < (unsigned int)cam->conf->lightswitch_frames)
+        cam->frame_skip = (unsigned int)cam->conf->lightswitch_frames;
+    cam->current_image->diffs = 0;
+    alg_update_reference_frame(cam, RESET_REF_FRAME);
+    /* The noise sum was taken against the old reference */
+    cam->imgs.noise_valid = FALSE;
+
+}
+
+/*
+ * Catch a lightswitch before the diff is run.  The histogram is compared
+ * with the one of the last image that took it, which is detection_interval
+ * images back, in bands of LIGHTSWITCH_BAND levels.  Half of the difference
+ * of the bands is the least number of pixels that moved to another band.
+ * A change that keeps most pixels within their band is not caught here but
+ * by alg_lightswitch from the diffs.  The motion image is cleared since
+ * the diff is skipped.
+ * Returns TRUE when a lightswitch was detected.
+ */
+int alg_lightswitch_histogram(struct ctx_cam *cam)
+{
+    ctx_images *imgs = &cam->imgs;
+    int band, level, cur, prev, changed;
+
+    if ((cam->conf->lightswitch_percent < 1) || cam->lost_connection ||
+        (imgs->histogram_frames < 2)) {
+        return FALSE;
+    }
+
+    changed = 0;
+    for (band = 0; band < 256; band += LIGHTSWITCH_BAND) {
+        cur = 0;
+        prev = 0;
+        for (level = band; level < (band + LIGHTSWITCH_BAND); level++) {
+            cur += imgs->histogram[level];
+            prev += imgs->histogram_prev[level];
         }
+        changed += abs(cur - prev);
+    }
+    changed /= 2;
+
+    if (changed <= (imgs->motionsize * cam->conf->lightswitch_percent / 100)) {
+        return FALSE;
     }
+
+    memset(imgs->image_motion.image_norm, 0, imgs->motionsize);
+    memset(imgs->block_diffs, 0
+        , imgs->block_cols * imgs->block_rows * sizeof(*imgs->block_diffs));
+    imgs->block_radius = 0;
+    imgs->motion_packed = FALSE;
+
+    alg_lightswitch_set(cam);
+
+    return TRUE;
 }
 
+/* Catch a lightswitch from the diffs of the image against the reference */
 void alg_lightswitch(struct ctx_cam *cam)
 {
 
-    if (cam->conf->lightswitch_percent >= 1 && !cam->lost_connection) {
-        if (cam->current_image->diffs > (cam->imgs.motionsize * cam->conf->lightswitch_percent / 100)) {
-            MOTION_LOG(INF, TYPE_ALL, NO_ERRNO, _("Lightswitch detected"));
-            if (cam->frame_skip < (unsigned int)cam->conf->lightswitch_frames)
-                cam->frame_skip = (unsigned int)cam->conf->lightswitch_frames;
-            cam->current_image->diffs = 0;
-            alg_update_reference_frame(cam, RESET_REF_FRAME);
+    if ((cam->conf->lightswitch_percent < 1) || cam->lost_connection) {
+        return;
+    }
+
+    if (cam->current_image->diffs > (cam->imgs.motionsize * cam->conf->lightswitch_percent / 100)) {
+        alg_lightswitch_set(cam);
+    }
+
+}
+
+/*
+ * Blend the new image into a running average of the reference kept in 8.8
+ * fixed point.  Pixels that are part of the motion are held until they
+ * have been static longer than accept_timer and then taken as they are.
+ * The motion of each run of 64 pixels is first expanded into a byte per
+ * pixel so the loop over the run has no branches.
+ */
+static void alg_update_reference_average(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    ctx_images *imgs = &cam->imgs;
+    int accept_timer = *(int *)arg;
+    int rate = (cam->conf->reference_rate * 256) / 100;
+    int threshold_ref = cam->noise * EXCLUDE_LEVEL_PERCENT / 100;
+    unsigned char moving[64];
+    unsigned char *ref, *image_virgin, *smartmask, *motion;
+    unsigned short *ref_dyn, *ref_average;
+    uint64_t bits;
+    int x, x0, y, len, indx, newpix, avg, dyn, excl, accept;
+
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        for (x0 = 0; x0 < imgs->width; x0 += 64) {
+            indx = (y * imgs->width) + x0;
+            len = MIN2(64, imgs->width - x0);
+            ref = imgs->ref + indx;
+            image_virgin = imgs->image_vprvcy + indx;
+            smartmask = imgs->smartmask_final + indx;
+            ref_dyn = imgs->ref_dyn + indx;
+            ref_average = imgs->ref_average + indx;
+
+            if (imgs->motion_packed) {
+                bits = imgs->motion_bits[(y * imgs->motion_bits_stride) + (x0 / 64)];
+                for (x = 0; x < len; x++) {
+                    moving[x] = (bits >> x) & 1;
+                }
+            } else {
+                motion = imgs->image_motion.image_norm + indx;
+                for (x = 0; x < len; x++) {
+                    moving[x] = (motion[x] != 0);
+                }
+            }
+
+            for (x = 0; x < len; x++) {
+                newpix = image_virgin[x] << 8;
+                avg = ref_average[x];
+                excl = (abs(ref[x] - image_virgin[x]) > threshold_ref) &
+                    (smartmask[x] != 0) & moving[x];
+                dyn = excl ? ref_dyn[x] + 1 : 0;
+                accept = (dyn > accept_timer);
+                avg = accept ? newpix : (excl ? avg : avg + (((newpix - avg) * rate) >> 8));
+                ref_dyn[x] = accept ? 0 : dyn;
+                ref_average[x] = avg;
+                ref[x] = (avg + 128) >> 8;
+            }
         }
     }
 }
 
+/* Original update of the reference frame for the rows of a strip */
+static void alg_update_reference_strip(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg)
+{
+    int accept_timer = *(int *)arg;
+    int i, indx, threshold_ref;
+    unsigned short *ref_dyn;
+    unsigned char *image_virgin, *ref, *smartmask;
+
+    threshold_ref = cam->noise * EXCLUDE_LEVEL_PERCENT / 100;
+
+    indx = strip->row_start * cam->imgs.width;
+    ref_dyn = cam->imgs.ref_dyn + indx;
+    image_virgin = cam->imgs.image_vprvcy + indx;
+    ref = cam->imgs.ref + indx;
+    smartmask = cam->imgs.smartmask_final + indx;
+
+    for (i = (strip->row_end - strip->row_start) * cam->imgs.width; i > 0; i--) {
+        /* Exclude pixels from ref frame well below noise level. */
+        if (((int)(abs(*ref - *image_virgin)) > threshold_ref) && (*smartmask)) {
+            if (*ref_dyn == 0) { /* Always give new pixels a chance. */
+                *ref_dyn = 1;
+            } else if (*ref_dyn > accept_timer) { /* Include static Object after some time. */
+                *ref_dyn = 0;
+                *ref = *image_virgin;
+            } else if (alg_motion_pixel(&cam->imgs, indx)) {
+                (*ref_dyn)++; /* Motionpixel? Keep excluding from ref frame. */
+            } else {
+                *ref_dyn = 0; /* Nothing special - release pixel. */
+                *ref = (*ref + *image_virgin) / 2;
+            }
+
+        } else {  /* No motion: copy to ref frame. */
+            *ref_dyn = 0; /* Reset pixel */
+            *ref = *image_virgin;
+        }
+
+        ref++;
+        image_virgin++;
+        smartmask++;
+        ref_dyn++;
+        indx++;
+    } /* end for i */
+}
+
 /**
  * alg_update_reference_frame
  *
@@ -1017,51 +1855,34 @@ void alg_lightswitch(struct ctx_cam *cam)
 void alg_update_reference_frame(struct ctx_cam *cam, int action)
 {
     int accept_timer = cam->lastrate * cam->conf->static_object_time;
-    int i, threshold_ref;
-    int *ref_dyn = cam->imgs.ref_dyn;
-    unsigned char *image_virgin = cam->imgs.image_vprvcy;
-    unsigned char *ref = cam->imgs.ref;
-    unsigned char *smartmask = cam->imgs.smartmask_final;
-    unsigned char *out = cam->imgs.image_motion.image_norm;
+    int i;
 
     if (cam->lastrate > 5) /* Match rate limit */
         accept_timer /= (cam->lastrate / 3);
 
-    if (action == UPDATE_REF_FRAME) { /* Black&white only for better performance. */
-        threshold_ref = cam->noise * EXCLUDE_LEVEL_PERCENT / 100;
-
-        for (i = cam->imgs.motionsize; i > 0; i--) {
-            /* Exclude pixels from ref frame well below noise level. */
-            if (((int)(abs(*ref - *image_virgin)) > threshold_ref) && (*smartmask)) {
-                if (*ref_dyn == 0) { /* Always give new pixels a chance. */
-                    *ref_dyn = 1;
-                } else if (*ref_dyn > accept_timer) { /* Include static Object after some time. */
-                    *ref_dyn = 0;
-                    *ref = *image_virgin;
-                } else if (*out) {
-                    (*ref_dyn)++; /* Motionpixel? Keep excluding from ref frame. */
-                } else {
-                    *ref_dyn = 0; /* Nothing special - release pixel. */
-                    *ref = (*ref + *image_virgin) / 2;
-                }
+    /* Keep the count of static frames within ref_dyn */
+    if (accept_timer > 65534)
+        accept_timer = 65534;
 
-            } else {  /* No motion: copy to ref frame. */
-                *ref_dyn = 0; /* Reset pixel */
-                *ref = *image_virgin;
+    if ((action == UPDATE_REF_FRAME) && (cam->conf->reference_rate > 0)) {
+        if (!cam->imgs.ref_averaged) {
+            for (i = 0; i < cam->imgs.motionsize; i++) {
+                cam->imgs.ref_average[i] = cam->imgs.ref[i] << 8;
             }
+            cam->imgs.ref_averaged = TRUE;
+        }
+        alg_pool_run(cam, alg_update_reference_average, &accept_timer);
 
-            ref++;
-            image_virgin++;
-            smartmask++;
-            ref_dyn++;
-            out++;
-        } /* end for i */
+    } else if (action == UPDATE_REF_FRAME) { /* Black&white only for better performance. */
+        cam->imgs.ref_averaged = FALSE;
+        alg_pool_run(cam, alg_update_reference_strip, &accept_timer);
 
     } else {   /* action == RESET_REF_FRAME - also used to initialize the frame at startup. */
         /* Copy fresh image */
         memcpy(cam->imgs.ref, cam->imgs.image_vprvcy, cam->imgs.size_norm);
         /* Reset static objects */
         memset(cam->imgs.ref_dyn, 0, cam->imgs.motionsize * sizeof(*cam->imgs.ref_dyn));
+        cam->imgs.ref_averaged = FALSE;
     }
 }
 
@@ -1074,31 +1895,75 @@ void alg_new_update_frame(ctx_cam *cam)
 
 }
 
+/*
+ * Count the changes in each row of a strip along with the sum of their x
+ * and x squared.  alg_new_location_moments adds up the rows afterwards.
+ */
+static void alg_new_location_rows(ctx_cam *cam, ctx_detect_strip *strip, void *arg)
+{
+    ctx_images *imgs = &cam->imgs;
+    uint64_t *row, val;
+    int64_t count, sum_x, sum_xx, x;
+    int y, indx;
+
+    (void)arg;
+
+    for (y = strip->row_start; y < strip->row_end; y++) {
+        row = imgs->motion_bits + (y * imgs->motion_bits_stride);
+        count = 0;
+        sum_x = 0;
+        sum_xx = 0;
+        for (indx = 0; indx < imgs->motion_bits_stride; indx++) {
+            val = row[indx];
+            while (val) {
+                x = (indx * 64) + __builtin_ctzll(val);
+                val &= (val - 1);
+                count++;
+                sum_x += x;
+                sum_xx += x * x;
+            }
+        }
+        imgs->location_rows[(y * 3)] = count;
+        imgs->location_rows[(y * 3) + 1] = sum_x;
+        imgs->location_rows[(y * 3) + 2] = sum_xx;
+    }
+}
+
+/* Add up the rows into the raw moments of the changes */
+static void alg_new_location_moments(ctx_images *imgs, LocationMoments *mom)
+{
+    int64_t count, sum_x, y;
+
+    memset(mom, 0, sizeof(LocationMoments));
+
+    for (y = 0; y < imgs->height; y++) {
+        count = imgs->location_rows[(y * 3)];
+        if (count == 0) {
+            continue;
+        }
+        sum_x = imgs->location_rows[(y * 3) + 1];
+        mom->count += count;
+        mom->sum_x += sum_x;
+        mom->sum_y += y * count;
+        mom->sum_xx += imgs->location_rows[(y * 3) + 2];
+        mom->sum_yy += y * y * count;
+        mom->sum_xy += y * sum_x;
+    }
+}
+
 /*Calculate the center location of changes*/
-static void alg_new_location_center(ctx_cam *cam)
+static void alg_new_location_center(ctx_cam *cam, LocationMoments *mom)
 {
     int width = cam->imgs.width;
     int height = cam->imgs.height;
     ctx_coord *cent = &cam->current_image->location;
-    unsigned char *out = cam->imgs.image_motion.image_norm;
-    int x, y, centc = 0;
 
     cent->x = 0;
     cent->y = 0;
 
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            if (*(out++)) {
-                cent->x += x;
-                cent->y += y;
-                centc++;
-            }
-        }
-    }
-
-    if (centc) {
-        cent->x = cent->x / centc;
-        cent->y = cent->y / centc;
+    if (mom->count) {
+        cent->x = (int)(mom->sum_x / mom->count);
+        cent->y = (int)(mom->sum_y / mom->count);
     }
 
     /* This allows for the redcross and boxes to be drawn*/
@@ -1109,85 +1974,55 @@ static void alg_new_location_center(ctx_cam *cam)
 
 }
 
-/*Calculate distribution and variances of changes*/
-static void alg_new_location_dist(ctx_cam *cam)
+/*
+ * Calculate distribution and variances of changes from the moments.
+ * The sums of the squared distances from the center are expanded so that
+ * no pass over the pixels is needed.  stddev_xy is the deviation along the
+ * major axis of the changes which also uses their covariance.  The box is
+ * 2.5 deviations each side of the center which is about the same as the
+ * three mean absolute deviations used previously.
+ */
+static void alg_new_location_dist(ctx_cam *cam, LocationMoments *mom)
 {
-    ctx_images *imgs = &cam->imgs;
     int width = cam->imgs.width;
     int height = cam->imgs.height;
     ctx_coord *cent = &cam->current_image->location;
-    unsigned char *out = imgs->image_motion.image_norm;
-    int x, y, centc = 0, xdist = 0, ydist = 0;
-    uint64_t variance_x, variance_y, variance_xy, distance_mean;
+    int64_t cx, cy, n, variance_x, variance_y, covariance;
+    double var_x, var_y, cov, major;
 
-    /* Note that the term variance refers to the statistical calulation.  It is
-     * not really precise however since we are using integers rather than floats.
-     * This is done to improve performance over the statistically correct
-     * calculation for mean and variance
-     */
     cent->maxx = 0;
     cent->maxy = 0;
     cent->minx = width;
     cent->miny = height;
-    variance_x = 0;
-    variance_y = 0;
-    distance_mean = 0;
+    cent->stddev_x = 0;
+    cent->stddev_y = 0;
+    cent->stddev_xy = 0;
 
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            if (*(out++)) {
-                variance_x += pow((x - cent->x),2);
-                variance_y += pow((y - cent->y),2);
-                /* ToDo: We should store this number for the variance calc...*/
-                distance_mean += sqrt(pow((x - cent->x), 2) + pow((y - cent->y), 2));
-
-                if (x > cent->x){
-                    xdist += x - cent->x;
-                } else if (x < cent->x){
-                    xdist += cent->x - x;
-                }
+    n = mom->count;
+    if (n == 0) {
+        return;
+    }
 
-                if (y > cent->y){
-                    ydist += y - cent->y;
-                } else if (y < cent->y){
-                    ydist += cent->y - y;
-                }
+    cx = cent->x;
+    cy = cent->y;
+    variance_x = mom->sum_xx - (2 * cx * mom->sum_x) + (n * cx * cx);
+    variance_y = mom->sum_yy - (2 * cy * mom->sum_y) + (n * cy * cy);
+    covariance = mom->sum_xy - (cx * mom->sum_y) - (cy * mom->sum_x) + (n * cx * cy);
 
-                centc++;
-            }
-        }
-    }
+    cent->stddev_x = sqrt(variance_x / n);
+    cent->stddev_y = sqrt(variance_y / n);
 
-    if (centc) {
-        cent->minx = cent->x - xdist / centc * 3;
-        cent->maxx = cent->x + xdist / centc * 3;
-        cent->miny = cent->y - ydist / centc * 3;
-        cent->maxy = cent->y + ydist / centc * 3;
-        cent->stddev_x = sqrt((variance_x / centc));
-        cent->stddev_y = sqrt((variance_y / centc));
-        distance_mean = (distance_mean / centc);
-    } else {
-        cent->stddev_y = 0;
-        cent->stddev_x = 0;
-        distance_mean = 0;
-    }
+    var_x = (double)variance_x / n;
+    var_y = (double)variance_y / n;
+    cov = (double)covariance / n;
+    major = ((var_x + var_y) / 2) + sqrt(pow((var_x - var_y) / 2, 2) + pow(cov, 2));
+    cent->stddev_xy = sqrt(major);
+
+    cent->minx = cent->x - (cent->stddev_x * 5) / 2;
+    cent->maxx = cent->x + (cent->stddev_x * 5) / 2;
+    cent->miny = cent->y - (cent->stddev_y * 5) / 2;
+    cent->maxy = cent->y + (cent->stddev_y * 5) / 2;
 
-    variance_xy = 0;
-    out = imgs->image_motion.image_norm;
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            if (*(out++)) {
-                variance_xy += pow(
-                    sqrt(pow((x - cent->x), 2) + pow((y - cent->y), 2)) -
-                        distance_mean,
-                    2);
-            }
-        }
-    }
-    /* Per statistics, divide by n-1 for calc of a standard deviation */
-    if ((centc-1) > 0) {
-        cent->stddev_xy = sqrt((variance_xy / (centc-1)));
-    }
 }
 
 /* Ensure min/max are within limits*/
@@ -1236,10 +2071,20 @@ static void alg_new_location_minmax(ctx_cam *cam)
 /* Determine the location and standard deviations of changes*/
 static void alg_new_location(ctx_cam *cam)
 {
+    LocationMoments mom;
+
+    /* The moments are taken from the packed copy of the image */
+    if (!cam->imgs.motion_packed) {
+        alg_bits_pack(cam);
+    }
 
-    alg_new_location_center(cam);
+    alg_pool_run(cam, alg_new_location_rows, NULL);
 
-    alg_new_location_dist(cam);
+    alg_new_location_moments(&cam->imgs, &mom);
+
+    alg_new_location_center(cam, &mom);
+
+    alg_new_location_dist(cam, &mom);
 
     alg_new_location_minmax(cam);
 }
@@ -1316,43 +2161,20 @@ static void alg_new_stddev(ctx_cam *cam)
 static void alg_new_diff_base(ctx_cam *cam)
 {
 
-    ctx_images *imgs = &cam->imgs;
-    int indx = 0;
-    int indx_en = imgs->motionsize;
-    long diffs = 0;
-    long diffs_net = 0;
-    int noise = cam->noise;
-    unsigned char *ref = imgs->ref;
-    unsigned char *out = imgs->image_motion.image_norm;
-    unsigned char *mask = imgs->mask;
-    unsigned char *new_var = cam->imgs.image_vprvcy;
-    unsigned char curdiff;
+    long diffs, diffs_net;
+    int diffs_pos;
 
-    memset(out + indx_en, 128, indx_en / 2); /* Motion pictures are now b/w i.o. green */
-    memset(out, 0, indx_en);
+    alg_motion_chroma(cam);
+
+    /* Motion pictures are now b/w i.o. green */
+    diffs_pos = 0;
+    diffs = alg_diff_blocks(cam, NULL, NULL, &diffs_pos);
 
-    for (indx = 0; indx < indx_en; indx++) {
-        curdiff = (int)(abs(*ref - *new_var));
-        if (mask) {
-            curdiff = ((int)(curdiff * *mask++) / 255);
-        }
-        if (curdiff > noise) {
-            *out = *new_var;
-            diffs++;
-            if ((int)(*ref - *new_var) > 0) {
-                diffs_net++;
-            } else {
-                diffs_net--;
-            }
-        }
-        out++;
-        ref++;
-        new_var++;
-    }
     cam->current_image->diffs_raw = diffs;
     cam->current_image->diffs = diffs;
 
-    diffs_net = abs(diffs_net);
+    /* Pixels darker than the reference count up and the brighter ones down */
+    diffs_net = abs((2 * diffs_pos) - diffs);
     if (diffs_net > 0 ) {
         cam->current_image->diffs_ratio = (diffs *10) / diffs_net;
     } else {
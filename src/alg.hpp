@@ -21,15 +21,56 @@
 #define _INCLUDE_ALG_H
 
     struct ctx_coord;
+    struct ctx_detect_pool;
+    struct ctx_detect_strip;
+
+    #define DETECT_STRIPS_MAX 16
+
+    typedef void (*detect_job)(struct ctx_cam *cam, struct ctx_detect_strip *strip, void *arg);
+
+    struct ctx_detect_strip {
+        struct ctx_detect_pool  *pool;
+        int                     row_start;      /* First row of the strip */
+        int                     row_end;        /* Row after the last row of the strip */
+        int                     label_start;    /* First provisional label for the strip */
+        int                     label_next;     /* Next unused provisional label */
+        int                     count;          /* Count from the strip added up after the job */
+        int                     count_pos;      /* Diffs of the strip where the reference was brighter */
+        int64_t                 sum;            /* Sum from the strip added up after the job */
+        int                     *histogram;     /* Luma histogram of the strip */
+        unsigned char           *buffer;        /* Rows for the erode filters followed by the halo rows */
+    };
+
+    struct ctx_detect_pool {
+        pthread_t               thread[DETECT_STRIPS_MAX];
+        int                     thread_cnt;     /* Worker threads started */
+        pthread_mutex_t         mutex;
+        pthread_cond_t          cond_start;
+        pthread_cond_t          cond_done;
+        int                     finish;         /* Tell the workers to exit */
+        int                     job_nbr;        /* Incremented for each job */
+        int                     pending;        /* Strips of the job still running */
+        int                     strip_cnt;      /* Strips of the current job */
+        detect_job              job;
+        void                    *job_arg;
+        struct ctx_cam          *cam;
+        struct ctx_detect_strip strip[DETECT_STRIPS_MAX];
+    };
 
     void alg_locate_center_size(struct ctx_images *, int width, int height, struct ctx_coord *);
     void alg_diff(struct ctx_cam *cam);
+    void alg_histogram(struct ctx_cam *cam);
+    void alg_histogram_roll(struct ctx_cam *cam, int skip);
+    int alg_lightswitch_histogram(struct ctx_cam *cam);
     void alg_lightswitch(struct ctx_cam *cam);
-    void alg_noise_tune(struct ctx_cam *cam, unsigned char *);
+    void alg_noise_tune(struct ctx_cam *cam);
     void alg_threshold_tune(struct ctx_cam *cam, int, int);
     void alg_despeckle(struct ctx_cam *cam);
     void alg_tune_smartmask(struct ctx_cam *cam);
     void alg_update_reference_frame(struct ctx_cam *cam, int);
+    void alg_motion_unpack(struct ctx_images *imgs);
+    void alg_pool_init(struct ctx_cam *cam);
+    void alg_pool_deinit(struct ctx_cam *cam);
 
     void alg_new_update_frame(ctx_cam *cam);
     void alg_new_diff(ctx_cam *cam);
@@ -0,0 +1,676 @@
+/*
+ *    This file is part of MotionPlus.
+ *
+ *    MotionPlus is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    MotionPlus is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with MotionPlus.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *    Copyright 2020 MotionMrDave@gmail.com
+ */
+
+/*
+ * Single pass kernels for the per pixel loops of the motion detection.
+ * The _c functions are the reference implementations and every vectorized
+ * kernel here must give the same results as they do.
+ * The kernel is selected once at startup based upon the running cpu.
+ */
+
+#include "motionplus.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "alg_simd.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define ALGSIMD_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define ALGSIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+/* The vector loops count the motion of each block from 16 pixels at a time */
+static_assert(MOTION_BLOCK_SIZE == 16, "alg_simd needs a MOTION_BLOCK_SIZE of 16");
+
+typedef int (*algsimd_diff_fn)(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks);
+
+typedef void (*algsimd_histogram_fn)(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count);
+
+static enum SIMD_TYPE algsimd_selected = SIMD_TYPE_NONE;
+static algsimd_diff_fn algsimd_diff_kernel = NULL;
+static algsimd_histogram_fn algsimd_histogram_kernel = NULL;
+
+/*
+ * Scalar version of the difference.  It is used when there is no vector
+ * unit, for the pixels left over at the end of the vector loops and for
+ * noise levels outside of a byte.  The mask, smart mask and buffer
+ * are all optional with NULL meaning the item is not in use.
+ */
+static int algsimd_diff_c(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks)
+{
+    int indx, curdiff, diffs, pos;
+
+    diffs = 0;
+    pos = 0;
+    for (indx = 0; indx < count; indx++) {
+        curdiff = abs(ref[indx] - new_img[indx]);
+        if (mask) {
+            curdiff = ((curdiff * mask[indx]) / 255);
+        }
+        if (curdiff > noise) {
+            if (smartmask_buffer) {
+                if (smartmask_buffer[indx] > (0xFFFF - SMARTMASK_SENSITIVITY_INCR)) {
+                    smartmask_buffer[indx] = 0xFFFF;
+                } else {
+                    smartmask_buffer[indx] += SMARTMASK_SENSITIVITY_INCR;
+                }
+            }
+            if ((smartmask_final) && (smartmask_final[indx] == 0)) {
+                curdiff = 0;
+            }
+        }
+        if (curdiff > noise) {
+            out[indx] = new_img[indx];
+            diffs++;
+            if (ref[indx] > new_img[indx]) {
+                pos++;
+            }
+            if (blocks) {
+                blocks[indx / MOTION_BLOCK_SIZE]++;
+            }
+        } else {
+            out[indx] = 0;
+        }
+    }
+
+    if (diffs_pos) {
+        *diffs_pos += pos;
+    }
+
+    return diffs;
+}
+
+/*
+ * Scalar version of the histogram.  Each pixel of new_img is counted
+ * into the histogram and the pixels where smartmask_final is set add
+ * their difference from ref, scaled by the optional mask, plus one into
+ * diff_sum.
+ */
+static void algsimd_histogram_c(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count)
+{
+    int indx, curdiff, cnt;
+    int64_t sum;
+
+    sum = 0;
+    cnt = 0;
+    for (indx = 0; indx < count; indx++) {
+        histogram[new_img[indx]]++;
+        if ((smartmask_final == NULL) || (smartmask_final[indx] != 0)) {
+            curdiff = abs(ref[indx] - new_img[indx]);
+            if (mask) {
+                curdiff = ((curdiff * mask[indx]) / 255);
+            }
+            sum += curdiff + 1;
+            cnt++;
+        }
+    }
+
+    *diff_sum += sum;
+    *diff_count += cnt;
+}
+
+#if defined(ALGSIMD_X86) || defined(ALGSIMD_NEON)
+
+/*
+ * Count the pixels into four histograms in turn so that neighbouring
+ * pixels of the same level do not wait upon each other's increment.
+ */
+static inline void algsimd_hist4(int (*hist)[256], unsigned char *pix, int count)
+{
+    int indx;
+
+    for (indx = 0; indx + 4 <= count; indx += 4) {
+        hist[0][pix[indx]]++;
+        hist[1][pix[indx + 1]]++;
+        hist[2][pix[indx + 2]]++;
+        hist[3][pix[indx + 3]]++;
+    }
+}
+
+static inline void algsimd_hist4_merge(int *histogram, int (*hist)[256])
+{
+    int indx;
+
+    for (indx = 0; indx < 256; indx++) {
+        histogram[indx] += hist[0][indx] + hist[1][indx] + hist[2][indx] + hist[3][indx];
+    }
+}
+
+#endif
+
+#ifdef ALGSIMD_X86
+
+/* Scale the difference by the mask value.  (x * 0x8081) >> 23 is x / 255 for 16 bit x */
+__attribute__((target("sse2")))
+static inline __m128i algsimd_mask_sse2(__m128i curdiff, __m128i mask)
+{
+    __m128i zero, lo, hi, div;
+
+    zero = _mm_setzero_si128();
+    div = _mm_set1_epi16((short)0x8081);
+
+    lo = _mm_mullo_epi16(_mm_unpacklo_epi8(curdiff, zero), _mm_unpacklo_epi8(mask, zero));
+    hi = _mm_mullo_epi16(_mm_unpackhi_epi8(curdiff, zero), _mm_unpackhi_epi8(mask, zero));
+    lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div), 7);
+    hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div), 7);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* Add the sensitivity increment to the smartmask_buffer of the 16 pixels in motion */
+__attribute__((target("sse2")))
+static inline void algsimd_smartbuf_sse2(unsigned short *smartmask_buffer, __m128i motion)
+{
+    __m128i incr, lo, hi;
+
+    incr = _mm_set1_epi16(SMARTMASK_SENSITIVITY_INCR);
+    lo = _mm_and_si128(_mm_unpacklo_epi8(motion, motion), incr);
+    hi = _mm_and_si128(_mm_unpackhi_epi8(motion, motion), incr);
+
+    _mm_storeu_si128((__m128i *)smartmask_buffer
+        , _mm_adds_epu16(_mm_loadu_si128((__m128i *)smartmask_buffer), lo));
+    _mm_storeu_si128((__m128i *)(smartmask_buffer + 8)
+        , _mm_adds_epu16(_mm_loadu_si128((__m128i *)(smartmask_buffer + 8)), hi));
+}
+
+__attribute__((target("sse2")))
+static int algsimd_diff_sse2(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks)
+{
+    __m128i vref, vnew, curdiff, motion, zero, ones, vnoise;
+    int indx, bits, diffs, pos;
+
+    zero = _mm_setzero_si128();
+    ones = _mm_cmpeq_epi8(zero, zero);
+    vnoise = _mm_set1_epi8((char)noise);
+    diffs = 0;
+    pos = 0;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vref = _mm_loadu_si128((__m128i *)(ref + indx));
+        vnew = _mm_loadu_si128((__m128i *)(new_img + indx));
+        curdiff = _mm_or_si128(_mm_subs_epu8(vref, vnew), _mm_subs_epu8(vnew, vref));
+        if (mask) {
+            curdiff = algsimd_mask_sse2(curdiff
+                , _mm_loadu_si128((__m128i *)(mask + indx)));
+        }
+        /* curdiff > noise is the same as the saturated subtraction being non zero */
+        motion = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(curdiff, vnoise), zero), ones);
+
+        if (smartmask_buffer && _mm_movemask_epi8(motion)) {
+            algsimd_smartbuf_sse2(smartmask_buffer + indx, motion);
+        }
+        if (smartmask_final) {
+            motion = _mm_andnot_si128(_mm_cmpeq_epi8(
+                _mm_loadu_si128((__m128i *)(smartmask_final + indx)), zero), motion);
+        }
+
+        _mm_storeu_si128((__m128i *)(out + indx), _mm_and_si128(motion, vnew));
+
+        bits = _mm_movemask_epi8(motion);
+        if (bits) {
+            diffs += __builtin_popcount(bits);
+            if (blocks) {
+                blocks[indx / MOTION_BLOCK_SIZE] += __builtin_popcount(bits);
+            }
+            if (diffs_pos) {
+                pos += __builtin_popcount(bits &
+                    ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(vref, vnew), zero)));
+            }
+        }
+    }
+
+    if (diffs_pos) {
+        *diffs_pos += pos;
+    }
+
+    return diffs + algsimd_diff_c(ref + indx, new_img + indx, out + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , (smartmask_buffer ? smartmask_buffer + indx : NULL)
+        , noise, count - indx, diffs_pos
+        , (blocks ? blocks + (indx / MOTION_BLOCK_SIZE) : NULL));
+}
+
+__attribute__((target("sse2")))
+static void algsimd_histogram_sse2(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count)
+{
+    __m128i vref, vnew, curdiff, inuse, zero, ones, sums;
+    int64_t lanes[2];
+    int hist[4][256];
+    int indx, cnt;
+
+    memset(hist, 0, sizeof(hist));
+    zero = _mm_setzero_si128();
+    ones = _mm_cmpeq_epi8(zero, zero);
+    sums = _mm_setzero_si128();
+    inuse = ones;
+    cnt = 0;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        algsimd_hist4(hist, new_img + indx, 16);
+
+        vref = _mm_loadu_si128((__m128i *)(ref + indx));
+        vnew = _mm_loadu_si128((__m128i *)(new_img + indx));
+        curdiff = _mm_or_si128(_mm_subs_epu8(vref, vnew), _mm_subs_epu8(vnew, vref));
+        if (mask) {
+            curdiff = algsimd_mask_sse2(curdiff
+                , _mm_loadu_si128((__m128i *)(mask + indx)));
+        }
+        if (smartmask_final) {
+            inuse = _mm_xor_si128(_mm_cmpeq_epi8(
+                _mm_loadu_si128((__m128i *)(smartmask_final + indx)), zero), ones);
+            curdiff = _mm_and_si128(curdiff, inuse);
+        }
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(curdiff, zero));
+        cnt += __builtin_popcount(_mm_movemask_epi8(inuse));
+    }
+
+    algsimd_hist4_merge(histogram, hist);
+    _mm_storeu_si128((__m128i *)lanes, sums);
+    *diff_sum += lanes[0] + lanes[1] + cnt;
+    *diff_count += cnt;
+
+    algsimd_histogram_c(ref + indx, new_img + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , count - indx, histogram, diff_sum, diff_count);
+}
+
+/* Scale the difference by the mask value.  Unpack and pack stay within each 128 bit lane */
+__attribute__((target("avx2")))
+static inline __m256i algsimd_mask_avx2(__m256i curdiff, __m256i mask)
+{
+    __m256i zero, lo, hi, div;
+
+    zero = _mm256_setzero_si256();
+    div = _mm256_set1_epi16((short)0x8081);
+
+    lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(curdiff, zero), _mm256_unpacklo_epi8(mask, zero));
+    hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(curdiff, zero), _mm256_unpackhi_epi8(mask, zero));
+    lo = _mm256_srli_epi16(_mm256_mulhi_epu16(lo, div), 7);
+    hi = _mm256_srli_epi16(_mm256_mulhi_epu16(hi, div), 7);
+
+    return _mm256_packus_epi16(lo, hi);
+}
+
+/* Add the sensitivity increment to the smartmask_buffer of the 32 pixels in motion */
+__attribute__((target("avx2")))
+static inline void algsimd_smartbuf_avx2(unsigned short *smartmask_buffer, __m256i motion)
+{
+    __m256i incr, lo, hi;
+
+    incr = _mm256_set1_epi16(SMARTMASK_SENSITIVITY_INCR);
+    lo = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(motion)), incr);
+    hi = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(motion, 1)), incr);
+
+    _mm256_storeu_si256((__m256i *)smartmask_buffer
+        , _mm256_adds_epu16(_mm256_loadu_si256((__m256i *)smartmask_buffer), lo));
+    _mm256_storeu_si256((__m256i *)(smartmask_buffer + 16)
+        , _mm256_adds_epu16(_mm256_loadu_si256((__m256i *)(smartmask_buffer + 16)), hi));
+}
+
+__attribute__((target("avx2")))
+static int algsimd_diff_avx2(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks)
+{
+    __m256i vref, vnew, curdiff, motion, zero, ones, vnoise;
+    int indx, diffs, pos;
+    unsigned int bits;
+
+    zero = _mm256_setzero_si256();
+    ones = _mm256_cmpeq_epi8(zero, zero);
+    vnoise = _mm256_set1_epi8((char)noise);
+    diffs = 0;
+    pos = 0;
+
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        vref = _mm256_loadu_si256((__m256i *)(ref + indx));
+        vnew = _mm256_loadu_si256((__m256i *)(new_img + indx));
+        curdiff = _mm256_or_si256(_mm256_subs_epu8(vref, vnew), _mm256_subs_epu8(vnew, vref));
+        if (mask) {
+            curdiff = algsimd_mask_avx2(curdiff
+                , _mm256_loadu_si256((__m256i *)(mask + indx)));
+        }
+        motion = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(curdiff, vnoise), zero), ones);
+
+        if (smartmask_buffer && _mm256_movemask_epi8(motion)) {
+            algsimd_smartbuf_avx2(smartmask_buffer + indx, motion);
+        }
+        if (smartmask_final) {
+            motion = _mm256_andnot_si256(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((__m256i *)(smartmask_final + indx)), zero), motion);
+        }
+
+        _mm256_storeu_si256((__m256i *)(out + indx), _mm256_and_si256(motion, vnew));
+
+        bits = (unsigned int)_mm256_movemask_epi8(motion);
+        if (bits) {
+            diffs += __builtin_popcount(bits);
+            if (blocks) {
+                blocks[indx / MOTION_BLOCK_SIZE] += __builtin_popcount(bits & 0xFFFF);
+                blocks[(indx / MOTION_BLOCK_SIZE) + 1] += __builtin_popcount(bits >> 16);
+            }
+            if (diffs_pos) {
+                pos += __builtin_popcount(bits & ~(unsigned int)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_subs_epu8(vref, vnew), zero)));
+            }
+        }
+    }
+
+    if (diffs_pos) {
+        *diffs_pos += pos;
+    }
+
+    return diffs + algsimd_diff_c(ref + indx, new_img + indx, out + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , (smartmask_buffer ? smartmask_buffer + indx : NULL)
+        , noise, count - indx, diffs_pos
+        , (blocks ? blocks + (indx / MOTION_BLOCK_SIZE) : NULL));
+}
+
+__attribute__((target("avx2")))
+static void algsimd_histogram_avx2(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count)
+{
+    __m256i vref, vnew, curdiff, inuse, zero, ones, sums;
+    int64_t lanes[2];
+    int hist[4][256];
+    int indx, cnt;
+
+    memset(hist, 0, sizeof(hist));
+    zero = _mm256_setzero_si256();
+    ones = _mm256_cmpeq_epi8(zero, zero);
+    sums = _mm256_setzero_si256();
+    inuse = ones;
+    cnt = 0;
+
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        algsimd_hist4(hist, new_img + indx, 32);
+
+        vref = _mm256_loadu_si256((__m256i *)(ref + indx));
+        vnew = _mm256_loadu_si256((__m256i *)(new_img + indx));
+        curdiff = _mm256_or_si256(_mm256_subs_epu8(vref, vnew), _mm256_subs_epu8(vnew, vref));
+        if (mask) {
+            curdiff = algsimd_mask_avx2(curdiff
+                , _mm256_loadu_si256((__m256i *)(mask + indx)));
+        }
+        if (smartmask_final) {
+            inuse = _mm256_xor_si256(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((__m256i *)(smartmask_final + indx)), zero), ones);
+            curdiff = _mm256_and_si256(curdiff, inuse);
+        }
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(curdiff, zero));
+        cnt += __builtin_popcount((unsigned int)_mm256_movemask_epi8(inuse));
+    }
+
+    algsimd_hist4_merge(histogram, hist);
+    _mm_storeu_si128((__m128i *)lanes
+        , _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1)));
+    *diff_sum += lanes[0] + lanes[1] + cnt;
+    *diff_count += cnt;
+
+    algsimd_histogram_c(ref + indx, new_img + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , count - indx, histogram, diff_sum, diff_count);
+}
+
+#endif /* ALGSIMD_X86 */
+
+#ifdef ALGSIMD_NEON
+
+/* Sum the lanes that are set in a 0x00/0xFF byte vector */
+static inline int algsimd_count_neon(uint8x16_t motion)
+{
+    uint64x2_t sum;
+
+    sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vshrq_n_u8(motion, 7))));
+
+    return (int)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+}
+
+/* Scale the difference by the mask value.  (x + 1 + (x >> 8)) >> 8 is x / 255 here */
+static inline uint8x16_t algsimd_mask_neon(uint8x16_t curdiff, uint8x16_t mask)
+{
+    uint16x8_t lo, hi, one;
+
+    one = vdupq_n_u16(1);
+    lo = vmull_u8(vget_low_u8(curdiff), vget_low_u8(mask));
+    hi = vmull_u8(vget_high_u8(curdiff), vget_high_u8(mask));
+    lo = vshrq_n_u16(vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8)), 8);
+    hi = vshrq_n_u16(vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8)), 8);
+
+    return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+/* Add the sensitivity increment to the smartmask_buffer of the 16 pixels in motion */
+static inline void algsimd_smartbuf_neon(unsigned short *smartmask_buffer, uint8x16_t motion)
+{
+    uint16x8_t lo, hi, incr;
+
+    incr = vdupq_n_u16(SMARTMASK_SENSITIVITY_INCR);
+    lo = vandq_u16(vreinterpretq_u16_s16(vmovl_s8(vget_low_s8(vreinterpretq_s8_u8(motion)))), incr);
+    hi = vandq_u16(vreinterpretq_u16_s16(vmovl_s8(vget_high_s8(vreinterpretq_s8_u8(motion)))), incr);
+
+    vst1q_u16(smartmask_buffer, vqaddq_u16(vld1q_u16(smartmask_buffer), lo));
+    vst1q_u16(smartmask_buffer + 8, vqaddq_u16(vld1q_u16(smartmask_buffer + 8), hi));
+}
+
+static int algsimd_diff_neon(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks)
+{
+    uint8x16_t vref, vnew, curdiff, motion, vnoise;
+    int indx, bits, diffs, pos;
+
+    vnoise = vdupq_n_u8((uint8_t)noise);
+    diffs = 0;
+    pos = 0;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vref = vld1q_u8(ref + indx);
+        vnew = vld1q_u8(new_img + indx);
+        curdiff = vabdq_u8(vref, vnew);
+        if (mask) {
+            curdiff = algsimd_mask_neon(curdiff, vld1q_u8(mask + indx));
+        }
+        motion = vcgtq_u8(curdiff, vnoise);
+
+        if (smartmask_buffer) {
+            algsimd_smartbuf_neon(smartmask_buffer + indx, motion);
+        }
+        if (smartmask_final) {
+            motion = vandq_u8(motion, vtstq_u8(vld1q_u8(smartmask_final + indx)
+                , vld1q_u8(smartmask_final + indx)));
+        }
+
+        vst1q_u8(out + indx, vandq_u8(motion, vnew));
+
+        bits = algsimd_count_neon(motion);
+        diffs += bits;
+        if (blocks) {
+            blocks[indx / MOTION_BLOCK_SIZE] += bits;
+        }
+        if (diffs_pos) {
+            pos += algsimd_count_neon(vandq_u8(motion, vcgtq_u8(vref, vnew)));
+        }
+    }
+
+    if (diffs_pos) {
+        *diffs_pos += pos;
+    }
+
+    return diffs + algsimd_diff_c(ref + indx, new_img + indx, out + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , (smartmask_buffer ? smartmask_buffer + indx : NULL)
+        , noise, count - indx, diffs_pos
+        , (blocks ? blocks + (indx / MOTION_BLOCK_SIZE) : NULL));
+}
+
+static void algsimd_histogram_neon(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count)
+{
+    uint8x16_t vref, vnew, curdiff, inuse;
+    uint64x2_t sums;
+    int hist[4][256];
+    int indx, cnt;
+
+    memset(hist, 0, sizeof(hist));
+    sums = vdupq_n_u64(0);
+    inuse = vdupq_n_u8(0xFF);
+    cnt = 0;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        algsimd_hist4(hist, new_img + indx, 16);
+
+        vref = vld1q_u8(ref + indx);
+        vnew = vld1q_u8(new_img + indx);
+        curdiff = vabdq_u8(vref, vnew);
+        if (mask) {
+            curdiff = algsimd_mask_neon(curdiff, vld1q_u8(mask + indx));
+        }
+        if (smartmask_final) {
+            inuse = vtstq_u8(vld1q_u8(smartmask_final + indx), vld1q_u8(smartmask_final + indx));
+            curdiff = vandq_u8(curdiff, inuse);
+        }
+        sums = vpadalq_u32(sums, vpaddlq_u16(vpaddlq_u8(curdiff)));
+        cnt += algsimd_count_neon(inuse);
+    }
+
+    algsimd_hist4_merge(histogram, hist);
+    *diff_sum += (int64_t)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1)) + cnt;
+    *diff_count += cnt;
+
+    algsimd_histogram_c(ref + indx, new_img + indx
+        , (mask ? mask + indx : NULL)
+        , (smartmask_final ? smartmask_final + indx : NULL)
+        , count - indx, histogram, diff_sum, diff_count);
+}
+
+#endif /* ALGSIMD_NEON */
+
+/** Select the kernels to use for the cpu we are running upon */
+void algsimd_init(void)
+{
+    algsimd_selected = mysimd_type();
+
+    #ifdef ALGSIMD_X86
+        if (algsimd_selected == SIMD_TYPE_AVX2) {
+            algsimd_diff_kernel = algsimd_diff_avx2;
+            algsimd_histogram_kernel = algsimd_histogram_avx2;
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Motion detection using AVX2"));
+            return;
+        } else if (algsimd_selected == SIMD_TYPE_SSE2) {
+            algsimd_diff_kernel = algsimd_diff_sse2;
+            algsimd_histogram_kernel = algsimd_histogram_sse2;
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Motion detection using SSE2"));
+            return;
+        }
+    #endif
+
+    #ifdef ALGSIMD_NEON
+        if (algsimd_selected == SIMD_TYPE_NEON) {
+            algsimd_diff_kernel = algsimd_diff_neon;
+            algsimd_histogram_kernel = algsimd_histogram_neon;
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Motion detection using NEON"));
+            return;
+        }
+    #endif
+
+    algsimd_selected = SIMD_TYPE_NONE;
+    algsimd_diff_kernel = NULL;
+    algsimd_histogram_kernel = NULL;
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Motion detection using scalar functions"));
+}
+
+/** Return the instruction set selected for the kernels */
+enum SIMD_TYPE algsimd_type(void)
+{
+    return algsimd_selected;
+}
+
+/**
+ * algsimd_diff
+ *
+ *   Calculate the difference between ref and new_img for count pixels.
+ *   Pixels over the noise level get the value from new_img in out and
+ *   all the others are set to zero.  The optional mask is applied to
+ *   the difference.  If smartmask_final is provided, the pixels where it
+ *   is zero are not counted and when smartmask_buffer is provided it is
+ *   incremented for every pixel over the noise level, saturating at 0xFFFF.  When diffs_pos is
+ *   provided it is incremented by the pixels in motion that are darker
+ *   than the reference.  When blocks is provided, the count of pixels in
+ *   motion for each MOTION_BLOCK_SIZE run of pixels is added to it.  The
+ *   vector loops rely upon the block size being exactly 16.
+ *
+ *   Returns the number of pixels in motion
+ */
+int algsimd_diff(unsigned char *ref, unsigned char *new_img, unsigned char *out
+    , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+    , int noise, int count, int *diffs_pos, int *blocks)
+{
+    if ((algsimd_diff_kernel == NULL) || (noise < 0) || (noise > 255)) {
+        return algsimd_diff_c(ref, new_img, out, mask, smartmask_final
+            , smartmask_buffer, noise, count, diffs_pos, blocks);
+    }
+
+    return algsimd_diff_kernel(ref, new_img, out, mask, smartmask_final
+        , smartmask_buffer, noise, count, diffs_pos, blocks);
+}
+
+/**
+ * algsimd_histogram
+ *
+ *   Count each of the count pixels of new_img into the 256 levels of
+ *   histogram.  For the pixels where smartmask_final is set, or all of
+ *   them when it is NULL, the difference from ref scaled by the optional
+ *   mask plus one is added to diff_sum and the pixel to diff_count.
+ */
+void algsimd_histogram(unsigned char *ref, unsigned char *new_img
+    , unsigned char *mask, unsigned char *smartmask_final, int count
+    , int *histogram, int64_t *diff_sum, int *diff_count)
+{
+    if (algsimd_histogram_kernel == NULL) {
+        algsimd_histogram_c(ref, new_img, mask, smartmask_final
+            , count, histogram, diff_sum, diff_count);
+        return;
+    }
+
+    algsimd_histogram_kernel(ref, new_img, mask, smartmask_final
+        , count, histogram, diff_sum, diff_count);
+}
@@ -0,0 +1,35 @@
+/*
+ *    This file is part of MotionPlus.
+ *
+ *    MotionPlus is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    MotionPlus is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with MotionPlus.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *    Copyright 2020 MotionMrDave@gmail.com
+ */
+
+#ifndef _INCLUDE_ALG_SIMD_H
+#define _INCLUDE_ALG_SIMD_H
+
+/* Increment for *smartmask_buffer in alg_diff_standard. */
+#define SMARTMASK_SENSITIVITY_INCR 5
+
+    void algsimd_init(void);
+    enum SIMD_TYPE algsimd_type(void);
+    int algsimd_diff(unsigned char *ref, unsigned char *new_img, unsigned char *out
+        , unsigned char *mask, unsigned char *smartmask_final, unsigned short *smartmask_buffer
+        , int noise, int count, int *diffs_pos, int *blocks);
+    void algsimd_histogram(unsigned char *ref, unsigned char *new_img
+        , unsigned char *mask, unsigned char *smartmask_final, int count
+        , int *histogram, int64_t *diff_sum, int *diff_count);
+
+#endif /* _INCLUDE_ALG_SIMD_H */
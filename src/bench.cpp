@@ -0,0 +1,756 @@
+/*
+ *    This file is part of MotionPlus.
+ *
+ *    MotionPlus is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    MotionPlus is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with MotionPlus.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *    Copyright 2020 MotionMrDave@gmail.com
+ */
+
+/*
+ * motionplus-bench
+ *
+ * Offline timing of the per frame image processing.  Raw YUV420P frames
+ * from a file, or made up frames of a moving box over a noisy background,
+ * are run through the histogram, detection, rotate, text and jpeg stages
+ * one after another and the time of each stage is reported per resolution.
+ *
+ * With -p the pixel format conversions of video_common.cpp are timed
+ * instead, with the scalar kernels and with the kernels of each instruction
+ * set the cpu runs (SSE2, AVX2 or NEON), and the outputs are compared at
+ * the given sizes and at every even width up to 66 pixels.
+ *
+ * The bandwidth is an estimate from the bytes each stage reads and writes
+ * for each pixel of the luma plane and not a measurement of the memory bus.
+ *
+ * Usage: motionplus-bench [-c conf] [-f file.yuv] [-s WxH]... [-n frames] [-o parm=value]... [-p]
+ */
+
+#include "motionplus.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "alg.hpp"
+#include "alg_simd.hpp"
+#include "rotate.hpp"
+#include "draw.hpp"
+#include "jpegutils.hpp"
+#include "video_common.hpp"
+
+pthread_key_t tls_key_threadnr;
+
+#define BENCH_SIZES_MAX     8
+#define BENCH_FRAMES_DFLT   200
+#define BENCH_PARMS_MAX     32
+
+enum BENCH_STAGE {
+    BENCH_HISTOGRAM,
+    BENCH_DIFF,
+    BENCH_DESPECKLE,
+    BENCH_NEW_DIFF,
+    BENCH_ROTATE,
+    BENCH_TEXT,
+    BENCH_JPEG,
+    BENCH_STAGE_CNT
+};
+
+struct ctx_bench_stage {
+    const char      *name;
+    double          bytes;          /* Estimated bytes read and written for each pixel */
+    int64_t         nsec;           /* Time spent in the stage over all frames */
+};
+
+struct ctx_bench_convert {
+    const char      *name;
+    void            (*convert)(unsigned char *img_dst, unsigned char *img_src, int width, int height);
+};
+
+struct ctx_bench {
+    struct ctx_motapp       *motapp;
+    struct ctx_cam          *cam;
+    std::string             filename;
+    FILE                    *fp;
+    int                     frames;
+    int                     size_cnt;
+    int                     width[BENCH_SIZES_MAX];
+    int                     height[BENCH_SIZES_MAX];
+    int                     convert;        /* Bool for timing the pixel format conversions */
+    int                     parm_cnt;
+    std::string             parms[BENCH_PARMS_MAX];
+    unsigned char           *background;    /* Noise the synthetic frames are made from */
+    unsigned char           *image;         /* The frame being processed */
+    unsigned char           *image_out;     /* Copy of the frame for rotate, text and jpeg */
+    unsigned char           *jpeg;
+    int                     jpeg_size;      /* Bytes of jpeg written over all frames */
+    struct ctx_bench_stage  stage[BENCH_STAGE_CNT];
+};
+
+static void bench_usage(void)
+{
+
+    printf("Usage: motionplus-bench [options]\n");
+    printf("  -c file      Camera config file to take the parameters from\n");
+    printf("  -f file      Raw YUV420P frames to replay instead of synthetic frames\n");
+    printf("  -s WxH       Resolution to time.  May be repeated\n");
+    printf("  -n frames    Frames to process at each resolution (default %d)\n", BENCH_FRAMES_DFLT);
+    printf("  -o parm=val  Set a config parameter.  May be repeated\n");
+    printf("  -p           Time and compare the pixel format conversions\n");
+    printf("  -h           Show this help\n");
+
+}
+
+static int bench_add_size(struct ctx_bench *bench, int width, int height)
+{
+
+    if (bench->size_cnt >= BENCH_SIZES_MAX) {
+        fprintf(stderr, "Only %d resolutions may be given\n", BENCH_SIZES_MAX);
+        return -1;
+    }
+
+    if ((width <= 0) || (height <= 0) || ((width % 8) != 0) || ((height % 8) != 0)) {
+        fprintf(stderr, "Resolution %dx%d is not a multiple of 8\n", width, height);
+        return -1;
+    }
+
+    bench->width[bench->size_cnt] = width;
+    bench->height[bench->size_cnt] = height;
+    bench->size_cnt++;
+
+    return 0;
+}
+
+static int bench_args(struct ctx_bench *bench, int argc, char *argv[])
+{
+    int c, width, height;
+
+    while ((c = getopt(argc, argv, "c:f:s:n:o:ph")) != EOF) {
+        switch (c) {
+        case 'c':
+            bench->motapp->conf_filename = optarg;
+            break;
+        case 'f':
+            bench->filename = optarg;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+                fprintf(stderr, "Invalid resolution %s\n", optarg);
+                return -1;
+            }
+            if (bench_add_size(bench, width, height) != 0) return -1;
+            break;
+        case 'n':
+            bench->frames = atoi(optarg);
+            if (bench->frames <= 0) {
+                fprintf(stderr, "Invalid frame count %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'o':
+            if (strchr(optarg, '=') == NULL) {
+                fprintf(stderr, "Invalid parameter %s\n", optarg);
+                return -1;
+            }
+            if (bench->parm_cnt >= BENCH_PARMS_MAX) {
+                fprintf(stderr, "Only %d parameters may be given\n", BENCH_PARMS_MAX);
+                return -1;
+            }
+            bench->parms[bench->parm_cnt++] = optarg;
+            break;
+        case 'p':
+            bench->convert = TRUE;
+            break;
+        case 'h':
+        case '?':
+        default:
+            bench_usage();
+            return -1;
+        }
+    }
+
+    if (bench->size_cnt == 0) {
+        bench_add_size(bench, 640, 480);
+        bench_add_size(bench, 1280, 720);
+        bench_add_size(bench, 1920, 1080);
+        bench_add_size(bench, 3840, 2160);
+    }
+
+    if ((bench->filename != "") && (bench->size_cnt != 1)) {
+        fprintf(stderr, "Give the resolution of the frames in %s with a single -s\n"
+            , bench->filename.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_init_stages(struct ctx_bench *bench)
+{
+    struct ctx_cam *cam = bench->cam;
+    double despeckle;
+
+    /* Each erode or dilate pass reads and writes the motion image */
+    despeckle = 2.0 * cam->conf->despeckle_filter.length();
+
+    bench->stage[BENCH_HISTOGRAM].name = "alg_histogram";
+    bench->stage[BENCH_HISTOGRAM].bytes = 3.0;
+    bench->stage[BENCH_DIFF].name = "alg_diff";
+    bench->stage[BENCH_DIFF].bytes = 6.0;
+    bench->stage[BENCH_DESPECKLE].name = "alg_despeckle";
+    bench->stage[BENCH_DESPECKLE].bytes = despeckle;
+    bench->stage[BENCH_NEW_DIFF].name = "alg_new_diff";
+    bench->stage[BENCH_NEW_DIFF].bytes = 3.0 + despeckle;
+    bench->stage[BENCH_ROTATE].name = "rotate_map";
+    bench->stage[BENCH_ROTATE].bytes = 3.0;
+    bench->stage[BENCH_TEXT].name = "draw_text";
+    bench->stage[BENCH_TEXT].bytes = 0.0;
+    bench->stage[BENCH_JPEG].name = "jpgutl_put_yuv420p";
+    bench->stage[BENCH_JPEG].bytes = 1.5;
+
+}
+
+/* Allocate the buffers of the camera the way mlp_init_buffers does */
+static void bench_init_buffers(struct ctx_bench *bench, int width, int height)
+{
+    struct ctx_cam *cam = bench->cam;
+    struct ctx_images *imgs = &cam->imgs;
+    int indx;
+
+    memset(imgs, 0, sizeof(struct ctx_images));
+
+    imgs->width = width;
+    imgs->height = height;
+    imgs->motionsize = width * height;
+    imgs->size_norm = (width * height * 3) / 2;
+    imgs->size_high = 0;
+
+    imgs->ref =(unsigned char*) mymalloc(imgs->size_norm);
+    imgs->image_motion.image_norm = (unsigned char*)mymalloc(imgs->size_norm);
+    imgs->ref_dyn =(unsigned short*) mymalloc(imgs->motionsize * sizeof(*imgs->ref_dyn));
+    imgs->ref_average =(unsigned short*) mymalloc(imgs->motionsize * sizeof(*imgs->ref_average));
+    imgs->image_virgin =(unsigned char*) mymalloc(imgs->size_norm);
+    imgs->image_vprvcy = (unsigned char*)mymalloc(imgs->size_norm);
+    imgs->smartmask =(unsigned char*) mymalloc(imgs->motionsize);
+    imgs->smartmask_final =(unsigned char*) mymalloc(imgs->motionsize);
+    imgs->smartmask_buffer =(unsigned short*) mymalloc(imgs->motionsize * sizeof(*imgs->smartmask_buffer));
+    imgs->labels =(int*)mymalloc(imgs->motionsize * sizeof(*imgs->labels));
+    imgs->labelsize =(int*) mymalloc((height * ((width + 1) / 2) + 2) * sizeof(*imgs->labelsize));
+    imgs->labelparent =(int*) mymalloc((height * ((width + 1) / 2) + 2) * sizeof(*imgs->labelparent));
+    imgs->block_cols = (width + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    imgs->block_rows = (height + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    imgs->block_diffs =(int*) mymalloc(imgs->block_cols * imgs->block_rows * sizeof(*imgs->block_diffs));
+    imgs->motion_bits_stride = (width + 63) / 64;
+    imgs->motion_bits =(uint64_t*) mymalloc(imgs->motion_bits_stride * height * sizeof(*imgs->motion_bits));
+    imgs->motion_bits_work =(uint64_t*) mymalloc(imgs->motion_bits_stride * height * sizeof(*imgs->motion_bits_work));
+    imgs->location_rows =(int64_t*) mymalloc(3 * height * sizeof(*imgs->location_rows));
+    imgs->image_coarse =(unsigned char*) mymalloc(imgs->motionsize / 4);
+    imgs->ref_coarse =(unsigned char*) mymalloc(imgs->motionsize / 4);
+    imgs->block_coarse =(unsigned char*) mymalloc(imgs->block_cols * imgs->block_rows);
+    imgs->common_buffer =(unsigned char*) mymalloc(3 * width * height);
+
+    memset(imgs->image_motion.image_norm + imgs->motionsize, 128, imgs->motionsize / 2);
+    memset(imgs->smartmask_final, 255, imgs->motionsize);
+
+    bench->background =(unsigned char*) mymalloc(imgs->size_norm);
+    bench->image =(unsigned char*) mymalloc(imgs->size_norm);
+    bench->image_out =(unsigned char*) mymalloc(imgs->size_norm);
+    bench->jpeg =(unsigned char*) mymalloc(imgs->size_norm);
+    bench->jpeg_size = 0;
+
+    srand(1);
+    for (indx = 0; indx < imgs->motionsize; indx++) {
+        bench->background[indx] = 64 + (rand() % 128);
+    }
+    memset(bench->background + imgs->motionsize, 128, imgs->motionsize / 2);
+
+    for (indx = 0; indx < BENCH_STAGE_CNT; indx++) {
+        bench->stage[indx].nsec = 0;
+    }
+
+    cam->current_image = &imgs->image_motion;
+    cam->noise = cam->conf->noise_level;
+    cam->threshold = cam->conf->threshold;
+    if (cam->conf->threshold_maximum > cam->conf->threshold ){
+        cam->threshold_maximum = cam->conf->threshold_maximum;
+    } else {
+        cam->threshold_maximum = (height * width * 3) / 2;
+    }
+    cam->smartmask_speed = cam->conf->smart_mask_speed;
+    cam->event_nr = 1;
+    cam->prev_event = 0;
+    /* Time the full diff rather than the sampled one used while idle */
+    cam->detecting_motion = TRUE;
+
+    alg_pool_init(cam);
+
+    /* rotate_init swaps the size of the camera for 90 and 270 degrees */
+    rotate_init(cam);
+    imgs->width = width;
+    imgs->height = height;
+
+}
+
+static void bench_cleanup_buffers(struct ctx_bench *bench)
+{
+    struct ctx_images *imgs = &bench->cam->imgs;
+
+    rotate_deinit(bench->cam);
+    alg_pool_deinit(bench->cam);
+
+    free(imgs->ref);
+    free(imgs->image_motion.image_norm);
+    free(imgs->ref_dyn);
+    free(imgs->ref_average);
+    free(imgs->image_virgin);
+    free(imgs->image_vprvcy);
+    free(imgs->smartmask);
+    free(imgs->smartmask_final);
+    free(imgs->smartmask_buffer);
+    free(imgs->labels);
+    free(imgs->labelsize);
+    free(imgs->labelparent);
+    free(imgs->block_diffs);
+    free(imgs->motion_bits);
+    free(imgs->motion_bits_work);
+    free(imgs->location_rows);
+    free(imgs->image_coarse);
+    free(imgs->ref_coarse);
+    free(imgs->block_coarse);
+    free(imgs->common_buffer);
+
+    free(bench->background);
+    free(bench->image);
+    free(bench->image_out);
+    free(bench->jpeg);
+
+    memset(imgs, 0, sizeof(struct ctx_images));
+
+}
+
+/* Put the next frame into bench->image.  Returns -1 when none can be read */
+static int bench_next_frame(struct ctx_bench *bench, int frame)
+{
+    struct ctx_images *imgs = &bench->cam->imgs;
+    int y, box_w, box_h, box_x, box_y, indx;
+
+    if (bench->fp != NULL) {
+        if (fread(bench->image, imgs->size_norm, 1, bench->fp) != 1) {
+            rewind(bench->fp);
+            if (fread(bench->image, imgs->size_norm, 1, bench->fp) != 1) {
+                fprintf(stderr, "Could not read a %dx%d frame from %s\n"
+                    , imgs->width, imgs->height, bench->filename.c_str());
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /* Some noise on the background and a bright box moving across it */
+    memcpy(bench->image, bench->background, imgs->size_norm);
+    for (indx = frame % 7; indx < imgs->motionsize; indx += 7) {
+        bench->image[indx] += (rand() % 5) - 2;
+    }
+
+    box_w = imgs->width / 8;
+    box_h = imgs->height / 8;
+    box_x = (frame * 4) % (imgs->width - box_w);
+    box_y = (imgs->height - box_h) / 2;
+    for (y = box_y; y < box_y + box_h; y++) {
+        memset(bench->image + (y * imgs->width) + box_x, 240, box_w);
+    }
+
+    return 0;
+}
+
+static int64_t bench_nsec(struct timespec *ts_start)
+{
+    struct timespec ts_end;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    return ((int64_t)(ts_end.tv_sec - ts_start->tv_sec) * 1000000000) +
+        (ts_end.tv_nsec - ts_start->tv_nsec);
+}
+
+static int bench_run(struct ctx_bench *bench)
+{
+    struct ctx_cam *cam = bench->cam;
+    struct ctx_images *imgs = &cam->imgs;
+    struct ctx_image_data img_data;
+    struct timespec ts;
+    char text[64];
+    int frame, factor;
+
+    memset(&img_data, 0, sizeof(img_data));
+    img_data.image_norm = bench->image_out;
+
+    factor = cam->conf->text_scale;
+    if ((factor * 10 * 2 > imgs->width) || (factor * 10 * 2 > imgs->height)) {
+        factor = 1;
+    }
+
+    if (bench_next_frame(bench, 0) != 0) return -1;
+    memcpy(imgs->image_virgin, bench->image, imgs->size_norm);
+    memcpy(imgs->image_vprvcy, bench->image, imgs->size_norm);
+    alg_update_reference_frame(cam, RESET_REF_FRAME);
+
+    for (frame = 1; frame <= bench->frames; frame++) {
+        if (bench_next_frame(bench, frame) != 0) return -1;
+        memcpy(imgs->image_virgin, bench->image, imgs->size_norm);
+        memcpy(imgs->image_vprvcy, bench->image, imgs->size_norm);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        alg_histogram(cam);
+        bench->stage[BENCH_HISTOGRAM].nsec += bench_nsec(&ts);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        alg_diff(cam);
+        bench->stage[BENCH_DIFF].nsec += bench_nsec(&ts);
+
+        if (cam->conf->despeckle_filter != "") {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            alg_despeckle(cam);
+            bench->stage[BENCH_DESPECKLE].nsec += bench_nsec(&ts);
+        }
+
+        alg_update_reference_frame(cam, UPDATE_REF_FRAME);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        alg_new_diff(cam);
+        bench->stage[BENCH_NEW_DIFF].nsec += bench_nsec(&ts);
+
+        memcpy(bench->image_out, bench->image, imgs->size_norm);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rotate_map(cam, &img_data);
+        bench->stage[BENCH_ROTATE].nsec += bench_nsec(&ts);
+
+        snprintf(text, sizeof(text), "%dx%d frame %d", imgs->width, imgs->height, frame);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        draw_text(bench->image_out, imgs->width, imgs->height
+            , imgs->width - 10, imgs->height - (10 * factor), text, factor);
+        bench->stage[BENCH_TEXT].nsec += bench_nsec(&ts);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        bench->jpeg_size += jpgutl_put_yuv420p(bench->jpeg, imgs->size_norm, bench->image_out
+            , imgs->width, imgs->height, cam->conf->picture_quality, cam, NULL, NULL);
+        bench->stage[BENCH_JPEG].nsec += bench_nsec(&ts);
+    }
+
+    return 0;
+}
+
+static void bench_report(struct ctx_bench *bench, int width, int height)
+{
+    struct ctx_bench_stage *stage;
+    double pixels, nsec, bytes;
+    int indx;
+
+    pixels = (double)width * height * bench->frames;
+
+    printf("\n%dx%d  %d frames  %d threads\n", width, height, bench->frames
+        , bench->cam->conf->detection_threads);
+    printf("%-20s %10s %10s %10s\n", "stage", "ns/pixel", "frames/s", "MB/s");
+
+    for (indx = 0; indx < BENCH_STAGE_CNT; indx++) {
+        stage = &bench->stage[indx];
+        if (stage->nsec == 0) continue;
+        nsec = (double)stage->nsec;
+        bytes = stage->bytes * pixels;
+        if (indx == BENCH_JPEG) bytes += bench->jpeg_size;
+        if (bytes > 0) {
+            printf("%-20s %10.3f %10.1f %10.1f\n", stage->name, nsec / pixels
+                , bench->frames * 1e9 / nsec, bytes * 1e3 / nsec);
+        } else {
+            printf("%-20s %10.3f %10.1f %10s\n", stage->name, nsec / pixels
+                , bench->frames * 1e9 / nsec, "-");
+        }
+    }
+
+}
+
+/* Y10 as the v4l2 module converts it */
+static void bench_y10(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    vid_grey16toyuv420p(img_dst, img_src, width, height, 2);
+}
+
+static struct ctx_bench_convert bench_conversions[] = {
+    {"vid_yuv422to420p",    vid_yuv422to420p},
+    {"vid_uyvyto420p",      vid_uyvyto420p},
+    {"vid_yuv422pto420p",   vid_yuv422pto420p},
+    {"vid_rgb24toyuv420p",  vid_rgb24toyuv420p},
+    {"vid_bayer2yuv420p",   vid_bayer2yuv420p},
+    {"vid_grey16toyuv420p", bench_y10}
+};
+#define BENCH_CONVERT_CNT   (int)(sizeof(bench_conversions) / sizeof(bench_conversions[0]))
+
+/* Widths up to this are checked so each row kernel also runs its tail */
+#define BENCH_TAIL_WIDTH    66
+
+static const char *bench_simd_name(enum SIMD_TYPE simd)
+{
+    return (simd == SIMD_TYPE_AVX2) ? "AVX2" : (simd == SIMD_TYPE_SSE2) ? "SSE2" :
+        (simd == SIMD_TYPE_NEON) ? "NEON" : "scalar";
+}
+
+/*
+ * List the instruction sets that the cpu can run and that the conversion
+ * kernels were built for.  A cpu with AVX2 also runs the SSE2 kernels.
+ */
+static int bench_simd_list(enum SIMD_TYPE *list)
+{
+    enum SIMD_TYPE simd, want[3];
+    int indx, cnt, want_cnt;
+
+    simd = mysimd_type();
+    want_cnt = 0;
+    if ((simd == SIMD_TYPE_SSE2) || (simd == SIMD_TYPE_AVX2)) {
+        want[want_cnt++] = SIMD_TYPE_SSE2;
+    }
+    if (simd == SIMD_TYPE_AVX2) {
+        want[want_cnt++] = SIMD_TYPE_AVX2;
+    }
+    if (simd == SIMD_TYPE_NEON) {
+        want[want_cnt++] = SIMD_TYPE_NEON;
+    }
+
+    cnt = 0;
+    for (indx = 0; indx < want_cnt; indx++) {
+        if (vid_convert_init(want[indx]) == want[indx]) {
+            list[cnt++] = want[indx];
+        }
+    }
+    vid_convert_init(SIMD_TYPE_NONE);
+
+    return cnt;
+}
+
+/*
+ * Compare the vectorized kernels with the scalar ones for every even width
+ * up to BENCH_TAIL_WIDTH so the partial blocks at the end of the rows are
+ * covered as well as the full ones.  Returns -1 on a mismatch.
+ */
+static int bench_convert_tails(enum SIMD_TYPE *list, int list_cnt)
+{
+    unsigned char *src, *out_c, *out_simd;
+    int indx, isimd, width, height, size, retcd;
+
+    height = 4;
+    src =(unsigned char*) mymalloc(BENCH_TAIL_WIDTH * height * 3);
+    out_c =(unsigned char*) mymalloc(BENCH_TAIL_WIDTH * height * 2);
+    out_simd =(unsigned char*) mymalloc(BENCH_TAIL_WIDTH * height * 2);
+
+    srand(2);
+    for (indx = 0; indx < (BENCH_TAIL_WIDTH * height * 3); indx++) {
+        src[indx] = rand() % 256;
+    }
+
+    retcd = 0;
+    for (isimd = 0; isimd < list_cnt; isimd++) {
+        for (indx = 0; indx < BENCH_CONVERT_CNT; indx++) {
+            for (width = 2; width <= BENCH_TAIL_WIDTH; width += 2) {
+                size = (width * height * 3) / 2;
+
+                vid_convert_init(SIMD_TYPE_NONE);
+                bench_conversions[indx].convert(out_c, src, width, height);
+                vid_convert_init(list[isimd]);
+                bench_conversions[indx].convert(out_simd, src, width, height);
+
+                if (memcmp(out_c, out_simd, size) != 0) {
+                    printf("%-20s %-6s differs at %dx%d\n", bench_conversions[indx].name
+                        , bench_simd_name(list[isimd]), width, height);
+                    retcd = -1;
+                }
+            }
+        }
+    }
+    vid_convert_init(mysimd_type());
+
+    printf("Widths 2 to %d: %s\n", BENCH_TAIL_WIDTH, (retcd == 0) ? "same" : "DIFFERS");
+
+    free(src);
+    free(out_c);
+    free(out_simd);
+
+    return retcd;
+}
+
+/*
+ * Time each conversion with the scalar kernels and with the kernels of
+ * each instruction set the cpu runs, and check that they give the same
+ * image.  Returns -1 on a mismatch.
+ */
+static int bench_convert(struct ctx_bench *bench, int width, int height)
+{
+    unsigned char *src, *out_c, *out_simd;
+    struct timespec ts;
+    enum SIMD_TYPE list[3];
+    double pixels, nsec_c, nsec_simd;
+    int indx, isimd, list_cnt, frame, size, retcd;
+
+    size = (width * height * 3) / 2;
+    src =(unsigned char*) mymalloc(width * height * 3);
+    out_c =(unsigned char*) mymalloc(size);
+    out_simd =(unsigned char*) mymalloc(size);
+
+    srand(1);
+    for (indx = 0; indx < (width * height * 3); indx++) {
+        src[indx] = rand() % 256;
+    }
+
+    pixels = (double)width * height * bench->frames;
+    list_cnt = bench_simd_list(list);
+    retcd = 0;
+
+    printf("\n%dx%d  %d frames\n", width, height, bench->frames);
+    printf("%-20s %-6s %10s %10s %8s\n", "conversion", "simd", "c ns/px", "simd ns/px", "output");
+
+    for (indx = 0; indx < BENCH_CONVERT_CNT; indx++) {
+        vid_convert_init(SIMD_TYPE_NONE);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (frame = 0; frame < bench->frames; frame++) {
+            bench_conversions[indx].convert(out_c, src, width, height);
+        }
+        nsec_c = (double)bench_nsec(&ts);
+
+        for (isimd = 0; isimd < list_cnt; isimd++) {
+            vid_convert_init(list[isimd]);
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            for (frame = 0; frame < bench->frames; frame++) {
+                bench_conversions[indx].convert(out_simd, src, width, height);
+            }
+            nsec_simd = (double)bench_nsec(&ts);
+
+            if (memcmp(out_c, out_simd, size) != 0) {
+                retcd = -1;
+            }
+            printf("%-20s %-6s %10.3f %10.3f %8s\n", bench_conversions[indx].name
+                , bench_simd_name(list[isimd]), nsec_c / pixels, nsec_simd / pixels
+                , (memcmp(out_c, out_simd, size) == 0) ? "same" : "DIFFERS");
+        }
+    }
+    vid_convert_init(mysimd_type());
+
+    if (list_cnt == 0) {
+        printf("No vectorized kernels for this cpu\n");
+    } else if (bench_convert_tails(list, list_cnt) != 0) {
+        retcd = -1;
+    }
+
+    free(src);
+    free(out_c);
+    free(out_simd);
+
+    return retcd;
+}
+
+static int bench_init(struct ctx_bench *bench, int argc, char *argv[])
+{
+    struct ctx_motapp *motapp = bench->motapp;
+    std::string parm_nm, parm_val;
+    size_t pos;
+    int indx;
+
+    motapp->cam_list = NULL;
+    pthread_mutex_init(&motapp->global_lock, NULL);
+    pthread_mutex_init(&motapp->mutex_parms, NULL);
+    pthread_mutex_init(&motapp->mutex_camlst, NULL);
+    motapp->conf_filename = "";
+    motapp->log_file = "";
+    motapp->log_type_str = "";
+    motapp->log_level = WRN;
+    motapp->setup_mode = false;
+    motapp->pause = false;
+
+    pthread_key_create(&tls_key_threadnr, NULL);
+    pthread_setspecific(tls_key_threadnr, (void *)(0));
+
+    log_set_motapp(motapp);
+    log_set_level(motapp->log_level);
+
+    bench->frames = BENCH_FRAMES_DFLT;
+    bench->size_cnt = 0;
+    bench->parm_cnt = 0;
+    bench->convert = FALSE;
+    bench->fp = NULL;
+
+    if (bench_args(bench, argc, argv) != 0) return -1;
+
+    conf_init_cams(motapp);
+    bench->cam = motapp->cam_list[0];
+
+    /* Give the despeckle and rotate stages something to do */
+    if (bench->cam->conf->despeckle_filter == "") {
+        conf_edit_set(motapp, false, 0, "despeckle_filter", "EedDl");
+    }
+    if (bench->cam->conf->rotate == 0) {
+        conf_edit_set(motapp, false, 0, "rotate", "180");
+    }
+
+    for (indx = 0; indx < bench->parm_cnt; indx++) {
+        pos = bench->parms[indx].find('=');
+        parm_nm = bench->parms[indx].substr(0, pos);
+        parm_val = bench->parms[indx].substr(pos + 1);
+        conf_edit_set(motapp, false, 0, parm_nm, parm_val);
+    }
+
+    if (bench->filename != "") {
+        bench->fp = myfopen(bench->filename.c_str(), "rbe");
+        if (bench->fp == NULL) {
+            fprintf(stderr, "Could not open %s\n", bench->filename.c_str());
+            return -1;
+        }
+    }
+
+    draw_init_chars();
+
+    algsimd_init();
+
+    vid_convert_init(mysimd_type());
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct ctx_bench *bench;
+    int indx, retcd;
+
+    bench = new ctx_bench;
+    bench->motapp = new ctx_motapp;
+
+    retcd = bench_init(bench, argc, argv);
+
+    for (indx = 0; (retcd == 0) && bench->convert && (indx < bench->size_cnt); indx++) {
+        retcd = bench_convert(bench, bench->width[indx], bench->height[indx]);
+    }
+
+    for (indx = 0; (retcd == 0) && !bench->convert && (indx < bench->size_cnt); indx++) {
+        bench_init_buffers(bench, bench->width[indx], bench->height[indx]);
+        bench_init_stages(bench);
+        retcd = bench_run(bench);
+        if (retcd == 0) {
+            bench_report(bench, bench->width[indx], bench->height[indx]);
+        }
+        bench_cleanup_buffers(bench);
+    }
+
+    if (bench->fp != NULL) myfclose(bench->fp);
+    if (bench->motapp->cam_list != NULL) conf_deinit(bench->motapp);
+    pthread_key_delete(tls_key_threadnr);
+
+    delete bench->motapp;
+    delete bench;
+
+    return (retcd == 0) ? 0 : 1;
+}
@@ -73,6 +73,10 @@ struct ctx_parm config_parms[] = {
     "native_language",
     "# Native language support.",
     1, PARM_TYP_BOOL, PARM_CAT_00, WEBUI_LEVEL_LIMITED},
+    {
+    "netcam_decode_threads",
+    "# Number of threads shared by all network cameras for decoding.  0 decodes on each camera thread.",
+    1, PARM_TYP_INT, PARM_CAT_00, WEBUI_LEVEL_ADVANCED},
 
     {
     "quiet",
@@ -216,6 +220,18 @@ struct ctx_parm config_parms[] = {
     "# Primary method to be used for detection.",
     0,PARM_TYP_INT, PARM_CAT_05, WEBUI_LEVEL_LIMITED },
     {
+    "detection_scale",
+    "# Reduce the image by this scale (1, 2 or 4) to find the areas to compare for detection.",
+    0,PARM_TYP_INT, PARM_CAT_05, WEBUI_LEVEL_LIMITED },
+    {
+    "detection_threads",
+    "# Number of threads that split the image into strips for motion detection.",
+    0,PARM_TYP_INT, PARM_CAT_05, WEBUI_LEVEL_ADVANCED },
+    {
+    "detection_interval",
+    "# Run motion detection on every Nth image.  The images between use the last results.",
+    0,PARM_TYP_INT, PARM_CAT_05, WEBUI_LEVEL_LIMITED },
+    {
     "threshold",
     "# Threshold for number of changed pixels that triggers motion.",
     0,PARM_TYP_INT, PARM_CAT_05, WEBUI_LEVEL_LIMITED },
@@ -284,6 +300,10 @@ struct ctx_parm config_parms[] = {
     "smart_mask_speed",
     "# The value defining how slow or fast the smart motion mask created and used.",
     0, PARM_TYP_INT, PARM_CAT_06, WEBUI_LEVEL_LIMITED },
+    {
+    "smart_mask_incremental",
+    "# Tune a band of the smart mask each frame instead of all of it at once.",
+    0, PARM_TYP_BOOL, PARM_CAT_06, WEBUI_LEVEL_ADVANCED },
 
     {
     "lightswitch_percent",
@@ -302,6 +322,10 @@ struct ctx_parm config_parms[] = {
     "# Amount of time that must elapse before a new object is accepted into the image.",
     0, PARM_TYP_INT, PARM_CAT_07, WEBUI_LEVEL_LIMITED},
     {
+    "reference_rate",
+    "# Percent of each image blended into the reference frame.  0 uses the original update.",
+    0, PARM_TYP_INT, PARM_CAT_07, WEBUI_LEVEL_ADVANCED},
+    {
     "event_gap",
     "# Gap in seconds of no motion detected that triggers the end of an event.",
     0, PARM_TYP_INT, PARM_CAT_07, WEBUI_LEVEL_LIMITED },
@@ -1015,6 +1039,25 @@ static void conf_edit_native_language(struct ctx_motapp *motapp, std::string &pa
     MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","native_language",_("native_language"));
 }
 
+static void conf_edit_netcam_decode_threads(struct ctx_motapp *motapp, std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT){
+        motapp->netcam_decode_threads = 0;
+    } else if (pact == PARM_ACT_SET){
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 0) || (parm_in > 64)) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Invalid netcam_decode_threads %d"),parm_in);
+        } else {
+            motapp->netcam_decode_threads = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET){
+        parm = std::to_string(motapp->netcam_decode_threads);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","netcam_decode_threads",_("netcam_decode_threads"));
+}
+
 /************************************************************************/
 /************************************************************************/
 /************************************************************************/
@@ -1556,6 +1599,63 @@ static void conf_edit_primary_method(struct ctx_cam *cam, std::string &parm, enu
     MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","primary_method",_("primary_method"));
 }
 
+static void conf_edit_detection_scale(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT){
+        cam->conf->detection_scale = 1;
+    } else if (pact == PARM_ACT_SET){
+        parm_in = atoi(parm.c_str());
+        if ((parm_in != 1) && (parm_in != 2) && (parm_in != 4)) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Invalid detection_scale %d"),parm_in);
+        } else {
+            cam->conf->detection_scale = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET){
+        parm = std::to_string(cam->conf->detection_scale);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","detection_scale",_("detection_scale"));
+}
+
+static void conf_edit_detection_threads(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT){
+        cam->conf->detection_threads = 1;
+    } else if (pact == PARM_ACT_SET){
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 1) || (parm_in > 16)) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Invalid detection_threads %d"),parm_in);
+        } else {
+            cam->conf->detection_threads = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET){
+        parm = std::to_string(cam->conf->detection_threads);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","detection_threads",_("detection_threads"));
+}
+
+static void conf_edit_detection_interval(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT){
+        cam->conf->detection_interval = 1;
+    } else if (pact == PARM_ACT_SET){
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 1) || (parm_in > 100)) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Invalid detection_interval %d"),parm_in);
+        } else {
+            cam->conf->detection_interval = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET){
+        parm = std::to_string(cam->conf->detection_interval);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","detection_interval",_("detection_interval"));
+}
+
 static void conf_edit_threshold(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
 {
     int parm_in;
@@ -1818,6 +1918,19 @@ static void conf_edit_mask_privacy(struct ctx_cam *cam, std::string &parm, enum
     MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","mask_privacy",_("mask_privacy"));
 }
 
+static void conf_edit_smart_mask_incremental(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT){
+        cam->conf->smart_mask_incremental = FALSE;
+    } else if (pact == PARM_ACT_SET){
+        conf_edit_set_bool(cam->conf->smart_mask_incremental, parm);
+    } else if (pact == PARM_ACT_GET){
+        conf_edit_get_bool(parm, cam->conf->smart_mask_incremental);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","smart_mask_incremental",_("smart_mask_incremental"));
+}
+
 static void conf_edit_smart_mask_speed(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
 {
     int parm_in;
@@ -1913,6 +2026,25 @@ static void conf_edit_static_object_time(struct ctx_cam *cam, std::string &parm,
     MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","static_object_time",_("static_object_time"));
 }
 
+static void conf_edit_reference_rate(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT){
+        cam->conf->reference_rate = 0;
+    } else if (pact == PARM_ACT_SET){
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 0) || (parm_in > 100)) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Invalid reference_rate %d"),parm_in);
+        } else {
+            cam->conf->reference_rate = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET){
+        parm = std::to_string(cam->conf->reference_rate);
+    }
+    return;
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","reference_rate",_("reference_rate"));
+}
+
 static void conf_edit_event_gap(struct ctx_cam *cam, std::string &parm, enum PARM_ACT pact)
 {
     int parm_in;
@@ -3142,6 +3274,7 @@ static void conf_edit_cat00(struct ctx_motapp *motapp, std::string cmd
     } else if (cmd == "log_level"){               conf_edit_log_level(motapp, parm_val, pact);
     } else if (cmd == "log_type"){                conf_edit_log_type(motapp, parm_val, pact);
     } else if (cmd == "native_language"){         conf_edit_native_language(motapp, parm_val, pact);
+    } else if (cmd == "netcam_decode_threads"){   conf_edit_netcam_decode_threads(motapp, parm_val, pact);
     }
 
 }
@@ -3210,6 +3343,9 @@ static void conf_edit_cat05(struct ctx_cam *cam, std::string parm_nm
 {
     if (parm_nm == "emulate_motion"){          conf_edit_emulate_motion(cam, parm_val, pact);
     } else if (parm_nm == "primary_method"){          conf_edit_primary_method(cam, parm_val, pact);
+    } else if (parm_nm == "detection_scale"){         conf_edit_detection_scale(cam, parm_val, pact);
+    } else if (parm_nm == "detection_threads"){       conf_edit_detection_threads(cam, parm_val, pact);
+    } else if (parm_nm == "detection_interval"){      conf_edit_detection_interval(cam, parm_val, pact);
     } else if (parm_nm == "threshold"){               conf_edit_threshold(cam, parm_val, pact);
     } else if (parm_nm == "threshold_maximum"){       conf_edit_threshold_maximum(cam, parm_val, pact);
     } else if (parm_nm == "threshold_sdevx"){         conf_edit_threshold_sdevx(cam, parm_val, pact);
@@ -3234,6 +3370,7 @@ static void conf_edit_cat06(struct ctx_cam *cam, std::string parm_nm
     } else if (parm_nm == "mask_file"){               conf_edit_mask_file(cam, parm_val, pact);
     } else if (parm_nm == "mask_privacy"){            conf_edit_mask_privacy(cam, parm_val, pact);
     } else if (parm_nm == "smart_mask_speed"){        conf_edit_smart_mask_speed(cam, parm_val, pact);
+    } else if (parm_nm == "smart_mask_incremental"){  conf_edit_smart_mask_incremental(cam, parm_val, pact);
     }
 
 }
@@ -3245,6 +3382,7 @@ static void conf_edit_cat07(struct ctx_cam *cam, std::string parm_nm
     } else if (parm_nm == "lightswitch_frames"){      conf_edit_lightswitch_frames(cam, parm_val, pact);
     } else if (parm_nm == "minimum_motion_frames"){   conf_edit_minimum_motion_frames(cam, parm_val, pact);
     } else if (parm_nm == "static_object_time"){      conf_edit_static_object_time(cam, parm_val, pact);
+    } else if (parm_nm == "reference_rate"){          conf_edit_reference_rate(cam, parm_val, pact);
     } else if (parm_nm == "event_gap"){               conf_edit_event_gap(cam, parm_val, pact);
     } else if (parm_nm == "pre_capture"){             conf_edit_pre_capture(cam, parm_val, pact);
     } else if (parm_nm == "post_capture"){            conf_edit_post_capture(cam, parm_val, pact);
@@ -3441,6 +3579,7 @@ static void conf_edit_dflt_app(struct ctx_motapp *motapp)
     conf_edit_log_level(motapp, dflt, PARM_ACT_DFLT);
     conf_edit_log_type(motapp, dflt, PARM_ACT_DFLT);
     conf_edit_native_language(motapp, dflt, PARM_ACT_DFLT);
+    conf_edit_netcam_decode_threads(motapp, dflt, PARM_ACT_DFLT);
 
 }
 
@@ -66,6 +66,9 @@
         /* Motion detection configuration parameters */
         int             emulate_motion;
         int             primary_method;
+        int             detection_scale;
+        int             detection_threads;
+        int             detection_interval;
         int             threshold;
         int             threshold_maximum;
         int             threshold_sdevx;
@@ -83,10 +86,12 @@
         std::string     mask_file;
         std::string     mask_privacy;
         int             smart_mask_speed;
+        int             smart_mask_incremental;
         int             lightswitch_percent;
         int             lightswitch_frames;
         int             minimum_motion_frames;
         int             static_object_time;
+        int             reference_rate;
         int             event_gap;
         int             pre_capture;
         int             post_capture;
@@ -1465,6 +1465,8 @@ void draw_smartmask(struct ctx_cam *cam, unsigned char *out)
     width = imgs->width;
     height = imgs->height;
 
+    imgs->motion_chroma_dirty = TRUE;
+
     /* Set V to 255 to make smartmask appear red. */
     out_v = out + v;
     out_u = out + i;
@@ -1503,6 +1505,8 @@ void draw_fixed_mask(struct ctx_cam *cam, unsigned char *out)
     width = imgs->width;
     height = imgs->height;
 
+    imgs->motion_chroma_dirty = TRUE;
+
     /* Set U and V to 0 to make fixed mask appear green. */
     out_v = out + v;
     out_u = out + i;
@@ -1541,6 +1545,8 @@ void draw_largest_label(struct ctx_cam *cam, unsigned char *out)
     width = imgs->width;
     height = imgs->height;
 
+    imgs->motion_chroma_dirty = TRUE;
+
     /* Set U to 255 to make label appear blue. */
     out_u = out + i;
     out_v = out + v;
@@ -415,12 +415,16 @@ static void put_jpeg_exif(j_compress_ptr cinfo, const struct ctx_cam *cam,
  *  width            The width of the image
  *  height           The height of the image
  *  img_out          Pointer to the image output
+ *  scale            1, 2, 4 or 8 to decode the image at that fraction of its
+ *                   size by scaling the DCT.  width and height are the size
+ *                   after scaling.
  *
  *  Return Values
  *    Success 0, Failure -1
  */
 int jpgutl_decode_jpeg (unsigned char *jpeg_data_in, int jpeg_data_len,
-        unsigned int width, unsigned int height, unsigned char *volatile img_out)
+        unsigned int width, unsigned int height, unsigned char *volatile img_out,
+        unsigned int scale)
 {
     JSAMPARRAY      line;           /* Array of decomp data lines */
     unsigned char  *wline;          /* Will point to line[0] */
@@ -455,6 +459,10 @@ int jpgutl_decode_jpeg (unsigned char *jpeg_data_in, int jpeg_data_len,
     //420 sampling is the default for YCbCr so no need to override.
     dinfo.out_color_space = JCS_YCbCr;
     dinfo.dct_method = JDCT_DEFAULT;
+    if (scale > 1) {
+        dinfo.scale_num = 1;
+        dinfo.scale_denom = scale;
+    }
     guarantee_huff_tables(&dinfo);  /* Required by older versions of the jpeg libs */
     jpeg_start_decompress (&dinfo);
 
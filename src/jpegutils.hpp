@@ -23,7 +23,8 @@
 #define __JPEGUTILS_H__
 
     int jpgutl_decode_jpeg (unsigned char *jpeg_data_in, int jpeg_data_len,
-                        unsigned int width, unsigned int height, unsigned char *volatile img_out);
+                        unsigned int width, unsigned int height, unsigned char *volatile img_out,
+                        unsigned int scale);
 
     int jpgutl_put_yuv420p(unsigned char *, int image, unsigned char *, int, int, int, struct ctx_cam *cam, struct timespec *, struct ctx_coord *);
     int jpgutl_put_grey(unsigned char *, int image, unsigned char *, int, int, int, struct ctx_cam *cam, struct timespec *, struct ctx_coord *);
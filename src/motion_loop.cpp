@@ -39,6 +39,7 @@
 #include "dbse.hpp"
 #include "draw.hpp"
 #include "webu_stream.hpp"
+#include "video_common.hpp"
 
 
 static void mlp_ring_resize(struct ctx_cam *cam, int new_size)
@@ -130,6 +131,59 @@ static void mlp_ring_process_debug(struct ctx_cam *cam)
 
 }
 
+/*
+ * Fill the high resolution image from the normal image when the camera
+ * did not decode it.  This waits until the image is saved since most of
+ * those images never are.
+ */
+void mlp_image_high(struct ctx_cam *cam, struct ctx_image_data *img)
+{
+    if ((img->flags & IMAGE_NOHIGH) == 0) {
+        return;
+    }
+
+    vid_yuv420p_enlarge(img->image_high, img->image_norm
+        , cam->imgs.width, cam->imgs.height
+        , cam->imgs.width_high / cam->imgs.width);
+    img->flags &= ~IMAGE_NOHIGH;
+}
+
+/*
+ * Whether the camera needs to give the next image at full size and
+ * quality since it may be saved.  That is during an event, once the last
+ * image had motion, while an image with motion is still in the ring since
+ * an event starting then saves the ring as pre_capture, and around the
+ * timelapse image.  The second before the timelapse is included since the
+ * cameras that decode on a thread of their own run ahead of the loop.
+ */
+int mlp_need_full(struct ctx_cam *cam)
+{
+    int indx, interval;
+
+    if ((cam->detecting_motion) || (cam->postcap > 0) ||
+        (cam->previous_diffs > cam->threshold)) {
+        return TRUE;
+    }
+
+    if (cam->conf->pre_capture > 0) {
+        for (indx = 0; indx < cam->imgs.ring_size; indx++) {
+            if ((cam->imgs.image_ring[indx].flags & (IMAGE_MOTION | IMAGE_SAVED)) == IMAGE_MOTION) {
+                return TRUE;
+            }
+        }
+    }
+
+    interval = cam->conf->timelapse_interval;
+    if ((interval > 0) &&
+        (((cam->shots == 0) &&
+          ((cam->frame_curr_ts.tv_sec % interval) <= (cam->frame_last_ts.tv_sec % interval))) ||
+         (((cam->frame_curr_ts.tv_sec + 1) % interval) == 0))) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 static void mlp_ring_process(struct ctx_cam *cam)
 {
 
@@ -141,6 +195,7 @@ static void mlp_ring_process(struct ctx_cam *cam)
         }
 
         cam->current_image = &cam->imgs.image_ring[cam->imgs.ring_out];
+        mlp_image_high(cam, cam->current_image);
 
         if (cam->imgs.image_ring[cam->imgs.ring_out].shot < cam->conf->framerate) {
             if (cam->motapp->log_level >= DBG) mlp_ring_process_debug(cam);
@@ -197,6 +252,7 @@ static void mlp_detected_trigger(struct ctx_cam *cam, struct ctx_image_data *img
                        cam->event_nr);
 
             if (cam->new_img & (NEWIMG_FIRST | NEWIMG_BEST | NEWIMG_CENTER)){
+                mlp_image_high(cam, img);
                 pic_save_preview(cam, img);
             }
 
@@ -281,7 +337,8 @@ static void mlp_mask_privacy(struct ctx_cam *cam)
 
     indx_img = 1;
     indx_max = 1;
-    if (cam->imgs.size_high > 0) indx_max = 2;
+    if ((cam->imgs.size_high > 0) &&
+        ((cam->current_image->flags & IMAGE_NOHIGH) == 0)) indx_max = 2;
     increment = sizeof(unsigned long);
 
     while (indx_img <= indx_max){
@@ -551,14 +608,28 @@ static void mlp_init_buffers(struct ctx_cam *cam)
 
     cam->imgs.ref =(unsigned char*) mymalloc(cam->imgs.size_norm);
     cam->imgs.image_motion.image_norm = (unsigned char*)mymalloc(cam->imgs.size_norm);
-    cam->imgs.ref_dyn =(int*) mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.ref_dyn));
+    cam->imgs.ref_dyn =(unsigned short*) mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.ref_dyn));
+    cam->imgs.ref_average =(unsigned short*) mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.ref_average));
     cam->imgs.image_virgin =(unsigned char*) mymalloc(cam->imgs.size_norm);
     cam->imgs.image_vprvcy = (unsigned char*)mymalloc(cam->imgs.size_norm);
     cam->imgs.smartmask =(unsigned char*) mymalloc(cam->imgs.motionsize);
     cam->imgs.smartmask_final =(unsigned char*) mymalloc(cam->imgs.motionsize);
-    cam->imgs.smartmask_buffer =(int*) mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.smartmask_buffer));
+    cam->imgs.smartmask_buffer =(unsigned short*) mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.smartmask_buffer));
     cam->imgs.labels =(int*)mymalloc(cam->imgs.motionsize * sizeof(*cam->imgs.labels));
-    cam->imgs.labelsize =(int*) mymalloc((cam->imgs.motionsize/2+1) * sizeof(*cam->imgs.labelsize));
+    /* Provisional labels are given to each run of changed pixels in a row */
+    cam->imgs.labelsize =(int*) mymalloc((cam->imgs.height * ((cam->imgs.width + 1) / 2) + 2) * sizeof(*cam->imgs.labelsize));
+    cam->imgs.labelparent =(int*) mymalloc((cam->imgs.height * ((cam->imgs.width + 1) / 2) + 2) * sizeof(*cam->imgs.labelparent));
+    cam->imgs.block_cols = (cam->imgs.width + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    cam->imgs.block_rows = (cam->imgs.height + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    cam->imgs.block_diffs =(int*) mymalloc(cam->imgs.block_cols * cam->imgs.block_rows * sizeof(*cam->imgs.block_diffs));
+    cam->imgs.motion_bits_stride = (cam->imgs.width + 63) / 64;
+    cam->imgs.motion_bits =(uint64_t*) mymalloc(cam->imgs.motion_bits_stride * cam->imgs.height * sizeof(*cam->imgs.motion_bits));
+    cam->imgs.motion_bits_work =(uint64_t*) mymalloc(cam->imgs.motion_bits_stride * cam->imgs.height * sizeof(*cam->imgs.motion_bits_work));
+    cam->imgs.location_rows =(int64_t*) mymalloc(3 * cam->imgs.height * sizeof(*cam->imgs.location_rows));
+    /* Sized for the smallest detection_scale of 2 */
+    cam->imgs.image_coarse =(unsigned char*) mymalloc(cam->imgs.motionsize / 4);
+    cam->imgs.ref_coarse =(unsigned char*) mymalloc(cam->imgs.motionsize / 4);
+    cam->imgs.block_coarse =(unsigned char*) mymalloc(cam->imgs.block_cols * cam->imgs.block_rows);
     cam->imgs.image_preview.image_norm =(unsigned char*) mymalloc(cam->imgs.size_norm);
     cam->imgs.common_buffer =(unsigned char*) mymalloc(3 * cam->imgs.width * cam->imgs.height);
     cam->imgs.image_secondary =(unsigned char*) mymalloc(3 * cam->imgs.width * cam->imgs.height);
@@ -566,9 +637,16 @@ static void mlp_init_buffers(struct ctx_cam *cam)
         cam->imgs.image_preview.image_high =(unsigned char*) mymalloc(cam->imgs.size_high);
     }
 
+    /* The chroma of the motion image is constant and only restored after overlays */
+    memset(cam->imgs.image_motion.image_norm + cam->imgs.motionsize, 128, cam->imgs.motionsize / 2);
+    cam->imgs.motion_chroma_dirty = FALSE;
+
     memset(cam->imgs.smartmask, 0, cam->imgs.motionsize);
     memset(cam->imgs.smartmask_final, 255, cam->imgs.motionsize);
     memset(cam->imgs.smartmask_buffer, 0, cam->imgs.motionsize * sizeof(*cam->imgs.smartmask_buffer));
+    memset(cam->imgs.block_diffs, 0, cam->imgs.block_cols * cam->imgs.block_rows * sizeof(*cam->imgs.block_diffs));
+    cam->imgs.block_radius = 0;
+    cam->imgs.motion_packed = FALSE;
 
 }
 
@@ -673,6 +751,8 @@ static int mlp_init(struct ctx_cam *cam)
 
     mlp_init_buffers(cam);
 
+    alg_pool_init(cam);
+
     webu_stream_init(cam);
 
     algsec_init(cam);
@@ -717,6 +797,8 @@ void mlp_cleanup(struct ctx_cam *cam)
 
     algsec_deinit(cam);
 
+    alg_pool_deinit(cam);
+
     if (cam->video_dev >= 0) mlp_cam_close(cam);
 
     free(cam->imgs.image_motion.image_norm);
@@ -728,6 +810,9 @@ void mlp_cleanup(struct ctx_cam *cam)
     free(cam->imgs.ref_dyn);
     cam->imgs.ref_dyn = NULL;
 
+    free(cam->imgs.ref_average);
+    cam->imgs.ref_average = NULL;
+
     free(cam->imgs.image_virgin);
     cam->imgs.image_virgin = NULL;
 
@@ -740,6 +825,30 @@ void mlp_cleanup(struct ctx_cam *cam)
     free(cam->imgs.labelsize);
     cam->imgs.labelsize = NULL;
 
+    free(cam->imgs.labelparent);
+    cam->imgs.labelparent = NULL;
+
+    free(cam->imgs.block_diffs);
+    cam->imgs.block_diffs = NULL;
+
+    free(cam->imgs.motion_bits);
+    cam->imgs.motion_bits = NULL;
+
+    free(cam->imgs.motion_bits_work);
+    cam->imgs.motion_bits_work = NULL;
+
+    free(cam->imgs.location_rows);
+    cam->imgs.location_rows = NULL;
+
+    free(cam->imgs.image_coarse);
+    cam->imgs.image_coarse = NULL;
+
+    free(cam->imgs.ref_coarse);
+    cam->imgs.ref_coarse = NULL;
+
+    free(cam->imgs.block_coarse);
+    cam->imgs.block_coarse = NULL;
+
     free(cam->imgs.smartmask);
     cam->imgs.smartmask = NULL;
 
@@ -1029,17 +1138,52 @@ static int mlp_capture(struct ctx_cam *cam)
 
 }
 
+/* Carry the results of the last detection over to an image that skips it */
+static void mlp_detection_copy(struct ctx_cam *cam)
+{
+    cam->current_image->diffs = cam->detect_last.diffs;
+    cam->current_image->diffs_raw = cam->detect_last.diffs_raw;
+    cam->current_image->diffs_ratio = cam->detect_last.diffs_ratio;
+    cam->current_image->location = cam->detect_last.location;
+    cam->current_image->total_labels = cam->detect_last.total_labels;
+}
+
 static void mlp_detection(struct ctx_cam *cam)
 {
+    int histogram;
+
+    cam->detect_skipped = FALSE;
+    cam->imgs.noise_valid = FALSE;
 
     if (cam->frame_skip) {
         cam->frame_skip--;
         cam->current_image->diffs = 0;
+        alg_histogram_roll(cam, TRUE);
+        return;
+    }
+
+    if ((cam->detect_skip > 0) && !cam->pause) {
+        cam->detect_skip--;
+        cam->detect_skipped = TRUE;
+        mlp_detection_copy(cam);
         return;
     }
+    cam->detect_skip = cam->conf->detection_interval - 1;
+
+    /* The histogram is only taken for the lightswitch and the noise tuning */
+    histogram = ((cam->conf->primary_method == 0) && !cam->pause &&
+        (cam->conf->noise_tune || (cam->conf->lightswitch_percent > 0)));
+    if (histogram) {
+        alg_histogram(cam);
+    } else {
+        alg_histogram_roll(cam, FALSE);
+    }
 
     if ( !cam->pause ) {
         if (cam->conf->primary_method == 0){
+            if (alg_lightswitch_histogram(cam)) {
+                return;
+            }
             alg_diff(cam);
             alg_lightswitch(cam);
             alg_despeckle(cam);
@@ -1056,9 +1200,14 @@ static void mlp_detection(struct ctx_cam *cam)
 static void mlp_tuning(struct ctx_cam *cam)
 {
 
+    /* The reference and tuning only follow the images that ran detection */
+    if (cam->detect_skipped) {
+        return;
+    }
+
     if ((cam->conf->noise_tune && cam->shots == 0) &&
           (!cam->detecting_motion && (cam->current_image->diffs <= cam->threshold))) {
-        alg_noise_tune(cam, cam->imgs.image_vprvcy);
+        alg_noise_tune(cam);
     }
 
     if (cam->conf->threshold_tune){
@@ -1079,6 +1228,10 @@ static void mlp_tuning(struct ctx_cam *cam)
     cam->previous_location_x = cam->current_image->location.x;
     cam->previous_location_y = cam->current_image->location.y;
 
+    cam->detect_last = *cam->current_image;
+
+    webu_stream_heatmap(cam);
+
 }
 
 static void mlp_overlay(struct ctx_cam *cam)
@@ -1086,6 +1239,15 @@ static void mlp_overlay(struct ctx_cam *cam)
 
     char tmp[PATH_MAX];
 
+    /* Bring the motion image up to date when it is going to be output */
+    if ((cam->conf->picture_output_motion != "off") ||
+        cam->conf->movie_output_motion ||
+        cam->motapp->setup_mode ||
+        (cam->stream.motion.cnct_count > 0) ||
+        (cam->mpipe >= 0)) {
+        alg_motion_unpack(&cam->imgs);
+    }
+
     if (cam->smartmask_speed &&
         ((cam->conf->picture_output_motion != "off") ||
         cam->conf->movie_output_motion ||
@@ -1385,6 +1547,7 @@ static void mlp_timelapse(struct ctx_cam *cam)
         if (cam->shots == 0 &&
             cam->frame_curr_ts.tv_sec % cam->conf->timelapse_interval <=
             cam->frame_last_ts.tv_sec % cam->conf->timelapse_interval) {
+                mlp_image_high(cam, cam->current_image);
                 event(cam, EVENT_TIMELAPSE, cam->current_image, NULL
                     , NULL, &cam->current_image->imgts);
         }
@@ -24,5 +24,7 @@
 
 void *motion_loop(void *arg);
 void mlp_cleanup(struct ctx_cam *cam);
+void mlp_image_high(struct ctx_cam *cam, struct ctx_image_data *img);
+int mlp_need_full(struct ctx_cam *cam);
 
 #endif
\ No newline at end of file
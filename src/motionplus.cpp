@@ -28,6 +28,8 @@
 #include "movie.hpp"
 #include "netcam.hpp"
 #include "draw.hpp"
+#include "alg_simd.hpp"
+#include "video_common.hpp"
 
 pthread_key_t tls_key_threadnr;
 volatile enum MOTION_SIGNAL motsignal;
@@ -274,6 +276,8 @@ static void motion_shutdown(struct ctx_motapp *motapp)
 
     dbse_global_deinit(motapp);
 
+    netcam_global_deinit(motapp);
+
     conf_deinit(motapp);
 
 }
@@ -407,6 +411,12 @@ static void motion_startup(struct ctx_motapp *motapp, int daemonize, int argc, c
 
     draw_init_chars();
 
+    algsimd_init();
+
+    vid_convert_init(mysimd_type());
+
+    netcam_global_init(motapp);
+
     webu_init(motapp);
 
 }
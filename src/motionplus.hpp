@@ -78,13 +78,16 @@ struct ctx_dbse;
 struct ctx_mmalcam;
 struct ctx_movie;
 struct ctx_netcam;
+struct ctx_netcam_pool;
 struct ctx_algsec;
+struct ctx_detect_pool;
 struct ctx_config;
 struct ctx_v4l2cam;
 
 #define MYFFVER (LIBAVFORMAT_VERSION_MAJOR * 1000)+LIBAVFORMAT_VERSION_MINOR
 
 #define THRESHOLD_TUNE_LENGTH  256
+#define MOTION_BLOCK_SIZE      16   /* Pixels across and down each block of the motion grid */
 
 /* Filetype defines */
 #define FTYPE_IMAGE            1
@@ -137,6 +140,7 @@ struct ctx_v4l2cam;
 #define IMAGE_SAVED      8
 #define IMAGE_PRECAP    16
 #define IMAGE_POSTCAP   32
+#define IMAGE_NOHIGH    64  /* image_high was not decoded, see mlp_image_high */
 
 enum CAMERA_TYPE {
     CAMERA_TYPE_UNKNOWN,
@@ -159,6 +163,13 @@ enum FLIP_TYPE {
     FLIP_TYPE_VERTICAL
 };
 
+enum SIMD_TYPE {
+    SIMD_TYPE_NONE,
+    SIMD_TYPE_SSE2,
+    SIMD_TYPE_AVX2,
+    SIMD_TYPE_NEON
+};
+
 enum MOTION_SIGNAL {
     MOTION_SIGNAL_NONE,
     MOTION_SIGNAL_ALARM,
@@ -232,10 +243,13 @@ struct ctx_images {
     int ring_in;                /* Index in image ring buffer we last added a image into */
     int ring_out;               /* Index in image ring buffer we want to process next time */
 
-    int *ref_dyn;               /* Dynamic objects to be excluded from reference frame */
-    int *smartmask_buffer;
+    unsigned short *ref_dyn;    /* Dynamic objects to be excluded from reference frame */
+    unsigned short *ref_average; /* Running average of the luma in 8.8 fixed point */
+    int ref_averaged;           /* ref_average matches ref */
+    unsigned short *smartmask_buffer;  /* Saturating count of the changes of each pixel for the smart mask */
     int *labels;
     int *labelsize;
+    int *labelparent;           /* Union-find parent of each provisional label */
 
     int width;
     int height;
@@ -250,6 +264,34 @@ struct ctx_images {
     int labels_above;
     int labelsize_max;
     int largest_label;
+    int motion_chroma_dirty;        /* Bool for whether overlays changed the chroma of image_motion */
+    int *block_diffs;               /* Count of changed pixels in each block of the motion image */
+    int block_cols;                 /* Number of blocks across the image */
+    int block_rows;                 /* Number of blocks down the image */
+    int block_radius;               /* Blocks around a changed block that despeckle may have changed */
+    uint64_t *motion_bits;          /* Luma of image_motion packed one bit per pixel for despeckle */
+    uint64_t *motion_bits_work;     /* Second page of motion_bits written by each despeckle filter */
+    int motion_bits_stride;         /* Number of words in each row of motion_bits */
+    int motion_packed;              /* Bool for whether motion_bits is newer than image_motion */
+    int64_t *location_rows;         /* Count, sum of x and sum of x squared of the changes in each row */
+    int sample_seq;                 /* Frame count that moves the sample points */
+    int sample_estimate;            /* Changed pixels estimated from the last samples */
+    int sample_skips;               /* Frames the samples skipped the full diff */
+    int sample_audits;              /* Skipped frames checked with the full diff */
+    int sample_misses;              /* Checked frames that had changes after all */
+    int sample_runs;                /* Frames the samples passed to the full diff */
+    int sample_false;               /* Passed frames with few changes */
+    unsigned char *image_coarse;    /* Luma of image_vprvcy reduced by detection_scale */
+    unsigned char *ref_coarse;      /* Luma of ref reduced by detection_scale */
+    unsigned char *block_coarse;    /* Blocks of the motion grid that changed at the reduced scale */
+    int histogram[256];             /* Count of each luma level of image_vprvcy */
+    int histogram_prev[256];        /* Histogram of the image before */
+    int histogram_frames;           /* Images in a row counted into the histograms, up to 2 */
+    int luma_mean;                  /* Mean luma of image_vprvcy */
+    int luma_variance;              /* Variance of the luma of image_vprvcy */
+    int64_t noise_sum;              /* Differences from ref plus one of the pixels under the smart mask */
+    int noise_count;                /* Pixels added into noise_sum */
+    int noise_valid;                /* Bool for noise_sum being of this image, reference and smart mask */
     int size_secondary;             /* Size of the jpg put into image_secondary*/
 
 };
@@ -268,6 +310,9 @@ struct ctx_stream {
     struct ctx_stream_data  motion;     /* Copy of the image to use for web stream*/
     struct ctx_stream_data  source;     /* Copy of the image to use for web stream*/
     struct ctx_stream_data  secondary;  /* Copy of the image to use for web stream*/
+    int                     *heatmap;       /* Copy of the block diffs for the web heatmap */
+    int                     heatmap_cols;   /* Number of blocks across the heatmap copy */
+    int                     heatmap_rows;   /* Number of blocks down the heatmap copy */
 };
 
 /*
@@ -290,6 +335,7 @@ struct ctx_cam {
     struct ctx_v4l2cam      *v4l2cam;
     struct ctx_image_data   *current_image;     /* Pointer to a structure where the image, diffs etc is stored */
     struct ctx_algsec       *algsec;
+    struct ctx_detect_pool  *detect_pool;       /* Threads that share the detection of large images */
     struct ctx_rotate       *rotate_data;       /* rotation data is thread-specific */
     struct ctx_dbse         *dbse;
     struct ctx_movie        *movie_norm;
@@ -371,6 +417,9 @@ struct ctx_cam {
     int                     smartmask_count;
     unsigned int            smartmask_lastrate;
     int previous_diffs, previous_location_x, previous_location_y;
+    int                     detect_skip;        /* Images left until detection runs again */
+    int                     detect_skipped;     /* Detection did not run on the current image */
+    struct ctx_image_data   detect_last;        /* Results from the last image that ran detection */
     unsigned int            passflag;  //only purpose is to flag first frame vs all others.....
 
     pthread_mutex_t         parms_lock;
@@ -403,6 +452,8 @@ struct ctx_motapp {
     int                 setup_mode;
     int                 pause;
     int                 native_language;
+    int                 netcam_decode_threads;
+    struct ctx_netcam_pool  *netcam_pool;   /* Decoder threads shared by the network cameras */
 
     volatile int        webcontrol_running;
     volatile int        webcontrol_finish;
@@ -931,17 +931,10 @@ static int movie_put_frame(struct ctx_movie *movie, const struct timespec *ts1)
 
 }
 
-/* Reset the written flag and movie start time at opening of each event */
+/* Reset the last written packet at opening of each event */
 static void movie_passthru_reset(struct ctx_movie *movie)
 {
-    int indx;
-
-    pthread_mutex_lock(&movie->netcam_data->mutex_pktarray);
-        for(indx = 0; indx < movie->netcam_data->pktarray_size; indx++) {
-            movie->netcam_data->pktarray[indx].iswritten = FALSE;
-        }
-    pthread_mutex_unlock(&movie->netcam_data->mutex_pktarray);
-
+    movie->passthru_idnbr = 0;
 }
 
 
@@ -974,25 +967,33 @@ static int movie_passthru_pktpts(struct ctx_movie *movie)
     return 0;
 }
 
-static void movie_passthru_write(struct ctx_movie *movie, int indx)
+static void movie_passthru_write(struct ctx_movie *movie, int64_t idnbr)
 {
-    /* Write the packet in the buffer at indx to file */
+    /* Write the packet in the buffer with idnbr to file */
     char errstr[128];
-    int retcd;
+    int retcd, indx;
 
     av_init_packet(&movie->pkt);
     movie->pkt.data = NULL;
     movie->pkt.size = 0;
 
-    movie->netcam_data->pktarray[indx].iswritten = TRUE;
-
-    retcd = mycopy_packet(&movie->pkt, &movie->netcam_data->pktarray[indx].packet);
+    /* Only the reference is taken under the lock.  The write is done without it */
+    retcd = 0;
+    pthread_mutex_lock(&movie->netcam_data->mutex_pktarray);
+        indx = idnbr & (movie->netcam_data->pktarray_size - 1);
+        if ((movie->netcam_data->pktarray_size > 0) &&
+            (movie->netcam_data->pktarray[indx].idnbr == idnbr) &&
+            (movie->netcam_data->pktarray[indx].packet.size > 0)) {
+            retcd = mycopy_packet(&movie->pkt, &movie->netcam_data->pktarray[indx].packet);
+        }
+    pthread_mutex_unlock(&movie->netcam_data->mutex_pktarray);
     if (retcd < 0) {
         av_strerror(retcd, errstr, sizeof(errstr));
         MOTION_LOG(INF, TYPE_ENCODER, NO_ERRNO, "av_copy_packet: %s",errstr);
         mypacket_unref(movie->pkt);
         return;
     }
+    if (movie->pkt.size == 0) return;
 
     retcd = movie_passthru_pktpts(movie);
     if (retcd < 0) {
@@ -1011,10 +1012,16 @@ static void movie_passthru_write(struct ctx_movie *movie, int indx)
 
 }
 
+/*
+ * Write the packets after the last one written up to the one of the image.
+ * The packet array is indexed by idnbr so the range is known without a
+ * search.  The first write of a movie starts at the keyframe the image
+ * depends on.
+ */
 static int movie_passthru_put(struct ctx_movie *movie, struct ctx_image_data *img_data)
 {
-    int idnbr_image, idnbr_lastwritten, idnbr_stop, idnbr_firstkey;
-    int indx, indx_lastwritten, indx_firstkey;
+    int64_t idnbr_image, idnbr_last, idnbr_oldest, idnbr_start, idnbr_stop, idnbr;
+    int indx;
 
     if (movie->netcam_data == NULL) return -1;
 
@@ -1030,54 +1037,35 @@ static int movie_passthru_put(struct ctx_movie *movie, struct ctx_image_data *im
     }
 
     pthread_mutex_lock(&movie->netcam_data->mutex_pktarray);
-        idnbr_lastwritten = 0;
-        idnbr_firstkey = idnbr_image;
-        idnbr_stop = 0;
-        indx_lastwritten = -1;
-        indx_firstkey = -1;
-
-        for(indx = 0; indx < movie->netcam_data->pktarray_size; indx++) {
-            if ((movie->netcam_data->pktarray[indx].iswritten) &&
-                (movie->netcam_data->pktarray[indx].idnbr > idnbr_lastwritten)){
-                idnbr_lastwritten=movie->netcam_data->pktarray[indx].idnbr;
-                indx_lastwritten = indx;
-            }
-            if ((movie->netcam_data->pktarray[indx].idnbr >  idnbr_stop) &&
-                (movie->netcam_data->pktarray[indx].idnbr <= idnbr_image)){
-                idnbr_stop=movie->netcam_data->pktarray[indx].idnbr;
-            }
-            if ((movie->netcam_data->pktarray[indx].iskey) &&
-                (movie->netcam_data->pktarray[indx].idnbr <= idnbr_firstkey)){
-                    idnbr_firstkey=movie->netcam_data->pktarray[indx].idnbr;
-                    indx_firstkey = indx;
-            }
+        if (movie->netcam_data->pktarray_size == 0) {
+            pthread_mutex_unlock(&movie->netcam_data->mutex_pktarray);
+            return 0;
         }
+        idnbr_last = movie->netcam_data->pktarray_idnbr;
+        idnbr_oldest = idnbr_last - movie->netcam_data->pktarray_size + 1;
+        if (idnbr_oldest < 1) idnbr_oldest = 1;
 
-        if (idnbr_stop == 0){
+        idnbr_stop = idnbr_image;
+        if (idnbr_stop > idnbr_last) idnbr_stop = idnbr_last;
+        if (idnbr_stop < idnbr_oldest) {
             pthread_mutex_unlock(&movie->netcam_data->mutex_pktarray);
             return 0;
         }
 
-        if (indx_lastwritten != -1){
-            indx = indx_lastwritten;
-        } else if (indx_firstkey != -1) {
-            indx = indx_firstkey;
+        if (movie->passthru_idnbr != 0) {
+            idnbr_start = movie->passthru_idnbr + 1;
         } else {
-            indx = 0;
-        }
-
-        while (TRUE){
-            if ((!movie->netcam_data->pktarray[indx].iswritten) &&
-                (movie->netcam_data->pktarray[indx].packet.size > 0) &&
-                (movie->netcam_data->pktarray[indx].idnbr >  idnbr_lastwritten) &&
-                (movie->netcam_data->pktarray[indx].idnbr <= idnbr_image)) {
-                movie_passthru_write(movie, indx);
-            }
-            if (movie->netcam_data->pktarray[indx].idnbr == idnbr_stop) break;
-            indx++;
-            if (indx == movie->netcam_data->pktarray_size ) indx = 0;
+            indx = idnbr_stop & (movie->netcam_data->pktarray_size - 1);
+            idnbr_start = movie->netcam_data->pktarray[indx].idnbr_key;
         }
+        if (idnbr_start < idnbr_oldest) idnbr_start = idnbr_oldest;
     pthread_mutex_unlock(&movie->netcam_data->mutex_pktarray);
+
+    for (idnbr = idnbr_start; idnbr <= idnbr_stop; idnbr++) {
+        movie_passthru_write(movie, idnbr);
+        movie->passthru_idnbr = idnbr;
+    }
+
     return 0;
 }
 
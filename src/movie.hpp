@@ -71,6 +71,7 @@ struct ctx_movie {
     int            high_resolution;
     int            motion_images;
     int            passthrough;
+    int64_t        passthru_idnbr;  /* The idnbr of the last packet written */
     enum USER_CODEC     preferred_codec;
     char *nal_info;
     int  nal_info_len;
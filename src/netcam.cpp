@@ -39,12 +39,19 @@
 #include "rotate.hpp"
 #include "netcam.hpp"
 #include "movie.hpp"
+#include "motion_loop.hpp"
 
+/*
+ * The image buffers are swapped with the image ring of the motion loop so
+ * they must be freed with free.  New buffers start on a 64 byte boundary
+ * but one swapped in from the ring may not, so nothing relies on it.
+ */
 static void netcam_check_buffsize(netcam_buff_ptr buff, size_t numbytes)
 {
     int min_size_to_alloc;
     int real_alloc;
     int new_size;
+    char *new_ptr;
 
     if ((buff->size - buff->used) >= numbytes)
         return;
@@ -62,8 +69,16 @@ static void netcam_check_buffsize(netcam_buff_ptr buff, size_t numbytes)
         ,(int) buff->used, (int) buff->size
         ,(int) buff->used, new_size);
 
-    buff->ptr =(char*) myrealloc(buff->ptr, new_size,
-                          "netcam_check_buf_size");
+    if (posix_memalign((void **)&new_ptr, 64, new_size) != 0) {
+        MOTION_LOG(EMG, TYPE_NETCAM, NO_ERRNO
+            ,_("Could not resize memory-block at offset %p to %d bytes (function %s)!")
+            ,buff->ptr, new_size, "netcam_check_buf_size");
+        exit(1);
+    }
+    if (buff->used > 0) memcpy(new_ptr, buff->ptr, buff->used);
+    free(buff->ptr);
+
+    buff->ptr = new_ptr;
     buff->size = new_size;
 }
 
@@ -277,6 +292,19 @@ static int netcam_check_pixfmt(struct ctx_netcam *netcam)
 
 }
 
+static int netcam_check_resize(struct ctx_netcam *netcam)
+{
+    /* Determine if the frame needs to go through the scaling context */
+    if ((netcam->imgsize.width  != netcam->frame->width) ||
+        (netcam->imgsize.height != netcam->frame->height) ||
+        (netcam_check_pixfmt(netcam) != 0)) {
+        return -1;
+    }
+
+    return 0;
+
+}
+
 static void netcam_pktarray_free(struct ctx_netcam *netcam)
 {
 
@@ -292,7 +320,8 @@ static void netcam_pktarray_free(struct ctx_netcam *netcam)
         free(netcam->pktarray);
         netcam->pktarray = NULL;
         netcam->pktarray_size = 0;
-        netcam->pktarray_index = -1;
+        netcam->pktarray_idnbr = 0;
+        netcam->pktarray_key = 0;
     pthread_mutex_unlock(&netcam->mutex_pktarray);
 
 }
@@ -301,7 +330,6 @@ static void netcam_null_context(struct ctx_netcam *netcam)
 {
 
     netcam->swsctx          = NULL;
-    netcam->swsframe_in     = NULL;
     netcam->swsframe_out    = NULL;
     netcam->frame           = NULL;
     netcam->codec_context   = NULL;
@@ -312,11 +340,56 @@ static void netcam_null_context(struct ctx_netcam *netcam)
 
 }
 
+/* Drop the packets waiting for the decoder pool.  The pool mutex must be held */
+static int netcam_pool_flush(struct ctx_netcam *netcam)
+{
+    int indx, cnt;
+
+    cnt = netcam->pool_cnt;
+    for (indx = 0; indx < cnt; indx++) {
+        mypacket_unref(netcam->pool_queue[(netcam->pool_head + indx) % NETCAM_POOL_QUEUE].packet);
+    }
+    netcam->pool_head = 0;
+    netcam->pool_cnt = 0;
+
+    return cnt;
+}
+
+/*
+ * Take the camera out of the decoder pool.  This waits for a worker that
+ * is still decoding for the camera so the contexts can then be closed.
+ */
+static void netcam_pool_detach(struct ctx_netcam *netcam)
+{
+    struct ctx_netcam_pool *pool = netcam->pool;
+    int indx;
+
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->mutex);
+        for (indx = 0; indx < pool->netcam_cnt; indx++) {
+            if (pool->netcam_list[indx] == netcam) {
+                pool->netcam_cnt--;
+                pool->netcam_list[indx] = pool->netcam_list[pool->netcam_cnt];
+                break;
+            }
+        }
+        while (netcam->pool_busy) {
+            pthread_cond_wait(&pool->cond_idle, &pool->mutex);
+        }
+        netcam_pool_flush(netcam);
+    pthread_mutex_unlock(&pool->mutex);
+
+    netcam->pool = NULL;
+
+}
+
 static void netcam_close_context(struct ctx_netcam *netcam)
 {
 
+    netcam_pool_detach(netcam);
+
     if (netcam->swsctx       != NULL) sws_freeContext(netcam->swsctx);
-    if (netcam->swsframe_in  != NULL) myframe_free(netcam->swsframe_in);
     if (netcam->swsframe_out != NULL) myframe_free(netcam->swsframe_out);
     if (netcam->frame        != NULL) myframe_free(netcam->frame);
     if (netcam->pktarray     != NULL) netcam_pktarray_free(netcam);
@@ -345,13 +418,17 @@ static void netcam_pktarray_resize(struct ctx_cam *cam, int is_highres)
      * slow down the capture thread to the speed of the writing thread.  And that
      * writing thread operates at the user specified FPS which could be really slow
      * ...So....make this array big enough so we never catch our tail.  :)
+     *
+     * The packet with a idnbr is at (idnbr & (pktarray_size - 1)) so the size
+     * is kept at a power of two and the packets are moved to their new place
+     * when it grows.
      */
 
     int64_t               idnbr_last, idnbr_first;
-    int                   indx;
+    int                   indx, indx_new;
     struct ctx_netcam  *netcam;
     struct packet_item   *tmp;
-    int                   newsize;
+    int                   newsize, minsize;
 
     if (is_highres){
         idnbr_last = cam->imgs.image_ring[cam->imgs.ring_out].idnbr_high;
@@ -365,35 +442,40 @@ static void netcam_pktarray_resize(struct ctx_cam *cam, int is_highres)
 
     if (!netcam->passthrough) return;
 
-    /* The 30 is arbitrary */
+    /* The 32 is arbitrary */
     /* Double the size plus double last diff so we don't catch our tail */
-    newsize =((idnbr_first - idnbr_last) * 1 ) + ((netcam->idnbr - idnbr_last ) * 2);
-    if (newsize < 30) newsize = 30;
+    minsize =((idnbr_first - idnbr_last) * 1 ) + ((netcam->idnbr - idnbr_last ) * 2);
+    if (minsize < 32) minsize = 32;
 
-    pthread_mutex_lock(&netcam->mutex_pktarray);
-        if ((netcam->pktarray_size < newsize) ||  (netcam->pktarray_size < 30)){
-            tmp =(packet_item*) mymalloc(newsize * sizeof(struct packet_item));
-            if (netcam->pktarray_size > 0 ){
-                memcpy(tmp, netcam->pktarray, sizeof(struct packet_item) * netcam->pktarray_size);
-            }
-            for(indx = netcam->pktarray_size; indx < newsize; indx++) {
-                av_init_packet(&tmp[indx].packet);
-                tmp[indx].packet.data=NULL;
-                tmp[indx].packet.size=0;
-                tmp[indx].idnbr = 0;
-                tmp[indx].iskey = false;
-                tmp[indx].iswritten = false;
-            }
+    if (netcam->pktarray_size >= minsize) return;
 
-            if (netcam->pktarray != NULL) free(netcam->pktarray);
-            netcam->pktarray = tmp;
-            netcam->pktarray_size = newsize;
+    newsize = 32;
+    while (newsize < minsize) newsize <<= 1;
 
-            MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
-                ,_("%s: Resized packet array to %d"), netcam->cameratype,newsize);
+    tmp =(packet_item*) mymalloc(newsize * sizeof(struct packet_item));
+    for(indx = 0; indx < newsize; indx++) {
+        av_init_packet(&tmp[indx].packet);
+        tmp[indx].packet.data=NULL;
+        tmp[indx].packet.size=0;
+        tmp[indx].idnbr = 0;
+        tmp[indx].idnbr_key = 0;
+    }
+
+    pthread_mutex_lock(&netcam->mutex_pktarray);
+        for(indx = 0; indx < netcam->pktarray_size; indx++) {
+            if (netcam->pktarray[indx].idnbr == 0) continue;
+            indx_new = netcam->pktarray[indx].idnbr & (newsize - 1);
+            tmp[indx_new] = netcam->pktarray[indx];
         }
+
+        if (netcam->pktarray != NULL) free(netcam->pktarray);
+        netcam->pktarray = tmp;
+        netcam->pktarray_size = newsize;
     pthread_mutex_unlock(&netcam->mutex_pktarray);
 
+    MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+        ,_("%s: Resized packet array to %d"), netcam->cameratype,newsize);
+
 }
 
 static void netcam_pktarray_add(struct ctx_netcam *netcam)
@@ -410,12 +492,7 @@ static void netcam_pktarray_add(struct ctx_netcam *netcam)
             return;
         }
 
-        /* Recall pktarray_size is one based but pktarray is zero based */
-        if (netcam->pktarray_index == (netcam->pktarray_size-1) ){
-            indx_next = 0;
-        } else {
-            indx_next = netcam->pktarray_index + 1;
-        }
+        indx_next = netcam->idnbr & (netcam->pktarray_size - 1);
 
         netcam->pktarray[indx_next].idnbr = netcam->idnbr;
 
@@ -436,15 +513,15 @@ static void netcam_pktarray_add(struct ctx_netcam *netcam)
             netcam->pktarray[indx_next].packet.size = 0;
         }
 
-        if (netcam->pktarray[indx_next].packet.flags & AV_PKT_FLAG_KEY) {
-            netcam->pktarray[indx_next].iskey = true;
-        } else {
-            netcam->pktarray[indx_next].iskey = false;
+        /* Audio packets are usually flagged as keys so only video keyframes are indexed */
+        if ((netcam->pktarray[indx_next].packet.flags & AV_PKT_FLAG_KEY) &&
+            (netcam->pktarray[indx_next].packet.stream_index == netcam->video_stream_index)) {
+            netcam->pktarray_key = netcam->idnbr;
         }
-        netcam->pktarray[indx_next].iswritten = false;
+        netcam->pktarray[indx_next].idnbr_key = netcam->pktarray_key;
         clock_gettime(CLOCK_REALTIME, &netcam->pktarray[indx_next].timestamp_ts);
 
-        netcam->pktarray_index = indx_next;
+        netcam->pktarray_idnbr = netcam->idnbr;
     pthread_mutex_unlock(&netcam->mutex_pktarray);
 
 }
@@ -530,6 +607,51 @@ static int netcam_decode_vaapi(struct ctx_netcam *netcam)
     #endif
 }
 
+/*
+ * Reduce the decoding while the motion loop does not need every frame.
+ * The reduction is dropped as soon as full decoding is requested.  For
+ * keyframe only decoding that waits until the next keyframe since the
+ * frames in between cannot be decoded.
+ * Returns 1 when the packet is not to be sent to the decoder.
+ */
+static int netcam_decode_skip(struct ctx_netcam *netcam, AVPacket *pkt)
+{
+    int decode_full, iskey;
+
+    if ((netcam->decode_reduce == NETCAM_DECODE_FULL) &&
+        (netcam->decode_nth <= 1)) {
+        return 0;
+    }
+
+    decode_full = __atomic_load_n(&netcam->decode_full, __ATOMIC_RELAXED);
+    iskey = (pkt->flags & AV_PKT_FLAG_KEY);
+
+    if (decode_full && netcam->decode_reduced) {
+        if ((netcam->decode_reduce != NETCAM_DECODE_KEYFRAME) || iskey) {
+            netcam->codec_context->skip_frame = AVDISCARD_DEFAULT;
+            netcam->codec_context->skip_loop_filter = AVDISCARD_DEFAULT;
+            netcam->decode_reduced = false;
+        }
+    } else if (!decode_full && !netcam->decode_reduced) {
+        if (netcam->decode_reduce == NETCAM_DECODE_LOOPFILTER) {
+            netcam->codec_context->skip_loop_filter = AVDISCARD_ALL;
+        } else if (netcam->decode_reduce == NETCAM_DECODE_NONREF) {
+            netcam->codec_context->skip_frame = AVDISCARD_NONREF;
+            netcam->codec_context->skip_loop_filter = AVDISCARD_ALL;
+        } else if (netcam->decode_reduce == NETCAM_DECODE_KEYFRAME) {
+            netcam->codec_context->skip_frame = AVDISCARD_NONKEY;
+        }
+        netcam->decode_reduced = true;
+        netcam->decode_cnt = 0;
+    }
+
+    if (netcam->decode_reduced && (netcam->decode_nth > 1)) {
+        if ((netcam->decode_cnt++ % netcam->decode_nth) != 0) return 1;
+    }
+
+    return 0;
+}
+
 /* netcam_decode_video
  *
  * Return values:
@@ -538,7 +660,7 @@ static int netcam_decode_vaapi(struct ctx_netcam *netcam)
  *   1 valid data
  */
 
-static int netcam_decode_video(struct ctx_netcam *netcam)
+static int netcam_decode_video(struct ctx_netcam *netcam, AVPacket *pkt)
 {
     #if (MYFFVER >= 57041)
         int retcd;
@@ -551,7 +673,9 @@ static int netcam_decode_video(struct ctx_netcam *netcam)
         */
         if (netcam->finish) return 0;   /* This just speeds up the shutdown time */
 
-        retcd = avcodec_send_packet(netcam->codec_context, &netcam->packet_recv);
+        if (netcam_decode_skip(netcam, pkt)) return 0;
+
+        retcd = avcodec_send_packet(netcam->codec_context, pkt);
         if ((netcam->interrupted) || (netcam->finish)){
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                 ,_("%s: Interrupted or finish on send")
@@ -591,7 +715,9 @@ static int netcam_decode_video(struct ctx_netcam *netcam)
 
         if (netcam->finish) return 0;   /* This just speeds up the shutdown time */
 
-        retcd = avcodec_decode_video2(netcam->codec_context, netcam->frame, &check, &netcam->packet_recv);
+        if (netcam_decode_skip(netcam, pkt)) return 0;
+
+        retcd = avcodec_decode_video2(netcam->codec_context, netcam->frame, &check, pkt);
         if ((netcam->interrupted) || (netcam->finish)) return -1;
 
         if (retcd == AVERROR_INVALIDDATA) {
@@ -612,7 +738,7 @@ static int netcam_decode_video(struct ctx_netcam *netcam)
 
 }
 
-static int netcam_decode_packet(struct ctx_netcam *netcam)
+static int netcam_decode_packet(struct ctx_netcam *netcam, AVPacket *pkt)
 {
 
     int frame_size;
@@ -620,21 +746,23 @@ static int netcam_decode_packet(struct ctx_netcam *netcam)
 
     if (netcam->finish) return -1;   /* This just speeds up the shutdown time */
 
-    if (netcam->packet_recv.stream_index == netcam->audio_stream_index) {
+    if (pkt->stream_index == netcam->audio_stream_index) {
         MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
             ,_("%s: Error decoding video packet...it is audio")
             ,netcam->cameratype);
     }
 
-    retcd = netcam_decode_video(netcam);
+    retcd = netcam_decode_video(netcam, pkt);
     if (retcd <= 0) return retcd;
 
+    /* netcam_resize scales the frame straight into the image buffer */
+    if (netcam_check_resize(netcam) != 0) return 1;
+
     frame_size = myimage_get_buffer_size((enum AVPixelFormat) netcam->frame->format
                                         ,netcam->frame->width
                                         ,netcam->frame->height);
 
     netcam_check_buffsize(netcam->img_recv, frame_size);
-    netcam_check_buffsize(netcam->img_latest, frame_size);
 
     retcd = myimage_copy_to_buffer(netcam->frame
                                     ,(uint8_t *)netcam->img_recv->ptr
@@ -805,6 +933,43 @@ static int netcam_init_vaapi(struct ctx_netcam *netcam)
     #endif
 }
 
+/*
+ * Have the mjpeg decoder scale the IDCT to 1/mjpeg_scale of the image
+ * the same way that jpgutl_decode_jpeg does for v4l2 devices.
+ */
+static void netcam_init_lowres(struct ctx_netcam *netcam)
+{
+    int lowres;
+
+    netcam->lowres = 0;
+    if (netcam->mjpeg_scale <= 1) {
+        return;
+    }
+
+    if (netcam->codec_context->codec_id != AV_CODEC_ID_MJPEG) {
+        MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+            ,_("%s: mjpeg_scale is only used with mjpeg.  Ignoring")
+            ,netcam->cameratype);
+        return;
+    }
+
+    lowres = 0;
+    while ((1 << (lowres + 1)) <= netcam->mjpeg_scale) {
+        lowres++;
+    }
+    if (lowres > netcam->decoder->max_lowres) {
+        MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+            ,_("%s: Decoder %s can only scale by %d.  Using %d")
+            ,netcam->cameratype, netcam->decoder->name
+            ,(1 << netcam->decoder->max_lowres), (1 << netcam->decoder->max_lowres));
+        lowres = netcam->decoder->max_lowres;
+    }
+
+    netcam->codec_context->lowres = lowres;
+    netcam->lowres = lowres;
+
+}
+
 static int netcam_init_swdecoder(struct ctx_netcam *netcam)
 {
     #if ( MYFFVER >= 57041)
@@ -845,6 +1010,8 @@ static int netcam_init_swdecoder(struct ctx_netcam *netcam)
         netcam->codec_context->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
         netcam->codec_context->err_recognition = AV_EF_EXPLODE;
 
+        netcam_init_lowres(netcam);
+
         return 0;
     #else
         int retcd;
@@ -854,6 +1021,7 @@ static int netcam_init_swdecoder(struct ctx_netcam *netcam)
             netcam_decoder_error(netcam, 0, "avcodec_find_decoder");
             return -1;
         }
+        netcam_init_lowres(netcam);
         retcd = avcodec_open2(netcam->codec_context, netcam->decoder, NULL);
         if ((retcd < 0) || (netcam->interrupted)) {
             netcam_decoder_error(netcam, retcd, "avcodec_open2");
@@ -864,6 +1032,32 @@ static int netcam_init_swdecoder(struct ctx_netcam *netcam)
 
 }
 
+static void netcam_decode_init(struct ctx_netcam *netcam)
+{
+    const AVCodecDescriptor *desc;
+
+    netcam->decode_reduced = false;
+    netcam->decode_cnt = 0;
+
+    /* Packets can only be left out when every frame is a keyframe */
+    if (netcam->decode_nth > 1) {
+        desc = avcodec_descriptor_get(netcam->codec_context->codec_id);
+        if ((desc == NULL) || !(desc->props & AV_CODEC_PROP_INTRA_ONLY)) {
+            MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+                ,_("%s: decode_nth is only used with intra only codecs such as mjpeg.  Ignoring")
+                ,netcam->cameratype);
+            netcam->decode_nth = 1;
+        }
+    }
+
+    if ((netcam->decode_reduce != NETCAM_DECODE_FULL) || (netcam->decode_nth > 1)) {
+        MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+            ,_("%s: Reduced decoding outside of events")
+            ,netcam->cameratype);
+    }
+
+}
+
 static int netcam_open_codec(struct ctx_netcam *netcam)
 {
     #if ( MYFFVER >= 57041)
@@ -907,6 +1101,8 @@ static int netcam_open_codec(struct ctx_netcam *netcam)
             return -1;
         }
 
+        netcam_decode_init(netcam);
+
         MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
             ,_("%s: Decoder opened"),netcam->cameratype);
 
@@ -933,6 +1129,7 @@ static int netcam_open_codec(struct ctx_netcam *netcam)
         netcam->strm = netcam->format_context->streams[netcam->video_stream_index];
 
         retcd = netcam_init_swdecoder(netcam);
+        if (retcd == 0) netcam_decode_init(netcam);
 
         return retcd;
     #endif
@@ -1000,17 +1197,6 @@ static int netcam_open_sws(struct ctx_netcam *netcam)
 
     if (netcam->finish) return -1;   /* This just speeds up the shutdown time */
 
-    netcam->swsframe_in = myframe_alloc();
-    if (netcam->swsframe_in == NULL) {
-        if (netcam->status == NETCAM_NOTCONNECTED){
-            MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
-                , _("%s: Unable to allocate swsframe_in.")
-                , netcam->cameratype);
-        }
-        netcam_close_context(netcam);
-        return -1;
-    }
-
     netcam->swsframe_out = myframe_alloc();
     if (netcam->swsframe_out == NULL) {
         if (netcam->status == NETCAM_NOTCONNECTED){
@@ -1018,7 +1204,6 @@ static int netcam_open_sws(struct ctx_netcam *netcam)
                 , _("%s: Unable to allocate swsframe_out.")
                 , netcam->cameratype);
         }
-        netcam_close_context(netcam);
         return -1;
     }
 
@@ -1046,7 +1231,6 @@ static int netcam_open_sws(struct ctx_netcam *netcam)
                 , _("%s: Unable to allocate scaling context.")
                 , netcam->cameratype);
         }
-        netcam_close_context(netcam);
         return -1;
     }
 
@@ -1060,14 +1244,9 @@ static int netcam_open_sws(struct ctx_netcam *netcam)
                 , _("%s: Error determining size of frame out")
                 , netcam->cameratype);
         }
-        netcam_close_context(netcam);
         return -1;
     }
 
-    /* the image buffers must be big enough to hold the final frame after resizing */
-    netcam_check_buffsize(netcam->img_recv, netcam->swsframe_size);
-    netcam_check_buffsize(netcam->img_latest, netcam->swsframe_size);
-
     return 0;
 
 }
@@ -1077,7 +1256,6 @@ static int netcam_resize(struct ctx_netcam *netcam)
 
     int      retcd;
     char     errstr[128];
-    uint8_t *buffer_out;
 
     if (netcam->finish) return -1;   /* This just speeds up the shutdown time */
 
@@ -1085,28 +1263,13 @@ static int netcam_resize(struct ctx_netcam *netcam)
         if (netcam_open_sws(netcam) < 0) return -1;
     }
 
-    retcd=myimage_fill_arrays(
-        netcam->swsframe_in
-        ,(uint8_t*)netcam->img_recv->ptr
-        ,(enum AVPixelFormat)netcam->frame->format
-        ,netcam->frame->width
-        ,netcam->frame->height);
-    if (retcd < 0) {
-        if (netcam->status == NETCAM_NOTCONNECTED){
-            av_strerror(retcd, errstr, sizeof(errstr));
-            MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
-                ,_("%s: Error allocating picture in: %s")
-                , netcam->cameratype, errstr);
-        }
-        netcam_close_context(netcam);
-        return -1;
-    }
-
-    buffer_out=(uint8_t *)av_malloc(netcam->swsframe_size*sizeof(uint8_t));
+    /* The receiving buffer must be big enough to hold the final frame after resizing */
+    netcam_check_buffsize(netcam->img_recv, netcam->swsframe_size);
 
+    /* The output frame points into the receiving buffer so no copy is needed after scaling */
     retcd=myimage_fill_arrays(
         netcam->swsframe_out
-        ,buffer_out
+        ,(uint8_t *)netcam->img_recv->ptr
         ,MY_PIX_FMT_YUV420P
         ,netcam->imgsize.width
         ,netcam->imgsize.height);
@@ -1117,14 +1280,13 @@ static int netcam_resize(struct ctx_netcam *netcam)
                 ,_("%s: Error allocating picture out: %s")
                 , netcam->cameratype, errstr);
         }
-        netcam_close_context(netcam);
         return -1;
     }
 
     retcd = sws_scale(
         netcam->swsctx
-        ,(const uint8_t* const *)netcam->swsframe_in->data
-        ,netcam->swsframe_in->linesize
+        ,(const uint8_t* const *)netcam->frame->data
+        ,netcam->frame->linesize
         ,0
         ,netcam->frame->height
         ,netcam->swsframe_out->data
@@ -1136,33 +1298,236 @@ static int netcam_resize(struct ctx_netcam *netcam)
                 ,_("%s: Error resizing/reformatting: %s")
                 , netcam->cameratype, errstr);
         }
-        netcam_close_context(netcam);
         return -1;
     }
+    netcam->img_recv->used = netcam->swsframe_size;
 
-    retcd=myimage_copy_to_buffer(
-         netcam->swsframe_out
-        ,(uint8_t *)netcam->img_recv->ptr
-        ,MY_PIX_FMT_YUV420P
-        ,netcam->imgsize.width
-        ,netcam->imgsize.height
-        ,netcam->swsframe_size);
-    if (retcd < 0) {
-        if (netcam->status == NETCAM_NOTCONNECTED){
-            av_strerror(retcd, errstr, sizeof(errstr));
-            MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
-                ,_("%s: Error putting frame into output buffer: %s")
-                , netcam->cameratype, errstr);
-        }
-        netcam_close_context(netcam);
+    return 0;
+
+}
+
+/* Add the camera to the decoder pool.  This is called from the handler once connected */
+static void netcam_pool_attach(struct ctx_netcam *netcam)
+{
+    struct ctx_netcam_pool *pool = netcam->motapp->netcam_pool;
+
+    if ((pool == NULL) || (netcam->pool != NULL)) return;
+
+    /* For a high resolution pass-through we don't decode the image */
+    if (netcam->high_resolution && netcam->passthrough) return;
+
+    pthread_mutex_lock(&pool->mutex);
+        if (pool->netcam_cnt == pool->netcam_max) {
+            pool->netcam_max += 4;
+            pool->netcam_list =(struct ctx_netcam **)myrealloc(pool->netcam_list
+                , pool->netcam_max * sizeof(struct ctx_netcam *), "netcam_pool_attach");
+        }
+        pool->netcam_list[pool->netcam_cnt++] = netcam;
+        netcam->pool_head = 0;
+        netcam->pool_cnt = 0;
+        netcam->pool_busy = false;
+        netcam->pool_error = false;
+        netcam->pool_wait_key = false;
+        netcam->pool_lat_sum = 0;
+        netcam->pool_lat_max = 0;
+        netcam->pool_lat_cnt = 0;
+        netcam->pool_drop_cnt = 0;
+        clock_gettime(CLOCK_REALTIME, &netcam->pool_report_ts);
+        netcam->pool = pool;
+    pthread_mutex_unlock(&pool->mutex);
+
+}
+
+/*
+ * Queue the packet just read for the decoder pool.  When the workers fall
+ * behind, the queue is dropped and so is every packet up to the next
+ * keyframe since the frames in between could not be decoded anyway.
+ * Returns 1 once the packet is queued or dropped and -1 when a worker
+ * failed to decode for this camera.
+ */
+static int netcam_pool_queue(struct ctx_netcam *netcam)
+{
+    struct ctx_netcam_pool *pool = netcam->pool;
+    struct netcam_pool_pkt item;
+    int retcd, indx;
+
+    av_init_packet(&item.packet);
+    item.packet.data = NULL;
+    item.packet.size = 0;
+    if (mycopy_packet(&item.packet, &netcam->packet_recv) < 0) {
+        mypacket_unref(item.packet);
         return -1;
     }
-    netcam->img_recv->used = netcam->swsframe_size;
+    item.idnbr = netcam->idnbr + 1;     /* The idnbr the packet gets below in netcam_read_image */
+    clock_gettime(CLOCK_REALTIME, &item.queued_ts);
 
-    av_free(buffer_out);
+    retcd = 1;
+    pthread_mutex_lock(&pool->mutex);
+        if (netcam->pool_error) {
+            retcd = -1;
+        } else {
+            if (netcam->pool_cnt == NETCAM_POOL_QUEUE) {
+                netcam->pool_drop_cnt += netcam_pool_flush(netcam);
+                netcam->pool_wait_key = true;
+            }
+            if (netcam->pool_wait_key && !(item.packet.flags & AV_PKT_FLAG_KEY)) {
+                netcam->pool_drop_cnt++;
+            } else {
+                netcam->pool_wait_key = false;
+                indx = (netcam->pool_head + netcam->pool_cnt) % NETCAM_POOL_QUEUE;
+                netcam->pool_queue[indx] = item;
+                netcam->pool_cnt++;
+                item.packet.data = NULL;
+                pthread_cond_signal(&pool->cond_work);
+            }
+        }
+    pthread_mutex_unlock(&pool->mutex);
 
-    return 0;
+    if (item.packet.data != NULL) mypacket_unref(item.packet);
 
+    return retcd;
+}
+
+/*
+ * Pick the next camera in turn that has a packet waiting and no worker
+ * decoding for it.  The pool mutex must be held.
+ */
+static struct ctx_netcam *netcam_pool_pick(struct ctx_netcam_pool *pool)
+{
+    struct ctx_netcam *netcam;
+    int indx, cnt;
+
+    for (cnt = 0; cnt < pool->netcam_cnt; cnt++) {
+        indx = (pool->netcam_next + cnt) % pool->netcam_cnt;
+        netcam = pool->netcam_list[indx];
+        if ((netcam->pool_cnt > 0) && (!netcam->pool_busy) && (!netcam->pool_error)) {
+            pool->netcam_next = indx + 1;
+            return netcam;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Decode a packet on a pool worker and publish the image the same way
+ * the handler does when it decodes.
+ * Return values:
+ *   <0 error
+ *   0 no image from the packet
+ *   1 image published
+ */
+static int netcam_pool_decode(struct ctx_netcam *netcam, struct netcam_pool_pkt *item)
+{
+    int retcd;
+
+    netcam->img_recv->used = 0;
+    retcd = netcam_decode_packet(netcam, &item->packet);
+    if (retcd <= 0) return retcd;
+
+    clock_gettime(CLOCK_REALTIME, &netcam->img_recv->image_time);
+
+    if (netcam_check_resize(netcam) != 0) {
+        if (netcam_resize(netcam) < 0) return -1;
+    }
+
+    netcam->img_recv->idnbr = item->idnbr;
+    netcam->img_recv = __atomic_exchange_n(&netcam->img_latest
+        , netcam->img_recv, __ATOMIC_ACQ_REL);
+
+    return 1;
+}
+
+/* Add up the time from queued to published and report it every minute.  The pool mutex must be held */
+static void netcam_pool_latency(struct ctx_netcam *netcam, struct timespec *queued_ts)
+{
+    struct timespec curr_ts;
+    int64_t lat_usec;
+
+    clock_gettime(CLOCK_REALTIME, &curr_ts);
+
+    if (queued_ts != NULL) {
+        lat_usec = ((curr_ts.tv_sec - queued_ts->tv_sec) * 1000000L) +
+            ((curr_ts.tv_nsec - queued_ts->tv_nsec) / 1000);
+        netcam->pool_lat_sum += lat_usec;
+        netcam->pool_lat_cnt++;
+        if (lat_usec > netcam->pool_lat_max) netcam->pool_lat_max = lat_usec;
+    }
+
+    if ((curr_ts.tv_sec - netcam->pool_report_ts.tv_sec) < 60) return;
+
+    if (netcam->pool_lat_cnt > 0) {
+        MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+            ,_("%s: Decoder pool latency avg %ld max %ld usec for %d images, %d packets dropped")
+            ,netcam->cameratype
+            ,(long)(netcam->pool_lat_sum / netcam->pool_lat_cnt)
+            ,(long)netcam->pool_lat_max
+            ,netcam->pool_lat_cnt, netcam->pool_drop_cnt);
+    } else if (netcam->pool_drop_cnt > 0) {
+        MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+            ,_("%s: Decoder pool dropped %d packets")
+            ,netcam->cameratype, netcam->pool_drop_cnt);
+    }
+    netcam->pool_lat_sum = 0;
+    netcam->pool_lat_max = 0;
+    netcam->pool_lat_cnt = 0;
+    netcam->pool_drop_cnt = 0;
+    netcam->pool_report_ts = curr_ts;
+
+}
+
+/*
+ * A worker of the decoder pool.  It takes one packet at a time from the
+ * cameras in turn.  Only one worker decodes for a camera at a time so
+ * the packets of each camera are decoded in order.
+ */
+static void *netcam_pool_handler(void *arg)
+{
+    struct ctx_netcam_pool *pool = (struct ctx_netcam_pool *)arg;
+    struct ctx_netcam *netcam;
+    struct netcam_pool_pkt item;
+    int indx, retcd;
+
+    /* netcam_global_init holds the mutex until every thread_id is set */
+    pthread_mutex_lock(&pool->mutex);
+    indx = 0;
+    while ((indx < pool->thread_cnt) && (!pthread_equal(pool->thread_id[indx], pthread_self()))) {
+        indx++;
+    }
+    mythreadname_set("nd", indx + 1, "decoder");
+
+    while (true) {
+        netcam = NULL;
+        while ((!pool->finish) && ((netcam = netcam_pool_pick(pool)) == NULL)) {
+            pthread_cond_wait(&pool->cond_work, &pool->mutex);
+        }
+        if (pool->finish) break;
+
+        item = netcam->pool_queue[netcam->pool_head];
+        netcam->pool_head = (netcam->pool_head + 1) % NETCAM_POOL_QUEUE;
+        netcam->pool_cnt--;
+        netcam->pool_busy = true;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)netcam->threadnbr));
+        retcd = netcam_pool_decode(netcam, &item);
+        mypacket_unref(item.packet);
+        pthread_setspecific(tls_key_threadnr, (void *)(0));
+
+        pthread_mutex_lock(&pool->mutex);
+        if (retcd < 0) {
+            /* The handler sees the error on its next packet and reconnects */
+            netcam->pool_error = true;
+            netcam_pool_flush(netcam);
+        } else {
+            netcam_pool_latency(netcam, (retcd > 0) ? &item.queued_ts : NULL);
+        }
+        netcam->pool_busy = false;
+        pthread_cond_broadcast(&pool->cond_idle);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
 }
 
 static int netcam_read_image(struct ctx_netcam *netcam)
@@ -1170,7 +1535,6 @@ static int netcam_read_image(struct ctx_netcam *netcam)
 
     int  size_decoded, retcd, haveimage, errcnt;
     char errstr[128];
-    netcam_buff *xchg;
 
     if (netcam->finish) return -1;   /* This just speeds up the shutdown time */
 
@@ -1183,7 +1547,8 @@ static int netcam_read_image(struct ctx_netcam *netcam)
     netcam->interruptduration = 10;
 
     netcam->status = NETCAM_READINGIMAGE;
-    netcam->img_recv->used = 0;
+    /* With the decoder pool the receiving buffer belongs to the workers */
+    if (netcam->pool == NULL) netcam->img_recv->used = 0;
     size_decoded = 0;
     errcnt = 0;
     haveimage = false;
@@ -1215,14 +1580,24 @@ static int netcam_read_image(struct ctx_netcam *netcam)
                     if (netcam->packet_recv.data != NULL) {
                         size_decoded = 1;
                     }
+                } else if (netcam->pool != NULL) {
+                    size_decoded = netcam_pool_queue(netcam);
                 } else {
-                    size_decoded = netcam_decode_packet(netcam);
+                    size_decoded = netcam_decode_packet(netcam, &netcam->packet_recv);
                 }
             }
             if (size_decoded > 0 ){
                 haveimage = true;
             } else if (size_decoded == 0){
                 /* Did not fail, just didn't get anything.  Try again */
+                /* The packet is still needed for pass-through */
+                if ((netcam->passthrough) &&
+                    (netcam->packet_recv.stream_index == netcam->video_stream_index)) {
+                    pthread_mutex_lock(&netcam->mutex);
+                        netcam->idnbr++;
+                        netcam_pktarray_add(netcam);
+                    pthread_mutex_unlock(&netcam->mutex);
+                }
                 mypacket_unref(netcam->packet_recv);
                 av_init_packet(&netcam->packet_recv);
                 netcam->packet_recv.data = NULL;
@@ -1234,19 +1609,20 @@ static int netcam_read_image(struct ctx_netcam *netcam)
             }
         }
     }
-    clock_gettime(CLOCK_REALTIME, &netcam->img_recv->image_time);
+    if (netcam->pool == NULL) {
+        clock_gettime(CLOCK_REALTIME, &netcam->img_recv->image_time);
+    }
 
     if (!netcam->first_image) {
         netcam->status = NETCAM_CONNECTED;
     }
 
-    /* Skip resize/pix format for high pass-through */
-    if (!(netcam->high_resolution && netcam->passthrough) &&
+    /* Skip resize/pix format for high pass-through and when the decoder pool does it */
+    if ((netcam->pool == NULL) &&
+        !(netcam->high_resolution && netcam->passthrough) &&
         (netcam->packet_recv.stream_index == netcam->video_stream_index)) {
 
-        if ((netcam->imgsize.width  != netcam->frame->width) ||
-            (netcam->imgsize.height != netcam->frame->height) ||
-            (netcam_check_pixfmt(netcam) != 0)) {
+        if (netcam_check_resize(netcam) != 0) {
             if (netcam_resize(netcam) < 0){
                 mypacket_unref(netcam->packet_recv);
                 netcam_close_context(netcam);
@@ -1258,14 +1634,17 @@ static int netcam_read_image(struct ctx_netcam *netcam)
     pthread_mutex_lock(&netcam->mutex);
         netcam->idnbr++;
         if (netcam->passthrough) netcam_pktarray_add(netcam);
-        if (!(netcam->high_resolution && netcam->passthrough) &&
-            (netcam->packet_recv.stream_index == netcam->video_stream_index)) {
-            xchg = netcam->img_latest;
-            netcam->img_latest = netcam->img_recv;
-            netcam->img_recv = xchg;
-        }
     pthread_mutex_unlock(&netcam->mutex);
 
+    /* Publish the image.  We get back whichever buffer netcam_next left in img_latest */
+    if ((netcam->pool == NULL) &&
+        !(netcam->high_resolution && netcam->passthrough) &&
+        (netcam->packet_recv.stream_index == netcam->video_stream_index)) {
+        netcam->img_recv->idnbr = netcam->idnbr;
+        netcam->img_recv = __atomic_exchange_n(&netcam->img_latest
+            , netcam->img_recv, __ATOMIC_ACQ_REL);
+    }
+
     mypacket_unref(netcam->packet_recv);
 
     if (netcam->format_context->streams[netcam->video_stream_index]->avg_frame_rate.den > 0){
@@ -1371,7 +1750,10 @@ static void netcam_set_options(struct ctx_netcam *netcam)
     /* Write the options to the context, while skipping the Motion ones */
     for (indx = 0; indx < netcam->params->params_count; indx++) {
         if (mystrne(netcam->params->params_array[indx].param_name,"decoder") &&
-            mystrne(netcam->params->params_array[indx].param_name,"capture_rate")) {
+            mystrne(netcam->params->params_array[indx].param_name,"capture_rate") &&
+            mystrne(netcam->params->params_array[indx].param_name,"decode_reduce") &&
+            mystrne(netcam->params->params_array[indx].param_name,"decode_nth") &&
+            mystrne(netcam->params->params_array[indx].param_name,"mjpeg_scale")) {
             av_dict_set(&netcam->opts
                 , netcam->params->params_array[indx].param_name
                 , netcam->params->params_array[indx].param_value
@@ -1486,17 +1868,28 @@ static void netcam_set_parms (struct ctx_cam *cam, struct ctx_netcam *netcam )
     mycheck_passthrough(cam);
     util_parms_add_default(netcam->params,"decoder","NULL");
     netcam->img_recv =(netcam_buff_ptr) mymalloc(sizeof(netcam_buff));
-    netcam->img_recv->ptr =(char*) mymalloc(NETCAM_BUFFSIZE);
+    netcam->img_recv->ptr = NULL;
+    netcam_check_buffsize(netcam->img_recv, NETCAM_BUFFSIZE);
     netcam->img_latest =(netcam_buff_ptr) mymalloc(sizeof(netcam_buff));
-    netcam->img_latest->ptr =(char*) mymalloc(NETCAM_BUFFSIZE);
+    netcam->img_latest->ptr = NULL;
+    netcam_check_buffsize(netcam->img_latest, NETCAM_BUFFSIZE);
+    netcam->img_read =(netcam_buff_ptr) mymalloc(sizeof(netcam_buff));
+    netcam->img_read->ptr = NULL;
+    netcam_check_buffsize(netcam->img_read, NETCAM_BUFFSIZE);
     netcam->pktarray_size = 0;
-    netcam->pktarray_index = -1;
+    netcam->pktarray_idnbr = 0;
+    netcam->pktarray_key = 0;
     netcam->pktarray = NULL;
     netcam->handler_finished = true;
     netcam->first_image = true;
     netcam->reconnect_count = 0;
     netcam->src_fps =  -1; /* Default to neg so we know it has not been set */
     netcam->capture_rate = -1;
+    netcam->decode_reduce = NETCAM_DECODE_FULL;
+    netcam->decode_nth = 1;
+    netcam->decode_full = true;
+    netcam->mjpeg_scale = 1;
+    netcam->lowres = 0;
 
     for (indx = 0; indx < netcam->params->params_count; indx++) {
         if (mystreq(netcam->params->params_array[indx].param_name,"decoder")) {
@@ -1510,6 +1903,33 @@ static void netcam_set_parms (struct ctx_cam *cam, struct ctx_netcam *netcam )
             netcam->capture_rate = atoi(netcam->params->params_array[indx].param_value);
         }
 
+        if (mystreq(netcam->params->params_array[indx].param_name,"decode_reduce")) {
+            if (mystreq(netcam->params->params_array[indx].param_value,"loopfilter")) {
+                netcam->decode_reduce = NETCAM_DECODE_LOOPFILTER;
+            } else if (mystreq(netcam->params->params_array[indx].param_value,"nonref")) {
+                netcam->decode_reduce = NETCAM_DECODE_NONREF;
+            } else if (mystreq(netcam->params->params_array[indx].param_value,"keyframe")) {
+                netcam->decode_reduce = NETCAM_DECODE_KEYFRAME;
+            } else {
+                netcam->decode_reduce = NETCAM_DECODE_FULL;
+            }
+        }
+
+        if (mystreq(netcam->params->params_array[indx].param_name,"decode_nth")) {
+            netcam->decode_nth = atoi(netcam->params->params_array[indx].param_value);
+        }
+
+        if (mystreq(netcam->params->params_array[indx].param_name,"mjpeg_scale")) {
+            netcam->mjpeg_scale = atoi(netcam->params->params_array[indx].param_value);
+            if ((netcam->mjpeg_scale != 1) && (netcam->mjpeg_scale != 2) &&
+                (netcam->mjpeg_scale != 4) && (netcam->mjpeg_scale != 8)) {
+                MOTION_LOG(WRN, TYPE_NETCAM, NO_ERRNO
+                    ,_("%s: mjpeg_scale must be 1, 2, 4 or 8.  Using 1")
+                    ,netcam->cameratype);
+                netcam->mjpeg_scale = 1;
+            }
+        }
+
     }
 
     /* If this is the norm and we have a highres, then disable passthru on the norm */
@@ -1705,6 +2125,13 @@ static int netcam_open_context(struct ctx_netcam *netcam)
     if (netcam->high_resolution){
         netcam->imgsize.width = netcam->codec_context->width;
         netcam->imgsize.height = netcam->codec_context->height;
+        #if ( MYFFVER >= 57041)
+            /* The decoder gives the image at 1/mjpeg_scale of the stream */
+            if (netcam->lowres > 0) {
+                netcam->imgsize.width = AV_CEIL_RSHIFT(netcam->strm->codecpar->width, netcam->lowres);
+                netcam->imgsize.height = AV_CEIL_RSHIFT(netcam->strm->codecpar->height, netcam->lowres);
+            }
+        #endif
     }
 
     netcam->frame = myframe_alloc();
@@ -1753,6 +2180,9 @@ static int netcam_connect(struct ctx_netcam *netcam)
 
     if (netcam_read_image(netcam) < 0) return -1;
 
+    /* The first images above were decoded here to validate the camera */
+    if (!netcam->first_image) netcam_pool_attach(netcam);
+
     /* We use the status for determining whether to grab a image from
      * the Motion loop(see "next" function).  When we are initially starting,
      * we open and close the context and during this process we do not want the
@@ -1814,6 +2244,12 @@ static void netcam_shutdown(struct ctx_netcam *netcam)
         }
         netcam->img_recv   = NULL;
 
+        if (netcam->img_read != NULL){
+            free(netcam->img_read->ptr);
+            free(netcam->img_read);
+        }
+        netcam->img_read   = NULL;
+
         if (netcam->decoder_nm != NULL){
             free(netcam->decoder_nm);
         }
@@ -1966,9 +2402,7 @@ static int netcam_start_handler(struct ctx_netcam *netcam)
      */
     wait_counter = 60;
     while (wait_counter > 0) {
-        pthread_mutex_lock(&netcam->mutex);
-            if (netcam->img_latest->ptr != NULL ) wait_counter = -1;
-        pthread_mutex_unlock(&netcam->mutex);
+        if (__atomic_load_n(&netcam->img_latest, __ATOMIC_ACQUIRE)->ptr != NULL ) wait_counter = -1;
 
         if (wait_counter > 0 ){
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
@@ -2055,8 +2489,42 @@ int netcam_setup(struct ctx_cam *cam)
 
 }
 
+/*
+ * Take the latest image from the handler.  img_read is exchanged with
+ * img_latest and, when it holds a new image, its buffer is swapped with
+ * the image of the ring.  A buffer that has been taken is marked with
+ * used = 0 so getting it back from img_latest means there is no new image.
+ * The idnbr of the packet the image came from is kept in idnbr_image since
+ * the decoder pool can publish an image after later packets were read.
+ * Returns 1 when there is no new image.
+ */
+static int netcam_img_take(struct ctx_netcam *netcam, unsigned char **image, int size)
+{
+    unsigned char *xchg;
+
+    netcam->img_read = __atomic_exchange_n(&netcam->img_latest
+        , netcam->img_read, __ATOMIC_ACQ_REL);
+    if (netcam->img_read->used == 0) return 1;
+
+    netcam->idnbr_image = netcam->img_read->idnbr;
+
+    if (netcam->img_read->used == (size_t)size) {
+        xchg = *image;
+        *image = (unsigned char *)netcam->img_read->ptr;
+        netcam->img_read->ptr = (char *)xchg;
+        netcam->img_read->size = size;
+    } else {
+        if (netcam->img_read->used < (size_t)size) size = netcam->img_read->used;
+        memcpy(*image, netcam->img_read->ptr, size);
+    }
+    netcam->img_read->used = 0;
+
+    return 0;
+}
+
 int netcam_next(struct ctx_cam *cam, struct ctx_image_data *img_data)
 {
+    int indx_prev, stale_norm, stale_high, decode_full;
 
     /* This is called from the motion loop thread */
 
@@ -2064,32 +2532,52 @@ int netcam_next(struct ctx_cam *cam, struct ctx_image_data *img_data)
         (cam->netcam->status == NETCAM_NOTCONNECTED)){
             return 1;
         }
+
+    decode_full = mlp_need_full(cam);
+    __atomic_store_n(&cam->netcam->decode_full, decode_full, __ATOMIC_RELAXED);
+    if (cam->netcam_high) {
+        __atomic_store_n(&cam->netcam_high->decode_full, decode_full, __ATOMIC_RELAXED);
+    }
     pthread_mutex_lock(&cam->netcam->mutex);
         netcam_pktarray_resize(cam, false);
-        memcpy(img_data->image_norm
-               , cam->netcam->img_latest->ptr
-               , cam->netcam->img_latest->used);
-        img_data->idnbr_norm = cam->netcam->idnbr;
     pthread_mutex_unlock(&cam->netcam->mutex);
+    stale_norm = netcam_img_take(cam->netcam, &img_data->image_norm, cam->imgs.size_norm);
+    img_data->idnbr_norm = cam->netcam->idnbr_image;
 
+    stale_high = false;
     if (cam->netcam_high){
         if ((cam->netcam_high->status == NETCAM_RECONNECTING) ||
             (cam->netcam_high->status == NETCAM_NOTCONNECTED)) return 1;
 
         pthread_mutex_lock(&cam->netcam_high->mutex);
             netcam_pktarray_resize(cam, true);
-            if (!(cam->netcam_high->high_resolution && cam->netcam_high->passthrough)) {
-                memcpy(img_data->image_high
-                       ,cam->netcam_high->img_latest->ptr
-                       ,cam->netcam_high->img_latest->used);
-            }
             img_data->idnbr_high = cam->netcam_high->idnbr;
         pthread_mutex_unlock(&cam->netcam_high->mutex);
+        if (!(cam->netcam_high->high_resolution && cam->netcam_high->passthrough)) {
+            stale_high = netcam_img_take(cam->netcam_high, &img_data->image_high, cam->imgs.size_high);
+            img_data->idnbr_high = cam->netcam_high->idnbr_image;
+        }
     }
 
     /* Rotate images if requested */
     rotate_map(cam, img_data);
 
+    /*
+     * When the handler has not finished a new image, repeat the last one.
+     * Those are already rotated.  The normal image is drawn on after
+     * capture so it is taken from image_virgin.  The high resolution image
+     * is taken from the previous slot in the ring.
+     */
+    if (stale_norm) {
+        memcpy(img_data->image_norm, cam->imgs.image_virgin, cam->imgs.size_norm);
+    }
+    if (stale_high && (cam->imgs.ring_size > 1)) {
+        indx_prev = cam->imgs.ring_in - 1;
+        if (indx_prev < 0) indx_prev = cam->imgs.ring_size - 1;
+        memcpy(img_data->image_high
+            , cam->imgs.image_ring[indx_prev].image_high, cam->imgs.size_high);
+    }
+
     return 0;
 }
 
@@ -2171,3 +2659,84 @@ void netcam_cleanup(struct ctx_cam *cam, int init_retry_flag)
     }
 }
 
+
+/* Start the decoder threads shared by the network cameras */
+static void netcam_pool_start(struct ctx_motapp *motapp)
+{
+    struct ctx_netcam_pool *pool;
+    int indx;
+
+    pool = (struct ctx_netcam_pool *)mymalloc(sizeof(struct ctx_netcam_pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_work, NULL);
+    pthread_cond_init(&pool->cond_idle, NULL);
+    pool->thread_id = (pthread_t *)mymalloc(motapp->netcam_decode_threads * sizeof(pthread_t));
+
+    pthread_mutex_lock(&pool->mutex);
+    for (indx = 0; indx < motapp->netcam_decode_threads; indx++) {
+        if (pthread_create(&pool->thread_id[indx], NULL
+                , netcam_pool_handler, pool) != 0) {
+            MOTION_LOG(ERR, TYPE_NETCAM, SHOW_ERRNO
+                , _("Unable to start netcam decoder thread %d"), indx + 1);
+            break;
+        }
+        pool->thread_cnt++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    motapp->netcam_pool = pool;
+
+    if (pool->thread_cnt == 0) {
+        netcam_global_deinit(motapp);
+        return;
+    }
+
+    MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+        ,_("Started %d netcam decoder threads"), pool->thread_cnt);
+
+}
+
+void netcam_global_init(struct ctx_motapp *motapp)
+{
+
+    motapp->netcam_pool = NULL;
+
+    if (motapp->netcam_decode_threads <= 0) return;
+
+    /* The packets are handed to the pool by reference */
+    #if (MYFFVER < 55000)
+        (void)netcam_pool_start;
+        MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+            ,_("netcam_decode_threads is not available with this version of ffmpeg"));
+    #else
+        netcam_pool_start(motapp);
+    #endif
+
+}
+
+void netcam_global_deinit(struct ctx_motapp *motapp)
+{
+    struct ctx_netcam_pool *pool = motapp->netcam_pool;
+    int indx;
+
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->mutex);
+        pool->finish = true;
+        pthread_cond_broadcast(&pool->cond_work);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (indx = 0; indx < pool->thread_cnt; indx++) {
+        pthread_join(pool->thread_id[indx], NULL);
+    }
+
+    pthread_cond_destroy(&pool->cond_idle);
+    pthread_cond_destroy(&pool->cond_work);
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool->netcam_list);
+    free(pool->thread_id);
+    free(pool);
+    motapp->netcam_pool = NULL;
+
+}
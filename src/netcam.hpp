@@ -28,6 +28,7 @@ struct image_data;
 #define NETCAM_GENERAL_ERROR       0x02          /* binary 000010 */
 #define NETCAM_RESTART_ERROR       0x12          /* binary 010010 */
 #define NETCAM_BUFFSIZE 4096
+#define NETCAM_POOL_QUEUE 8     /* Packets each camera may have waiting for the decoder pool */
 
 enum NETCAM_STATUS {
     NETCAM_CONNECTED,      /* The camera is currently connected */
@@ -36,6 +37,13 @@ enum NETCAM_STATUS {
     NETCAM_RECONNECTING   /* Motion is trying to reconnect to camera */
 };
 
+enum NETCAM_DECODE {
+    NETCAM_DECODE_FULL,        /* Every frame is fully decoded */
+    NETCAM_DECODE_LOOPFILTER,  /* The loop filter is skipped */
+    NETCAM_DECODE_NONREF,      /* Frames that are not references are skipped */
+    NETCAM_DECODE_KEYFRAME     /* Only keyframes are decoded */
+};
+
 struct imgsize_context {
     int                   width;
     int                   height;
@@ -55,14 +63,17 @@ struct url_t {
 
 /*
  * We use a special "triple-buffer" technique.  There are
- * three separate buffers (latest, receiving and jpegbuf)
- * which are each described using a struct netcam_image_buff
+ * three separate buffers (receiving, latest and read)
+ * which are each described using a struct netcam_image_buff.
+ * The handler owns receiving, the motion loop owns read and
+ * each side exchanges its buffer with latest atomically.
  */
 typedef struct netcam_image_buff {
     char *ptr;
     int content_length;
     size_t size;                    /* total allocated size */
     size_t used;                    /* bytes already used */
+    int64_t idnbr;                  /* idnbr of the packet the image was decoded from */
     struct timespec image_time;      /* time this image was received */
 } netcam_buff;
 typedef netcam_buff *netcam_buff_ptr;
@@ -82,26 +93,32 @@ extern "C" {
 struct packet_item{
     AVPacket                  packet;
     int64_t                   idnbr;
-    int                       iskey;
-    int                       iswritten;
+    int64_t                   idnbr_key;    /* The idnbr of the last video keyframe up to this packet */
     struct timespec           timestamp_ts;
 };
 
+struct netcam_pool_pkt {
+    AVPacket                  packet;
+    int64_t                   idnbr;        /* The idnbr the handler gives the packet */
+    struct timespec           queued_ts;    /* The time the packet was queued for decoding */
+};
+
 struct ctx_netcam {
 
     AVFormatContext          *format_context;        /* Main format context for the camera */
     AVCodecContext           *codec_context;         /* Codec being sent from the camera */
     AVStream                 *strm;
     AVFrame                  *frame;                 /* Reusable frame for images from camera */
-    AVFrame                  *swsframe_in;           /* Used when resizing image sent from camera */
     AVFrame                  *swsframe_out;          /* Used when resizing image sent from camera */
     struct SwsContext        *swsctx;                /* Context for the resizing of the image */
     AVPacket                  packet_recv;           /* The packet that is currently being processed */
     AVFormatContext          *transfer_format;       /* Format context just for transferring to pass-through */
     struct packet_item       *pktarray;              /* Pointer to array of packets for passthru processing */
-    int                       pktarray_size;         /* The number of packets in array.  1 based */
-    int                       pktarray_index;        /* The index to the most current packet in array */
+    int                       pktarray_size;         /* The number of packets in array.  Power of two */
+    int64_t                   pktarray_idnbr;        /* The idnbr of the most current packet in array */
+    int64_t                   pktarray_key;          /* The idnbr of the most current video keyframe */
     int64_t                   idnbr;                 /* A ID number to track the packet vs image */
+    int64_t                   idnbr_image;           /* The idnbr of the image last taken by the motion loop */
     AVDictionary             *opts;                  /* AVOptions when opening the format context */
     int                       swsframe_size;         /* The size of the image after resizing */
     int                       video_stream_index;    /* Stream index associated with video from camera */
@@ -119,6 +136,7 @@ struct ctx_netcam {
 
     netcam_buff_ptr           img_recv;         /* The image buffer that is currently being processed */
     netcam_buff_ptr           img_latest;       /* The most recent image buffer that finished processing */
+    netcam_buff_ptr           img_read;         /* The image buffer last taken by the motion loop */
 
     int                       interrupted;      /* Boolean for whether interrupt has been tripped */
     int                       finish;           /* Boolean for whether we are finishing the application */
@@ -140,6 +158,27 @@ struct ctx_netcam {
     int                       src_fps;          /* The fps provided from source*/
     char                      *decoder_nm;      /* User requested decoder */
 
+    enum NETCAM_DECODE        decode_reduce;    /* Reduced decoding used while there is no event */
+    int                       decode_nth;       /* Decode every nth packet of intra only codecs */
+    int                       decode_full;      /* Set by the motion loop when full decoding is needed */
+    int                       decode_reduced;   /* Boolean for whether the decoder is currently reduced */
+    int                       decode_cnt;       /* Count of packets for decode_nth */
+    int                       mjpeg_scale;      /* Decode mjpeg at 1/mjpeg_scale with the decoder lowres */
+    int                       lowres;           /* The lowres given to the decoder */
+
+    struct ctx_netcam_pool    *pool;            /* Shared decoder pool.  NULL when the handler decodes */
+    struct netcam_pool_pkt    pool_queue[NETCAM_POOL_QUEUE];  /* Packets waiting for the decoder pool */
+    int                       pool_head;        /* Index of the next packet to decode */
+    int                       pool_cnt;         /* Count of packets in the queue */
+    int                       pool_busy;        /* Boolean for whether a worker is decoding for this camera */
+    int                       pool_error;       /* Boolean for whether a worker failed to decode */
+    int                       pool_wait_key;    /* Boolean for dropping packets until the next keyframe */
+    int64_t                   pool_lat_sum;     /* Sum of usec from queued to published since last report */
+    int64_t                   pool_lat_max;     /* Maximum usec from queued to published since last report */
+    int                       pool_lat_cnt;     /* Count of images published since last report */
+    int                       pool_drop_cnt;    /* Count of packets dropped since last report */
+    struct timespec           pool_report_ts;   /* The time of the last latency report */
+
     struct timespec           frame_prev_tm;    /* The time set before calling the av functions */
     struct timespec           frame_curr_tm;    /* Time during the interrupt to determine duration since start*/
     struct ctx_motapp         *motapp;          /* Pointer to parent application context  */
@@ -153,9 +192,28 @@ struct ctx_netcam {
     pthread_mutex_t           mutex_transfer;   /* mutex used with transferring stream info for pass-through */
     pthread_mutex_t           mutex_pktarray;   /* mutex used with the packet array */
 
+};
 
+/*
+ * The decoder pool is shared by all the network cameras.  The handler
+ * of each camera still reads the packets and queues the video packets
+ * while the workers take one packet at a time from the cameras in turn.
+ */
+struct ctx_netcam_pool {
+    pthread_t                 *thread_id;
+    int                       thread_cnt;       /* Worker threads started */
+    pthread_mutex_t           mutex;
+    pthread_cond_t            cond_work;        /* Signalled when a packet is queued */
+    pthread_cond_t            cond_idle;        /* Signalled when a worker is done with a camera */
+    struct ctx_netcam         **netcam_list;    /* Cameras attached to the pool */
+    int                       netcam_cnt;
+    int                       netcam_max;       /* Allocated size of netcam_list */
+    int                       netcam_next;      /* Index in netcam_list of the next camera to serve */
+    int                       finish;           /* Tell the workers to exit */
 };
 
+void netcam_global_init(struct ctx_motapp *motapp);
+void netcam_global_deinit(struct ctx_motapp *motapp);
 int netcam_setup(struct ctx_cam *cam);
 int netcam_next(struct ctx_cam *cam, struct ctx_image_data *img_data);
 void netcam_cleanup(struct ctx_cam *cam, int init_retry_flag);
@@ -320,7 +320,8 @@ int rotate_map(struct ctx_cam *cam, struct ctx_image_data *img_data)
 
     indx = 0;
     indx_max = 0;
-    if ((cam->rotate_data->capture_width_high != 0) && (cam->rotate_data->capture_height_high != 0)) indx_max = 1;
+    if ((cam->rotate_data->capture_width_high != 0) && (cam->rotate_data->capture_height_high != 0) &&
+        ((img_data->flags & IMAGE_NOHIGH) == 0)) indx_max = 1;
 
     while (indx <= indx_max) {
         deg = cam->rotate_data->degrees;
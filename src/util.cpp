@@ -548,6 +548,24 @@ int mycheck_passthrough(struct ctx_cam *cam)
 
 }
 
+/** Determine the best vector instruction set supported by the running cpu */
+enum SIMD_TYPE mysimd_type(void)
+{
+    #if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SIMD_TYPE_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            return SIMD_TYPE_SSE2;
+        }
+        return SIMD_TYPE_NONE;
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        return SIMD_TYPE_NEON;
+    #else
+        return SIMD_TYPE_NONE;
+    #endif
+}
+
 static void mytranslate_locale_chg(const char *langcd)
 {
     #ifdef HAVE_GETTEXT
@@ -104,6 +104,7 @@
     void mythreadname_set(const char *abbr, int threadnbr, const char *threadname);
     void mythreadname_get(char *threadname);
     int mycheck_passthrough(struct ctx_cam *cam);
+    enum SIMD_TYPE mysimd_type(void);
 
     char* mytranslate_text(const char *msgid, int setnls);
     void mytranslate_init(void);
@@ -21,6 +21,27 @@
 #include "logger.hpp"
 #include "util.hpp"
 #include "jpegutils.hpp"
+#include "video_common.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define VIDSIMD_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define VIDSIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+typedef void (*vid_packed422_fn)(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count, int yofs);
+typedef void (*vid_avgrows_fn)(unsigned char *dst, unsigned char *src, unsigned char *src2, int count);
+typedef void (*vid_rgb24_fn)(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count);
+typedef void (*vid_grey16_fn)(unsigned char *dst, unsigned char *src, int count, int shift);
+typedef void (*vid_bayer_fn)(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *img_src, int width, int height, int y);
 
 typedef struct {
     int is_abs;
@@ -259,168 +280,989 @@ void vid_bayer2rgb24(unsigned char *img_dst, unsigned char *img_src, long int wi
 
 }
 
-void vid_yuv422to420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+/*
+ * Row kernels of the pixel format conversions.  Each kernel converts a
+ * pair of rows so that the chroma of the two rows can be averaged in the
+ * same pass.  The _c kernels are the reference and the vectorized kernels
+ * must give the same bytes as they do.  The vectorized kernels convert
+ * the pixels left over at the end of the rows with the _c kernel.
+ */
+
+/*
+ * Packed 4:2:2 where yofs is the offset of the first luma of each four
+ * bytes.  This is 0 for YUYV and 1 for UYVY.  The chroma of the two rows
+ * are averaged, rounding down.
+ */
+static void vid_packed422_c(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count, int yofs)
 {
-    unsigned char *src, *dest, *src2, *dest2;
-    int i, j;
+    int indx;
 
-    /* Create the Y plane. */
-    src = img_src;
-    dest = img_dst;
-    for (i = width * height; i > 0; i--) {
-        *dest++ = *src;
-        src += 2;
-    }
-    /* Create U and V planes. */
-    src = img_src + 1;
-    src2 = img_src + width * 2 + 1;
-    dest = img_dst + width * height;
-    dest2 = dest + (width * height) / 4;
-    for (i = height / 2; i > 0; i--) {
-        for (j = width / 2; j > 0; j--) {
-            *dest = ((int) *src + (int) *src2) / 2;
-            src += 2;
-            src2 += 2;
-            dest++;
-            *dest2 = ((int) *src + (int) *src2) / 2;
-            src += 2;
-            src2 += 2;
-            dest2++;
+    for (indx = 0; indx < count; indx += 2) {
+        dst_y[indx] = src[(indx * 2) + yofs];
+        dst_y[indx + 1] = src[(indx * 2) + 2 + yofs];
+        dst_y2[indx] = src2[(indx * 2) + yofs];
+        dst_y2[indx + 1] = src2[(indx * 2) + 2 + yofs];
+        dst_u[indx / 2] = ((int)src[(indx * 2) + 1 - yofs] + (int)src2[(indx * 2) + 1 - yofs]) / 2;
+        dst_v[indx / 2] = ((int)src[(indx * 2) + 3 - yofs] + (int)src2[(indx * 2) + 3 - yofs]) / 2;
+    }
+}
+
+/* Average of the two rows, rounding down */
+static void vid_avgrows_c(unsigned char *dst, unsigned char *src, unsigned char *src2, int count)
+{
+    int indx;
+
+    for (indx = 0; indx < count; indx++) {
+        dst[indx] = ((int)src[indx] + (int)src2[indx]) / 2;
+    }
+}
+
+/* Luma of one pixel and its part of the chroma of the 2x2 block it is in */
+static inline void vid_rgb24_pixel(unsigned char *rgb, unsigned char *y, int *u, int *v)
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+
+    *y = (9796 * r + 19235 * g + 3736 * b) >> 15;
+    *u += ((-4784 * r - 9437 * g + 14221 * b) >> 17) + 32;
+    *v += ((20218 * r - 16941 * g - 3277 * b) >> 17) + 32;
+}
+
+/*
+ * The chroma is the sum of the parts from the four pixels of the block
+ * kept to the byte, as the earlier version that added each part into
+ * the output plane did.
+ */
+static void vid_rgb24_c(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count)
+{
+    int indx, u, v;
+
+    for (indx = 0; indx < count; indx += 2) {
+        u = 0;
+        v = 0;
+        vid_rgb24_pixel(src + (indx * 3), dst_y + indx, &u, &v);
+        vid_rgb24_pixel(src + (indx * 3) + 3, dst_y + indx + 1, &u, &v);
+        vid_rgb24_pixel(src2 + (indx * 3), dst_y2 + indx, &u, &v);
+        vid_rgb24_pixel(src2 + (indx * 3) + 3, dst_y2 + indx + 1, &u, &v);
+        dst_u[indx / 2] = (unsigned char)u;
+        dst_v[indx / 2] = (unsigned char)v;
+    }
+}
+
+/*
+ * One pixel of the bayer image with the same interpolation and in the
+ * same byte order as vid_bayer2rgb24 gives it.
+ */
+static void vid_bayer_pixel(unsigned char *img_src, int width, int height
+    , int x, int y, unsigned char *rgb)
+{
+    int i = (y * width) + x;
+    unsigned char *rawpt = img_src + i;
+
+    if ((y & 1) == 0) {
+        if ((x & 1) == 0) {
+            if ((i > width) && (x > 0)) {
+                rgb[0] = *rawpt;
+                rgb[1] = (*(rawpt - 1) + *(rawpt + 1) + *(rawpt + width) + *(rawpt - width)) / 4;
+                rgb[2] = (*(rawpt - width - 1) + *(rawpt - width + 1) +
+                    *(rawpt + width - 1) + *(rawpt + width + 1)) / 4;
+            } else {
+                rgb[0] = *rawpt;
+                rgb[1] = (*(rawpt + 1) + *(rawpt + width)) / 2;
+                rgb[2] = *(rawpt + width + 1);
+            }
+        } else {
+            if ((i > width) && (x < (width - 1))) {
+                rgb[0] = (*(rawpt - 1) + *(rawpt + 1)) / 2;
+                rgb[1] = *rawpt;
+                rgb[2] = (*(rawpt + width) + *(rawpt - width)) / 2;
+            } else {
+                rgb[0] = *(rawpt - 1);
+                rgb[1] = *rawpt;
+                rgb[2] = *(rawpt + width);
+            }
+        }
+    } else {
+        if ((x & 1) == 0) {
+            if ((i < (width * (height - 1))) && (x > 0)) {
+                rgb[0] = (*(rawpt + width) + *(rawpt - width)) / 2;
+                rgb[1] = *rawpt;
+                rgb[2] = (*(rawpt - 1) + *(rawpt + 1)) / 2;
+            } else {
+                rgb[0] = *(rawpt - width);
+                rgb[1] = *rawpt;
+                rgb[2] = *(rawpt + 1);
+            }
+        } else {
+            if ((i < (width * (height - 1))) && (x < (width - 1))) {
+                rgb[0] = (*(rawpt - width - 1) + *(rawpt - width + 1) +
+                    *(rawpt + width - 1) + *(rawpt + width + 1)) / 4;
+                rgb[1] = (*(rawpt - 1) + *(rawpt + 1) + *(rawpt - width) + *(rawpt + width)) / 4;
+                rgb[2] = *rawpt;
+            } else {
+                rgb[0] = *(rawpt - width - 1);
+                rgb[1] = (*(rawpt - 1) + *(rawpt - width)) / 2;
+                rgb[2] = *rawpt;
+            }
         }
-        src += width * 2;
-        src2 += width * 2;
     }
 }
 
-void vid_yuv422pto420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+/* Demosaic and convert the 2x2 blocks from xstart to xend of rows y and y + 1 */
+static void vid_bayer_c(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *img_src, int width, int height, int y, int xstart, int xend)
 {
-    unsigned char *src, *dest, *dest2;
-    unsigned char *src_u, *src_u2, *src_v, *src_v2;
+    unsigned char rgb[3];
+    int x, u, v;
 
-    int i, j;
-    /*Planar version of 422 */
-    /* Create the Y plane. */
-    src = img_src;
-    dest = img_dst;
-    for (i = width * height; i > 0; i--) {
-        *dest++ = *src++;
-    }
-
-    /* Create U and V planes. */
-    dest = img_dst + width * height;
-    dest2 = dest + (width * height) / 4;
-    for (i = 0; i< (height / 2); i++) {
-        src_u = img_src + (width * height) + ((i*2) * (width/2));
-        src_u2 = src_u  + (width/2);
-        src_v = src_u + (width/2 * height);
-        src_v2 = src_v  + (width/2);
-
-        for (j = 0; j < (width / 2); j++) {
-            *dest = ((int) *src_u + (int) *src_u2) / 2;
-            src_u ++;
-            src_u2++;
-            dest++;
-
-            *dest2 = ((int) *src_v + (int) *src_v2) / 2;
-            src_v ++;
-            src_v2++;
-            dest2++;
+    for (x = xstart; x < xend; x += 2) {
+        u = 0;
+        v = 0;
+        vid_bayer_pixel(img_src, width, height, x, y, rgb);
+        vid_rgb24_pixel(rgb, dst_y + x, &u, &v);
+        vid_bayer_pixel(img_src, width, height, x + 1, y, rgb);
+        vid_rgb24_pixel(rgb, dst_y + x + 1, &u, &v);
+        vid_bayer_pixel(img_src, width, height, x, y + 1, rgb);
+        vid_rgb24_pixel(rgb, dst_y2 + x, &u, &v);
+        vid_bayer_pixel(img_src, width, height, x + 1, y + 1, rgb);
+        vid_rgb24_pixel(rgb, dst_y2 + x + 1, &u, &v);
+        dst_u[x / 2] = (unsigned char)u;
+        dst_v[x / 2] = (unsigned char)v;
+    }
+}
+
+static void vid_bayer_rows_c(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *img_src, int width, int height, int y)
+{
+    vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, 0, width);
+}
+
+/*
+ * Grey with 16 bit little endian pixels such as Y10 and Y12 shifted down
+ * to 8 bits.  Pixels still above 255 after the shift keep the upper bits
+ * by saturating to 255 instead of wrapping around.
+ */
+static void vid_grey16_c(unsigned char *dst, unsigned char *src, int count, int shift)
+{
+    int indx, val;
+
+    for (indx = 0; indx < count; indx++) {
+        val = (src[indx * 2] | (src[(indx * 2) + 1] << 8)) >> shift;
+        dst[indx] = (val > 255) ? 255 : val;
+    }
+}
+
+static vid_packed422_fn vid_packed422_kernel = vid_packed422_c;
+static vid_avgrows_fn vid_avgrows_kernel = vid_avgrows_c;
+static vid_rgb24_fn vid_rgb24_kernel = vid_rgb24_c;
+static vid_bayer_fn vid_bayer_kernel = vid_bayer_rows_c;
+static vid_grey16_fn vid_grey16_kernel = vid_grey16_c;
+
+#ifdef VIDSIMD_X86
+
+__attribute__((target("sse2")))
+static void vid_packed422_sse2(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count, int yofs)
+{
+    __m128i a, b, c, d, ca, cb, uv, lomask, zero;
+    int indx;
+
+    lomask = _mm_set1_epi16(0x00FF);
+    zero = _mm_setzero_si128();
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        a = _mm_loadu_si128((__m128i *)(src + (indx * 2)));
+        b = _mm_loadu_si128((__m128i *)(src + (indx * 2) + 16));
+        c = _mm_loadu_si128((__m128i *)(src2 + (indx * 2)));
+        d = _mm_loadu_si128((__m128i *)(src2 + (indx * 2) + 16));
+        if (yofs == 0) {
+            _mm_storeu_si128((__m128i *)(dst_y + indx)
+                , _mm_packus_epi16(_mm_and_si128(a, lomask), _mm_and_si128(b, lomask)));
+            _mm_storeu_si128((__m128i *)(dst_y2 + indx)
+                , _mm_packus_epi16(_mm_and_si128(c, lomask), _mm_and_si128(d, lomask)));
+            ca = _mm_add_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(c, 8));
+            cb = _mm_add_epi16(_mm_srli_epi16(b, 8), _mm_srli_epi16(d, 8));
+        } else {
+            _mm_storeu_si128((__m128i *)(dst_y + indx)
+                , _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+            _mm_storeu_si128((__m128i *)(dst_y2 + indx)
+                , _mm_packus_epi16(_mm_srli_epi16(c, 8), _mm_srli_epi16(d, 8)));
+            ca = _mm_add_epi16(_mm_and_si128(a, lomask), _mm_and_si128(c, lomask));
+            cb = _mm_add_epi16(_mm_and_si128(b, lomask), _mm_and_si128(d, lomask));
         }
+        /* U and V alternate in uv */
+        uv = _mm_packus_epi16(_mm_srli_epi16(ca, 1), _mm_srli_epi16(cb, 1));
+        _mm_storel_epi64((__m128i *)(dst_u + (indx / 2))
+            , _mm_packus_epi16(_mm_and_si128(uv, lomask), zero));
+        _mm_storel_epi64((__m128i *)(dst_v + (indx / 2))
+            , _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
     }
+
+    vid_packed422_c(dst_y + indx, dst_y2 + indx, dst_u + (indx / 2), dst_v + (indx / 2)
+        , src + (indx * 2), src2 + (indx * 2), count - indx, yofs);
 }
 
-void vid_uyvyto420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+/* _mm_avg_epu8 rounds up so the odd sums are taken back down */
+__attribute__((target("sse2")))
+static void vid_avgrows_sse2(unsigned char *dst, unsigned char *src, unsigned char *src2, int count)
 {
-    unsigned char *pY = img_dst;
-    unsigned char *pU = pY + (width * height);
-    unsigned char *pV = pU + (width * height) / 4;
-    unsigned int uv_offset = width * 2 * sizeof(unsigned char);
-    int ix, jx;
-
-    for (ix = 0; ix < height; ix++) {
-        for (jx = 0; jx < width; jx += 2) {
-            unsigned short int calc;
-
-            if ((ix&1) == 0) {
-                calc = *img_src;
-                calc += *(img_src + uv_offset);
-                calc /= 2;
-                *pU++ = (unsigned char) calc;
-            }
+    __m128i a, b, one;
+    int indx;
+
+    one = _mm_set1_epi8(1);
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        a = _mm_loadu_si128((__m128i *)(src + indx));
+        b = _mm_loadu_si128((__m128i *)(src2 + indx));
+        _mm_storeu_si128((__m128i *)(dst + indx), _mm_sub_epi8(_mm_avg_epu8(a, b)
+            , _mm_and_si128(_mm_xor_si128(a, b), one)));
+    }
+
+    vid_avgrows_c(dst + indx, src + indx, src2 + indx, count - indx);
+}
+
+__attribute__((target("avx2")))
+static void vid_packed422_avx2(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count, int yofs)
+{
+    __m256i a, b, c, d, ca, cb, uv, lomask, zero;
+    int indx;
+
+    lomask = _mm256_set1_epi16(0x00FF);
+    zero = _mm256_setzero_si256();
+
+    /* The packs work within each 128 bit lane so the quarters are put back in order after */
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        a = _mm256_loadu_si256((__m256i *)(src + (indx * 2)));
+        b = _mm256_loadu_si256((__m256i *)(src + (indx * 2) + 32));
+        c = _mm256_loadu_si256((__m256i *)(src2 + (indx * 2)));
+        d = _mm256_loadu_si256((__m256i *)(src2 + (indx * 2) + 32));
+        if (yofs == 0) {
+            _mm256_storeu_si256((__m256i *)(dst_y + indx), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_and_si256(a, lomask), _mm256_and_si256(b, lomask)), 0xD8));
+            _mm256_storeu_si256((__m256i *)(dst_y2 + indx), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_and_si256(c, lomask), _mm256_and_si256(d, lomask)), 0xD8));
+            ca = _mm256_add_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(c, 8));
+            cb = _mm256_add_epi16(_mm256_srli_epi16(b, 8), _mm256_srli_epi16(d, 8));
+        } else {
+            _mm256_storeu_si256((__m256i *)(dst_y + indx), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8));
+            _mm256_storeu_si256((__m256i *)(dst_y2 + indx), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_srli_epi16(c, 8), _mm256_srli_epi16(d, 8)), 0xD8));
+            ca = _mm256_add_epi16(_mm256_and_si256(a, lomask), _mm256_and_si256(c, lomask));
+            cb = _mm256_add_epi16(_mm256_and_si256(b, lomask), _mm256_and_si256(d, lomask));
+        }
+        uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(
+            _mm256_srli_epi16(ca, 1), _mm256_srli_epi16(cb, 1)), 0xD8);
+        _mm_storeu_si128((__m128i *)(dst_u + (indx / 2)), _mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(uv, lomask), zero), 0xD8)));
+        _mm_storeu_si128((__m128i *)(dst_v + (indx / 2)), _mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(uv, 8), zero), 0xD8)));
+    }
 
-            img_src++;
-            *pY++ = *img_src++;
+    vid_packed422_c(dst_y + indx, dst_y2 + indx, dst_u + (indx / 2), dst_v + (indx / 2)
+        , src + (indx * 2), src2 + (indx * 2), count - indx, yofs);
+}
+
+__attribute__((target("avx2")))
+static void vid_avgrows_avx2(unsigned char *dst, unsigned char *src, unsigned char *src2, int count)
+{
+    __m256i a, b, one;
+    int indx;
+
+    one = _mm256_set1_epi8(1);
+
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        a = _mm256_loadu_si256((__m256i *)(src + indx));
+        b = _mm256_loadu_si256((__m256i *)(src2 + indx));
+        _mm256_storeu_si256((__m256i *)(dst + indx), _mm256_sub_epi8(_mm256_avg_epu8(a, b)
+            , _mm256_and_si256(_mm256_xor_si256(a, b), one)));
+    }
+
+    vid_avgrows_c(dst + indx, src + indx, src2 + indx, count - indx);
+}
+
+/*
+ * Convert 16 pixels of a row of rgb24.  The bytes are split into the
+ * three colours with byte shuffles and each colour is weighed in 32 bits
+ * with multiply-add of the pixel pairs.  The chroma parts of each pair of
+ * pixels are returned added up in u and v.  This uses the SSSE3 and
+ * SSE4.1 parts of the AVX2 instruction set.
+ */
+__attribute__((target("avx2")))
+static inline void vid_rgb24_row_avx2(unsigned char *dst_y, unsigned char *src
+    , __m128i *u, __m128i *v)
+{
+    __m128i a, b, c, r, g, bl, zero, c32, rg_lo, rg_hi, b_lo, b_hi;
+    __m128i r16, g16, b16, y_lo, y_hi, ypart[2];
+    __m128i cy_rg, cy_b, cu_rg, cu_b, cv_rg, cv_b;
+    int half;
+
+    zero = _mm_setzero_si128();
+    c32 = _mm_set1_epi32(32);
+    cy_rg = _mm_setr_epi16(9796, 19235, 9796, 19235, 9796, 19235, 9796, 19235);
+    cy_b = _mm_setr_epi16(3736, 0, 3736, 0, 3736, 0, 3736, 0);
+    cu_rg = _mm_setr_epi16(-4784, -9437, -4784, -9437, -4784, -9437, -4784, -9437);
+    cu_b = _mm_setr_epi16(14221, 0, 14221, 0, 14221, 0, 14221, 0);
+    cv_rg = _mm_setr_epi16(20218, -16941, 20218, -16941, 20218, -16941, 20218, -16941);
+    cv_b = _mm_setr_epi16(-3277, 0, -3277, 0, -3277, 0, -3277, 0);
+
+    a = _mm_loadu_si128((__m128i *)src);
+    b = _mm_loadu_si128((__m128i *)(src + 16));
+    c = _mm_loadu_si128((__m128i *)(src + 32));
+
+    r = _mm_or_si128(_mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))
+        , _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1)))
+        , _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))
+        , _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1)))
+        , _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    bl = _mm_or_si128(_mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))
+        , _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1)))
+        , _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+
+    for (half = 0; half < 2; half++) {
+        if (half == 0) {
+            r16 = _mm_unpacklo_epi8(r, zero);
+            g16 = _mm_unpacklo_epi8(g, zero);
+            b16 = _mm_unpacklo_epi8(bl, zero);
+        } else {
+            r16 = _mm_unpackhi_epi8(r, zero);
+            g16 = _mm_unpackhi_epi8(g, zero);
+            b16 = _mm_unpackhi_epi8(bl, zero);
+        }
+        rg_lo = _mm_unpacklo_epi16(r16, g16);
+        rg_hi = _mm_unpackhi_epi16(r16, g16);
+        b_lo = _mm_unpacklo_epi16(b16, zero);
+        b_hi = _mm_unpackhi_epi16(b16, zero);
+
+        y_lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(rg_lo, cy_rg), _mm_madd_epi16(b_lo, cy_b)), 15);
+        y_hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(rg_hi, cy_rg), _mm_madd_epi16(b_hi, cy_b)), 15);
+        ypart[half] = _mm_packs_epi32(y_lo, y_hi);
+
+        u[half] = _mm_hadd_epi32(
+              _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(rg_lo, cu_rg), _mm_madd_epi16(b_lo, cu_b)), 17), c32)
+            , _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(rg_hi, cu_rg), _mm_madd_epi16(b_hi, cu_b)), 17), c32));
+        v[half] = _mm_hadd_epi32(
+              _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(rg_lo, cv_rg), _mm_madd_epi16(b_lo, cv_b)), 17), c32)
+            , _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(rg_hi, cv_rg), _mm_madd_epi16(b_hi, cv_b)), 17), c32));
+    }
+
+    _mm_storeu_si128((__m128i *)dst_y, _mm_packus_epi16(ypart[0], ypart[1]));
+}
+
+/* Keep the low byte of each of the eight sums as the chroma */
+__attribute__((target("avx2")))
+static inline void vid_rgb24_chroma_avx2(unsigned char *dst, __m128i *sum, __m128i *sum2)
+{
+    __m128i lomask;
+
+    lomask = _mm_set1_epi16(0x00FF);
+    _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(_mm_and_si128(_mm_packs_epi32(
+        _mm_add_epi32(sum[0], sum2[0]), _mm_add_epi32(sum[1], sum2[1])), lomask)
+        , _mm_setzero_si128()));
+}
+
+__attribute__((target("avx2")))
+static void vid_rgb24_avx2(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count)
+{
+    __m128i u[2], v[2], u2[2], v2[2];
+    int indx;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vid_rgb24_row_avx2(dst_y + indx, src + (indx * 3), u, v);
+        vid_rgb24_row_avx2(dst_y2 + indx, src2 + (indx * 3), u2, v2);
+        vid_rgb24_chroma_avx2(dst_u + (indx / 2), u, u2);
+        vid_rgb24_chroma_avx2(dst_v + (indx / 2), v, v2);
+    }
+
+    vid_rgb24_c(dst_y + indx, dst_y2 + indx, dst_u + (indx / 2), dst_v + (indx / 2)
+        , src + (indx * 3), src2 + (indx * 3), count - indx);
+}
+
+/* The saturating subtract takes the minimum of each pixel and 255 */
+__attribute__((target("sse2")))
+static void vid_grey16_sse2(unsigned char *dst, unsigned char *src, int count, int shift)
+{
+    __m128i a, b, cnt, lim;
+    int indx;
+
+    cnt = _mm_cvtsi32_si128(shift);
+    lim = _mm_set1_epi16(255);
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        a = _mm_srl_epi16(_mm_loadu_si128((__m128i *)(src + (indx * 2))), cnt);
+        b = _mm_srl_epi16(_mm_loadu_si128((__m128i *)(src + (indx * 2) + 16)), cnt);
+        a = _mm_sub_epi16(a, _mm_subs_epu16(a, lim));
+        b = _mm_sub_epi16(b, _mm_subs_epu16(b, lim));
+        _mm_storeu_si128((__m128i *)(dst + indx), _mm_packus_epi16(a, b));
+    }
+
+    vid_grey16_c(dst + indx, src + (indx * 2), count - indx, shift);
+}
+
+__attribute__((target("avx2")))
+static void vid_grey16_avx2(unsigned char *dst, unsigned char *src, int count, int shift)
+{
+    __m256i a, b, lim;
+    __m128i cnt;
+    int indx;
+
+    cnt = _mm_cvtsi32_si128(shift);
+    lim = _mm256_set1_epi16(255);
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        a = _mm256_srl_epi16(_mm256_loadu_si256((__m256i *)(src + (indx * 2))), cnt);
+        b = _mm256_srl_epi16(_mm256_loadu_si256((__m256i *)(src + (indx * 2) + 32)), cnt);
+        a = _mm256_min_epu16(a, lim);
+        b = _mm256_min_epu16(b, lim);
+        /* The pack works within each 128 bit lane so put the quarters back in order */
+        _mm256_storeu_si256((__m256i *)(dst + indx)
+            , _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+
+    vid_grey16_c(dst + indx, src + (indx * 2), count - indx, shift);
+}
+
+/*
+ * Colours and chroma of 16 pixels of a row pair in the middle of a bayer
+ * image.  The row above, the two rows and the row below are each loaded
+ * from one byte before and one byte after the block so that the 16 bit
+ * lanes hold the even columns with their left neighbours and the odd
+ * columns with their right neighbours.  The interpolation is that of the
+ * middle of the image in vid_bayer_pixel.
+ */
+__attribute__((target("sse2")))
+static inline __m128i vid_bayer_luma_sse2(__m128i c0, __m128i c1, __m128i c2)
+{
+    __m128i zero, k01, k2, lo, hi;
+
+    zero = _mm_setzero_si128();
+    k01 = _mm_setr_epi16(9796, 19235, 9796, 19235, 9796, 19235, 9796, 19235);
+    k2 = _mm_setr_epi16(3736, 0, 3736, 0, 3736, 0, 3736, 0);
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c0, c1), k01)
+        , _mm_madd_epi16(_mm_unpacklo_epi16(c2, zero), k2));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c0, c1), k01)
+        , _mm_madd_epi16(_mm_unpackhi_epi16(c2, zero), k2));
+
+    return _mm_packs_epi32(_mm_srli_epi32(lo, 15), _mm_srli_epi32(hi, 15));
+}
+
+/* Chroma part of eight pixels as 32 bit lanes added into sum */
+__attribute__((target("sse2")))
+static inline void vid_bayer_part_sse2(__m128i *sum, __m128i c0, __m128i c1, __m128i c2
+    , __m128i k01, __m128i k2)
+{
+    __m128i zero, c32;
+
+    zero = _mm_setzero_si128();
+    c32 = _mm_set1_epi32(32);
+    sum[0] = _mm_add_epi32(sum[0], _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+          _mm_madd_epi16(_mm_unpacklo_epi16(c0, c1), k01)
+        , _mm_madd_epi16(_mm_unpacklo_epi16(c2, zero), k2)), 17), c32));
+    sum[1] = _mm_add_epi32(sum[1], _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+          _mm_madd_epi16(_mm_unpackhi_epi16(c0, c1), k01)
+        , _mm_madd_epi16(_mm_unpackhi_epi16(c2, zero), k2)), 17), c32));
+}
+
+__attribute__((target("sse2")))
+static void vid_bayer_rows_sse2(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *img_src, int width, int height, int y)
+{
+    __m128i lomask, zero, ku01, ku2, kv01, kv2, u[2], v[2];
+    __m128i le[4], ev[4], od[4], ro[4];
+    __m128i ee0, ee1, ee2, eo0, eo1, eo2, oe0, oe1, oe2, oo0, oo1, oo2;
+    unsigned char *row;
+    int x, indx;
+
+    if ((y < 2) || ((y + 2) >= height)) {
+        vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, 0, width);
+        return;
+    }
+
+    lomask = _mm_set1_epi16(0x00FF);
+    zero = _mm_setzero_si128();
+    ku01 = _mm_setr_epi16(-4784, -9437, -4784, -9437, -4784, -9437, -4784, -9437);
+    ku2 = _mm_setr_epi16(14221, 0, 14221, 0, 14221, 0, 14221, 0);
+    kv01 = _mm_setr_epi16(20218, -16941, 20218, -16941, 20218, -16941, 20218, -16941);
+    kv2 = _mm_setr_epi16(-3277, 0, -3277, 0, -3277, 0, -3277, 0);
+
+    vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, 0, 2);
+
+    for (x = 2; x + 16 <= width - 2; x += 16) {
+        /* Rows y - 1 to y + 2 */
+        for (indx = 0; indx < 4; indx++) {
+            row = img_src + ((y - 1 + indx) * width) + x;
+            le[indx] = _mm_loadu_si128((__m128i *)(row - 1));
+            ro[indx] = _mm_loadu_si128((__m128i *)(row + 1));
+            ev[indx] = _mm_srli_epi16(le[indx], 8);
+            le[indx] = _mm_and_si128(le[indx], lomask);
+            od[indx] = _mm_and_si128(ro[indx], lomask);
+            ro[indx] = _mm_srli_epi16(ro[indx], 8);
+        }
+
+        /* Even row, even column */
+        ee0 = ev[1];
+        ee1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(le[1], od[1])
+            , _mm_add_epi16(ev[0], ev[2])), 2);
+        ee2 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(le[0], od[0])
+            , _mm_add_epi16(le[2], od[2])), 2);
+        /* Even row, odd column */
+        eo0 = _mm_srli_epi16(_mm_add_epi16(ev[1], ro[1]), 1);
+        eo1 = od[1];
+        eo2 = _mm_srli_epi16(_mm_add_epi16(od[0], od[2]), 1);
+        /* Odd row, even column */
+        oe0 = _mm_srli_epi16(_mm_add_epi16(ev[1], ev[3]), 1);
+        oe1 = ev[2];
+        oe2 = _mm_srli_epi16(_mm_add_epi16(le[2], od[2]), 1);
+        /* Odd row, odd column */
+        oo0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(ev[1], ro[1])
+            , _mm_add_epi16(ev[3], ro[3])), 2);
+        oo1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(ev[2], ro[2])
+            , _mm_add_epi16(od[1], od[3])), 2);
+        oo2 = od[2];
+
+        _mm_storeu_si128((__m128i *)(dst_y + x), _mm_or_si128(
+              vid_bayer_luma_sse2(ee0, ee1, ee2)
+            , _mm_slli_epi16(vid_bayer_luma_sse2(eo0, eo1, eo2), 8)));
+        _mm_storeu_si128((__m128i *)(dst_y2 + x), _mm_or_si128(
+              vid_bayer_luma_sse2(oe0, oe1, oe2)
+            , _mm_slli_epi16(vid_bayer_luma_sse2(oo0, oo1, oo2), 8)));
+
+        u[0] = zero;
+        u[1] = zero;
+        v[0] = zero;
+        v[1] = zero;
+        vid_bayer_part_sse2(u, ee0, ee1, ee2, ku01, ku2);
+        vid_bayer_part_sse2(u, eo0, eo1, eo2, ku01, ku2);
+        vid_bayer_part_sse2(u, oe0, oe1, oe2, ku01, ku2);
+        vid_bayer_part_sse2(u, oo0, oo1, oo2, ku01, ku2);
+        vid_bayer_part_sse2(v, ee0, ee1, ee2, kv01, kv2);
+        vid_bayer_part_sse2(v, eo0, eo1, eo2, kv01, kv2);
+        vid_bayer_part_sse2(v, oe0, oe1, oe2, kv01, kv2);
+        vid_bayer_part_sse2(v, oo0, oo1, oo2, kv01, kv2);
+        _mm_storel_epi64((__m128i *)(dst_u + (x / 2)), _mm_packus_epi16(
+            _mm_and_si128(_mm_packs_epi32(u[0], u[1]), lomask), zero));
+        _mm_storel_epi64((__m128i *)(dst_v + (x / 2)), _mm_packus_epi16(
+            _mm_and_si128(_mm_packs_epi32(v[0], v[1]), lomask), zero));
+    }
+
+    vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, x, width);
+}
+
+#endif /* VIDSIMD_X86 */
+
+#ifdef VIDSIMD_NEON
+
+static void vid_packed422_neon(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count, int yofs)
+{
+    uint8x8x4_t a, b;
+    uint8x8x2_t luma;
+    int indx;
+
+    /* The four bytes of each pixel pair are split into four vectors */
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        a = vld4_u8(src + (indx * 2));
+        b = vld4_u8(src2 + (indx * 2));
+        if (yofs == 0) {
+            luma.val[0] = a.val[0];
+            luma.val[1] = a.val[2];
+            vst2_u8(dst_y + indx, luma);
+            luma.val[0] = b.val[0];
+            luma.val[1] = b.val[2];
+            vst2_u8(dst_y2 + indx, luma);
+            vst1_u8(dst_u + (indx / 2), vhadd_u8(a.val[1], b.val[1]));
+            vst1_u8(dst_v + (indx / 2), vhadd_u8(a.val[3], b.val[3]));
+        } else {
+            luma.val[0] = a.val[1];
+            luma.val[1] = a.val[3];
+            vst2_u8(dst_y + indx, luma);
+            luma.val[0] = b.val[1];
+            luma.val[1] = b.val[3];
+            vst2_u8(dst_y2 + indx, luma);
+            vst1_u8(dst_u + (indx / 2), vhadd_u8(a.val[0], b.val[0]));
+            vst1_u8(dst_v + (indx / 2), vhadd_u8(a.val[2], b.val[2]));
+        }
+    }
+
+    vid_packed422_c(dst_y + indx, dst_y2 + indx, dst_u + (indx / 2), dst_v + (indx / 2)
+        , src + (indx * 2), src2 + (indx * 2), count - indx, yofs);
+}
 
-            if ((ix&1) == 0) {
-                calc = *img_src;
-                calc += *(img_src + uv_offset);
-                calc /= 2;
-                *pV++ = (unsigned char) calc;
+static void vid_avgrows_neon(unsigned char *dst, unsigned char *src, unsigned char *src2, int count)
+{
+    int indx;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vst1q_u8(dst + indx, vhaddq_u8(vld1q_u8(src + indx), vld1q_u8(src2 + indx)));
+    }
+
+    vid_avgrows_c(dst + indx, src + indx, src2 + indx, count - indx);
+}
+
+/* Chroma part of four pixels with the pixel pairs added up */
+static inline int32x2_t vid_rgb24_part_neon(uint16x4_t r, uint16x4_t g, uint16x4_t b
+    , int16_t cr, int16_t cg, int16_t cb)
+{
+    int32x4_t part;
+
+    part = vmull_n_s16(vreinterpret_s16_u16(r), cr);
+    part = vmlal_n_s16(part, vreinterpret_s16_u16(g), cg);
+    part = vmlal_n_s16(part, vreinterpret_s16_u16(b), cb);
+    part = vaddq_s32(vshrq_n_s32(part, 17), vdupq_n_s32(32));
+
+    return vpadd_s32(vget_low_s32(part), vget_high_s32(part));
+}
+
+/* Convert 16 pixels of a row of rgb24 and return the chroma of each pixel pair */
+static inline void vid_rgb24_row_neon(unsigned char *dst_y, unsigned char *src
+    , int32x4_t *u, int32x4_t *v)
+{
+    uint8x16x3_t px;
+    uint16x8_t r16, g16, b16;
+    uint16x4_t r, g, b, ypart[2];
+    uint32x4_t luma;
+    uint8x8_t y8[2];
+    int32x2_t upart[2], vpart[2];
+    int half, quarter;
+
+    px = vld3q_u8(src);
+
+    for (half = 0; half < 2; half++) {
+        if (half == 0) {
+            r16 = vmovl_u8(vget_low_u8(px.val[0]));
+            g16 = vmovl_u8(vget_low_u8(px.val[1]));
+            b16 = vmovl_u8(vget_low_u8(px.val[2]));
+        } else {
+            r16 = vmovl_u8(vget_high_u8(px.val[0]));
+            g16 = vmovl_u8(vget_high_u8(px.val[1]));
+            b16 = vmovl_u8(vget_high_u8(px.val[2]));
+        }
+        for (quarter = 0; quarter < 2; quarter++) {
+            if (quarter == 0) {
+                r = vget_low_u16(r16);
+                g = vget_low_u16(g16);
+                b = vget_low_u16(b16);
+            } else {
+                r = vget_high_u16(r16);
+                g = vget_high_u16(g16);
+                b = vget_high_u16(b16);
             }
+            luma = vmull_n_u16(r, 9796);
+            luma = vmlal_n_u16(luma, g, 19235);
+            luma = vmlal_n_u16(luma, b, 3736);
+            ypart[quarter] = vshrn_n_u32(luma, 15);
+            upart[quarter] = vid_rgb24_part_neon(r, g, b, -4784, -9437, 14221);
+            vpart[quarter] = vid_rgb24_part_neon(r, g, b, 20218, -16941, -3277);
+        }
+        y8[half] = vmovn_u16(vcombine_u16(ypart[0], ypart[1]));
+        u[half] = vcombine_s32(upart[0], upart[1]);
+        v[half] = vcombine_s32(vpart[0], vpart[1]);
+    }
+
+    vst1q_u8(dst_y, vcombine_u8(y8[0], y8[1]));
+}
+
+/* Keep the low byte of each of the eight sums as the chroma */
+static inline void vid_rgb24_chroma_neon(unsigned char *dst, int32x4_t *sum, int32x4_t *sum2)
+{
+    int16x8_t chroma;
+
+    chroma = vcombine_s16(vmovn_s32(vaddq_s32(sum[0], sum2[0]))
+        , vmovn_s32(vaddq_s32(sum[1], sum2[1])));
+    vst1_u8(dst, vmovn_u16(vreinterpretq_u16_s16(chroma)));
+}
+
+static void vid_rgb24_neon(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *src, unsigned char *src2, int count)
+{
+    int32x4_t u[2], v[2], u2[2], v2[2];
+    int indx;
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vid_rgb24_row_neon(dst_y + indx, src + (indx * 3), u, v);
+        vid_rgb24_row_neon(dst_y2 + indx, src2 + (indx * 3), u2, v2);
+        vid_rgb24_chroma_neon(dst_u + (indx / 2), u, u2);
+        vid_rgb24_chroma_neon(dst_v + (indx / 2), v, v2);
+    }
+
+    vid_rgb24_c(dst_y + indx, dst_y2 + indx, dst_u + (indx / 2), dst_v + (indx / 2)
+        , src + (indx * 3), src2 + (indx * 3), count - indx);
+}
+
+static void vid_grey16_neon(unsigned char *dst, unsigned char *src, int count, int shift)
+{
+    int16x8_t cnt;
+    int indx;
+
+    /* A negative count shifts right */
+    cnt = vdupq_n_s16(-shift);
+    for (indx = 0; indx + 8 <= count; indx += 8) {
+        vst1_u8(dst + indx, vqmovn_u16(vshlq_u16(vld1q_u16((uint16_t *)(src + (indx * 2)))
+            , cnt)));
+    }
+
+    vid_grey16_c(dst + indx, src + (indx * 2), count - indx, shift);
+}
+
+/* Luma of eight pixels of a row of bayer */
+static inline uint8x8_t vid_bayer_luma_neon(uint16x8_t c0, uint16x8_t c1, uint16x8_t c2)
+{
+    uint32x4_t lo, hi;
+
+    lo = vmull_n_u16(vget_low_u16(c0), 9796);
+    lo = vmlal_n_u16(lo, vget_low_u16(c1), 19235);
+    lo = vmlal_n_u16(lo, vget_low_u16(c2), 3736);
+    hi = vmull_n_u16(vget_high_u16(c0), 9796);
+    hi = vmlal_n_u16(hi, vget_high_u16(c1), 19235);
+    hi = vmlal_n_u16(hi, vget_high_u16(c2), 3736);
 
-            img_src++;
-            *pY++ = *img_src++;
+    return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15)));
+}
+
+/* Chroma part of eight pixels added into sum */
+static inline int16x8_t vid_bayer_part_neon(int16x8_t sum, uint16x8_t c0, uint16x8_t c1
+    , uint16x8_t c2, int16_t k0, int16_t k1, int16_t k2)
+{
+    int32x4_t lo, hi;
+
+    lo = vmull_n_s16(vreinterpret_s16_u16(vget_low_u16(c0)), k0);
+    lo = vmlal_n_s16(lo, vreinterpret_s16_u16(vget_low_u16(c1)), k1);
+    lo = vmlal_n_s16(lo, vreinterpret_s16_u16(vget_low_u16(c2)), k2);
+    hi = vmull_n_s16(vreinterpret_s16_u16(vget_high_u16(c0)), k0);
+    hi = vmlal_n_s16(hi, vreinterpret_s16_u16(vget_high_u16(c1)), k1);
+    hi = vmlal_n_s16(hi, vreinterpret_s16_u16(vget_high_u16(c2)), k2);
+    lo = vaddq_s32(vshrq_n_s32(lo, 17), vdupq_n_s32(32));
+    hi = vaddq_s32(vshrq_n_s32(hi, 17), vdupq_n_s32(32));
+
+    return vaddq_s16(sum, vcombine_s16(vmovn_s32(lo), vmovn_s32(hi)));
+}
+
+/* The same interpolation as vid_bayer_rows_sse2 with de-interleaving loads */
+static void vid_bayer_rows_neon(unsigned char *dst_y, unsigned char *dst_y2
+    , unsigned char *dst_u, unsigned char *dst_v
+    , unsigned char *img_src, int width, int height, int y)
+{
+    uint8x8x2_t left, right, luma;
+    uint16x8_t le[4], ev[4], od[4], ro[4];
+    uint16x8_t ee0, ee1, ee2, eo0, eo1, eo2, oe0, oe1, oe2, oo0, oo1, oo2;
+    int16x8_t u, v;
+    unsigned char *row;
+    int x, indx;
+
+    if ((y < 2) || ((y + 2) >= height)) {
+        vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, 0, width);
+        return;
+    }
+
+    vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, 0, 2);
+
+    for (x = 2; x + 16 <= width - 2; x += 16) {
+        for (indx = 0; indx < 4; indx++) {
+            row = img_src + ((y - 1 + indx) * width) + x;
+            left = vld2_u8(row - 1);
+            right = vld2_u8(row + 1);
+            le[indx] = vmovl_u8(left.val[0]);
+            ev[indx] = vmovl_u8(left.val[1]);
+            od[indx] = vmovl_u8(right.val[0]);
+            ro[indx] = vmovl_u8(right.val[1]);
         }
+
+        ee0 = ev[1];
+        ee1 = vshrq_n_u16(vaddq_u16(vaddq_u16(le[1], od[1]), vaddq_u16(ev[0], ev[2])), 2);
+        ee2 = vshrq_n_u16(vaddq_u16(vaddq_u16(le[0], od[0]), vaddq_u16(le[2], od[2])), 2);
+        eo0 = vshrq_n_u16(vaddq_u16(ev[1], ro[1]), 1);
+        eo1 = od[1];
+        eo2 = vshrq_n_u16(vaddq_u16(od[0], od[2]), 1);
+        oe0 = vshrq_n_u16(vaddq_u16(ev[1], ev[3]), 1);
+        oe1 = ev[2];
+        oe2 = vshrq_n_u16(vaddq_u16(le[2], od[2]), 1);
+        oo0 = vshrq_n_u16(vaddq_u16(vaddq_u16(ev[1], ro[1]), vaddq_u16(ev[3], ro[3])), 2);
+        oo1 = vshrq_n_u16(vaddq_u16(vaddq_u16(ev[2], ro[2]), vaddq_u16(od[1], od[3])), 2);
+        oo2 = od[2];
+
+        luma.val[0] = vid_bayer_luma_neon(ee0, ee1, ee2);
+        luma.val[1] = vid_bayer_luma_neon(eo0, eo1, eo2);
+        vst2_u8(dst_y + x, luma);
+        luma.val[0] = vid_bayer_luma_neon(oe0, oe1, oe2);
+        luma.val[1] = vid_bayer_luma_neon(oo0, oo1, oo2);
+        vst2_u8(dst_y2 + x, luma);
+
+        u = vdupq_n_s16(0);
+        u = vid_bayer_part_neon(u, ee0, ee1, ee2, -4784, -9437, 14221);
+        u = vid_bayer_part_neon(u, eo0, eo1, eo2, -4784, -9437, 14221);
+        u = vid_bayer_part_neon(u, oe0, oe1, oe2, -4784, -9437, 14221);
+        u = vid_bayer_part_neon(u, oo0, oo1, oo2, -4784, -9437, 14221);
+        v = vdupq_n_s16(0);
+        v = vid_bayer_part_neon(v, ee0, ee1, ee2, 20218, -16941, -3277);
+        v = vid_bayer_part_neon(v, eo0, eo1, eo2, 20218, -16941, -3277);
+        v = vid_bayer_part_neon(v, oe0, oe1, oe2, 20218, -16941, -3277);
+        v = vid_bayer_part_neon(v, oo0, oo1, oo2, 20218, -16941, -3277);
+        vst1_u8(dst_u + (x / 2), vmovn_u16(vreinterpretq_u16_s16(u)));
+        vst1_u8(dst_v + (x / 2), vmovn_u16(vreinterpretq_u16_s16(v)));
     }
+
+    vid_bayer_c(dst_y, dst_y2, dst_u, dst_v, img_src, width, height, y, x, width);
 }
 
-void vid_rgb24toyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+#endif /* VIDSIMD_NEON */
+
+/*
+ * Select the conversion kernels for the instruction set.  The scalar
+ * kernels are used until this is called and when simd is SIMD_TYPE_NONE.
+ * Returns the instruction set of the kernels selected.
+ */
+enum SIMD_TYPE vid_convert_init(enum SIMD_TYPE simd)
 {
-    unsigned char *y, *u, *v;
-    unsigned char *r, *g, *b;
-    int i, loop;
-
-    r = img_src;
-    g = r + 1;
-    b = g + 1;
-
-    y = img_dst;
-    u = y + width * height;
-    v = u + (width * height) / 4;
-    memset(u, 0, width * height / 4);
-    memset(v, 0, width * height / 4);
-
-    for (loop = 0; loop < height; loop++) {
-        for (i = 0; i < width; i += 2) {
-            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
-            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
-            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
-            r += 3;
-            g += 3;
-            b += 3;
-            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
-            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
-            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
-            r += 3;
-            g += 3;
-            b += 3;
-            u++;
-            v++;
+    vid_packed422_kernel = vid_packed422_c;
+    vid_avgrows_kernel = vid_avgrows_c;
+    vid_rgb24_kernel = vid_rgb24_c;
+    vid_bayer_kernel = vid_bayer_rows_c;
+    vid_grey16_kernel = vid_grey16_c;
+
+    #ifdef VIDSIMD_X86
+        if (simd == SIMD_TYPE_AVX2) {
+            vid_packed422_kernel = vid_packed422_avx2;
+            vid_avgrows_kernel = vid_avgrows_avx2;
+            vid_rgb24_kernel = vid_rgb24_avx2;
+            /* The bayer kernel gains nothing from the wider registers */
+            vid_bayer_kernel = vid_bayer_rows_sse2;
+            vid_grey16_kernel = vid_grey16_avx2;
+            return SIMD_TYPE_AVX2;
+        } else if (simd == SIMD_TYPE_SSE2) {
+            /* Splitting the colours of rgb24 needs the byte shuffles of SSSE3 */
+            vid_packed422_kernel = vid_packed422_sse2;
+            vid_avgrows_kernel = vid_avgrows_sse2;
+            vid_bayer_kernel = vid_bayer_rows_sse2;
+            vid_grey16_kernel = vid_grey16_sse2;
+            return SIMD_TYPE_SSE2;
         }
+    #endif
 
-        if ((loop & 1) == 0) {
-            u -= width / 2;
-            v -= width / 2;
+    #ifdef VIDSIMD_NEON
+        if (simd == SIMD_TYPE_NEON) {
+            vid_packed422_kernel = vid_packed422_neon;
+            vid_avgrows_kernel = vid_avgrows_neon;
+            vid_rgb24_kernel = vid_rgb24_neon;
+            vid_bayer_kernel = vid_bayer_rows_neon;
+            vid_grey16_kernel = vid_grey16_neon;
+            return SIMD_TYPE_NEON;
         }
+    #endif
+
+    return SIMD_TYPE_NONE;
+}
+
+void vid_yuv422to420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    unsigned char *dst_u, *dst_v;
+    int indx;
+
+    dst_u = img_dst + (width * height);
+    dst_v = dst_u + (width * height) / 4;
+    for (indx = 0; indx < height; indx += 2) {
+        vid_packed422_kernel(img_dst + (indx * width), img_dst + ((indx + 1) * width)
+            , dst_u + ((indx / 2) * (width / 2)), dst_v + ((indx / 2) * (width / 2))
+            , img_src + (indx * width * 2), img_src + ((indx + 1) * width * 2), width, 0);
     }
 }
 
-/**
- * mjpegtoyuv420p
- *
- * Return values
- *  -1 on fatal error
- *  0  on success
- *  2  if jpeg lib threw a "corrupt jpeg data" warning.
- *     in this case, "a damaged output image is likely."
+void vid_yuv422pto420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    unsigned char *src_u, *src_v, *dst_u, *dst_v;
+    int indx;
+
+    /*Planar version of 422 */
+    memcpy(img_dst, img_src, width * height);
+
+    /* Create U and V planes from the average of each pair of rows. */
+    src_u = img_src + (width * height);
+    src_v = src_u + (width / 2) * height;
+    dst_u = img_dst + (width * height);
+    dst_v = dst_u + (width * height) / 4;
+    for (indx = 0; indx < (height / 2); indx++) {
+        vid_avgrows_kernel(dst_u + (indx * (width / 2))
+            , src_u + ((indx * 2) * (width / 2)), src_u + (((indx * 2) + 1) * (width / 2)), width / 2);
+        vid_avgrows_kernel(dst_v + (indx * (width / 2))
+            , src_v + ((indx * 2) * (width / 2)), src_v + (((indx * 2) + 1) * (width / 2)), width / 2);
+    }
+}
+
+void vid_uyvyto420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    unsigned char *dst_u, *dst_v;
+    int indx;
+
+    dst_u = img_dst + (width * height);
+    dst_v = dst_u + (width * height) / 4;
+    for (indx = 0; indx < height; indx += 2) {
+        vid_packed422_kernel(img_dst + (indx * width), img_dst + ((indx + 1) * width)
+            , dst_u + ((indx / 2) * (width / 2)), dst_v + ((indx / 2) * (width / 2))
+            , img_src + (indx * width * 2), img_src + ((indx + 1) * width * 2), width, 1);
+    }
+}
+
+void vid_rgb24toyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    unsigned char *dst_u, *dst_v;
+    int indx;
+
+    dst_u = img_dst + (width * height);
+    dst_v = dst_u + (width * height) / 4;
+    for (indx = 0; indx < height; indx += 2) {
+        vid_rgb24_kernel(img_dst + (indx * width), img_dst + ((indx + 1) * width)
+            , dst_u + ((indx / 2) * (width / 2)), dst_v + ((indx / 2) * (width / 2))
+            , img_src + (indx * width * 3), img_src + ((indx + 1) * width * 3), width);
+    }
+}
+
+/*
+ * Demosaic a bayer image straight into yuv420p.  This gives the same
+ * bytes as vid_bayer2rgb24 followed by vid_rgb24toyuv420p without the
+ * rgb24 image in between.
  */
-int vid_mjpegtoyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height, unsigned int size)
+void vid_bayer2yuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
+{
+    unsigned char *dst_u, *dst_v;
+    int indx;
+
+    dst_u = img_dst + (width * height);
+    dst_v = dst_u + (width * height) / 4;
+    for (indx = 0; indx < height; indx += 2) {
+        vid_bayer_kernel(img_dst + (indx * width), img_dst + ((indx + 1) * width)
+            , dst_u + ((indx / 2) * (width / 2)), dst_v + ((indx / 2) * (width / 2))
+            , img_src, width, height, indx);
+    }
+}
+
+/*
+ * Move the image to the last start of image marker in the buffer since
+ * some cameras send several.  Returns 1 when there is no marker.
+ */
+static int vid_mjpeg_soi(unsigned char *img_src, unsigned int *size)
 {
     unsigned char *ptr_buffer;
     size_t soi_pos = 0;
-    int ret = 0;
 
-    ptr_buffer =(unsigned char*) memmem(img_src, size, "\xff\xd8", 2);
+    ptr_buffer =(unsigned char*) memmem(img_src, *size, "\xff\xd8", 2);
     if (ptr_buffer == NULL) {
         MOTION_LOG(CRT, TYPE_VIDEO, NO_ERRNO,_("Corrupt image ... continue"));
         return 1;
@@ -429,19 +1271,39 @@ int vid_mjpegtoyuv420p(unsigned char *img_dst, unsigned char *img_src, int width
      Some cameras are sending multiple SOIs in the buffer.
      Move the pointer to the last SOI in the buffer and proceed.
     */
-    while (ptr_buffer != NULL && ((size - soi_pos - 1) > 2) ){
+    while (ptr_buffer != NULL && ((*size - soi_pos - 1) > 2) ){
         soi_pos = ptr_buffer - img_src;
-        ptr_buffer =(unsigned char*) memmem(img_src + soi_pos + 1, size - soi_pos - 1, "\xff\xd8", 2);
+        ptr_buffer =(unsigned char*) memmem(img_src + soi_pos + 1, *size - soi_pos - 1, "\xff\xd8", 2);
     }
 
     if (soi_pos != 0){
         MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO,_("SOI position adjusted by %d bytes."), soi_pos);
     }
 
-    memmove(img_src, img_src + soi_pos, size - soi_pos);
-    size -= soi_pos;
+    memmove(img_src, img_src + soi_pos, *size - soi_pos);
+    *size -= soi_pos;
 
-    ret = jpgutl_decode_jpeg(img_src,size, width, height, img_dst);
+    return 0;
+}
+
+/**
+ * mjpegtoyuv420p
+ *
+ * Return values
+ *  -1 on fatal error
+ *  0  on success
+ *  2  if jpeg lib threw a "corrupt jpeg data" warning.
+ *     in this case, "a damaged output image is likely."
+ */
+int vid_mjpegtoyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height, unsigned int size)
+{
+    int ret = 0;
+
+    if (vid_mjpeg_soi(img_src, &size) != 0) {
+        return 1;
+    }
+
+    ret = jpgutl_decode_jpeg(img_src,size, width, height, img_dst, 1);
 
     if (ret == -1) {
         MOTION_LOG(CRT, TYPE_VIDEO, NO_ERRNO,_("Corrupt image ... continue"));
@@ -450,33 +1312,82 @@ int vid_mjpegtoyuv420p(unsigned char *img_dst, unsigned char *img_src, int width
     return ret;
 }
 
-void vid_y10torgb24(unsigned char *img_dst, unsigned char *img_src, int width, int height, int shift)
+/*
+ * Decode the jpeg at 1/scale of width and height into img_dst by scaling
+ * the DCT, which skips most of the work of the full decode.  When img_high
+ * is given the full size image is also decoded into it.  Return values are
+ * those of vid_mjpegtoyuv420p for img_dst.
+ */
+int vid_mjpegtoyuv420p_scaled(unsigned char *img_dst, unsigned char *img_high
+    , unsigned char *img_src, int width, int height, unsigned int size, int scale)
 {
-    /* Source code: raw2rgbpnm project */
-    /* url: http://salottisipuli.retiisi.org.uk/cgi-bin/gitweb.cgi?p=~sailus/raw2rgbpnm.git;a=summary */
+    int ret = 0;
+
+    if (vid_mjpeg_soi(img_src, &size) != 0) {
+        return 1;
+    }
 
-    /* bpp - bits per pixel */
+    ret = jpgutl_decode_jpeg(img_src, size, width / scale, height / scale, img_dst, scale);
+    if (ret == -1) {
+        MOTION_LOG(CRT, TYPE_VIDEO, NO_ERRNO,_("Corrupt image ... continue"));
+        return 1;
+    }
+
+    if (img_high != NULL) {
+        if (jpgutl_decode_jpeg(img_src, size, width, height, img_high, 1) == -1) {
+            vid_yuv420p_enlarge(img_high, img_dst, width / scale, height / scale, scale);
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Enlarge the yuv420p image of width and height by scale in each
+ * direction by repeating the pixels.  This stands in for the full size
+ * image when it was not decoded.
+ */
+void vid_yuv420p_enlarge(unsigned char *img_dst, unsigned char *img_src, int width, int height, int scale)
+{
+    unsigned char *src, *dst;
+    int plane, pw, ph, row, col, indx;
+
+    src = img_src;
+    dst = img_dst;
+    for (plane = 0; plane < 3; plane++) {
+        if (plane == 0) {
+            pw = width;
+            ph = height;
+        } else {
+            pw = width / 2;
+            ph = height / 2;
+        }
+        for (row = 0; row < ph; row++) {
+            for (col = 0; col < pw; col++) {
+                memset(dst + (col * scale), src[col], scale);
+            }
+            for (indx = 1; indx < scale; indx++) {
+                memcpy(dst + (indx * pw * scale), dst, pw * scale);
+            }
+            src += pw;
+            dst += pw * scale * scale;
+        }
+    }
+}
+
+/*
+ * Grey with 16 bit pixels such as Y10 and Y12 straight into yuv420p.
+ * The pixels are shifted down by shift bits into the luma and the chroma
+ * is set to the middle value.
+ */
+void vid_grey16toyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height, int shift)
+{
     /* bpp: 'Pixels are stored in 16-bit words with unused high bits padded with 0' */
     /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y12.html */
     /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y10.html */
 
-    int src_size[2] = {width,height};
-    int bpp = 16;
-    unsigned int src_stride = (src_size[0] * bpp) / 8;
-    unsigned int rgb_stride = src_size[0] * 3;
-    int a = 0;
-    int src_x = 0, src_y = 0;
-    int dst_x = 0, dst_y = 0;
-
-    for (src_y = 0, dst_y = 0; dst_y < src_size[1]; src_y++, dst_y++) {
-        for (src_x = 0, dst_x = 0; dst_x < src_size[0]; src_x++, dst_x++) {
-            a = (img_src[src_y*src_stride + src_x*2+0] |
-                (img_src[src_y*src_stride + src_x*2+1] << 8)) >> shift;
-            img_dst[dst_y*rgb_stride+3*dst_x+0] = a;
-            img_dst[dst_y*rgb_stride+3*dst_x+1] = a;
-            img_dst[dst_y*rgb_stride+3*dst_x+2] = a;
-        }
-    }
+    vid_grey16_kernel(img_dst, img_src, width * height, shift);
+    memset(img_dst + (width * height), 128, (width * height) / 2);
 }
 
 void vid_greytoyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height)
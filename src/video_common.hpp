@@ -20,14 +20,19 @@
 #ifndef _INCLUDE_VIDEO_COMMON_H
 #define _INCLUDE_VIDEO_COMMON_H
 
+enum SIMD_TYPE vid_convert_init(enum SIMD_TYPE simd);
 void vid_yuv422to420p(unsigned char *img_dest, unsigned char *img_src, int width, int height);
 void vid_yuv422pto420p(unsigned char *img_dest, unsigned char *img_src, int width, int height);
 void vid_uyvyto420p(unsigned char *img_dest, unsigned char *img_src, int width, int height);
 void vid_rgb24toyuv420p(unsigned char *img_dest, unsigned char *img_src, int width, int height);
+void vid_bayer2yuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height);
 void vid_bayer2rgb24(unsigned char *img_dst, unsigned char *img_src, long int width, long int height);
-void vid_y10torgb24(unsigned char *img_dest, unsigned char *img_src, int width, int height, int shift);
+void vid_grey16toyuv420p(unsigned char *img_dst, unsigned char *img_src, int width, int height, int shift);
 void vid_greytoyuv420p(unsigned char *img_dest, unsigned char *img_src, int width, int height);
 int vid_sonix_decompress(unsigned char *img_dest, unsigned char *img_src, int width, int height);
 int vid_mjpegtoyuv420p(unsigned char *img_dest, unsigned char *img_src, int width, int height, unsigned int size);
+int vid_mjpegtoyuv420p_scaled(unsigned char *img_dst, unsigned char *img_high
+    , unsigned char *img_src, int width, int height, unsigned int size, int scale);
+void vid_yuv420p_enlarge(unsigned char *img_dst, unsigned char *img_src, int width, int height, int scale);
 
 #endif
@@ -24,11 +24,13 @@
 #include "rotate.hpp"
 #include "video_common.hpp"
 #include "video_v4l2.hpp"
+#include "motion_loop.hpp"
 #include <sys/mman.h>
 
 
 #define MMAP_BUFFERS            4
 #define MIN_MMAP_BUFFERS        2
+#define V4L2_QUEUE_SIZE         4
 #define V4L2_PALETTE_COUNT_MAX 21
 
 #ifdef HAVE_V4L2
@@ -615,6 +617,122 @@ static int v4l2_set_palette(ctx_v4l2cam *v4l2cam)
 
 }
 
+/*
+ * Queue buffers of our own to the device instead of mapping its buffers.
+ * The buffers are the size of an image ring slot so that a captured
+ * YUV420 image can be swapped into the ring instead of copied.  Returns
+ * -1 when the device or format can not be used this way and the caller
+ * is to fall back to the memory mapped buffers.
+ */
+static int v4l2_set_userptr(ctx_v4l2cam *v4l2cam)
+{
+    struct v4l2_buffer buf;
+    int buffer_index, size_norm;
+
+    if (v4l2cam->userptr == FALSE) {
+        return -1;
+    }
+
+    size_norm = (v4l2cam->width * v4l2cam->height * 3) / 2;
+    if ((v4l2cam->pixfmt_src != V4L2_PIX_FMT_YUV420) ||
+        (v4l2cam->dst_fmt.fmt.pix.bytesperline != (unsigned int)v4l2cam->width) ||
+        (v4l2cam->dst_fmt.fmt.pix.sizeimage > (unsigned int)size_norm)) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("userptr needs the unpadded YUV420 palette.  Using mmap"));
+        return -1;
+    }
+
+    memset(&v4l2cam->req, 0, sizeof(struct v4l2_requestbuffers));
+
+    v4l2cam->req.count = MMAP_BUFFERS;
+    v4l2cam->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    v4l2cam->req.memory = V4L2_MEMORY_USERPTR;
+    if (xioctl(v4l2cam, VIDIOC_REQBUFS, &v4l2cam->req) == -1) {
+        MOTION_LOG(NTC, TYPE_VIDEO, SHOW_ERRNO
+            ,_("Device does not support userptr.  Using mmap"));
+        return -1;
+    }
+    v4l2cam->buffer_count = v4l2cam->req.count;
+
+    if (v4l2cam->buffer_count < MIN_MMAP_BUFFERS) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("Insufficient userptr buffers %d.  Using mmap"), v4l2cam->buffer_count);
+        v4l2cam->req.count = 0;
+        xioctl(v4l2cam, VIDIOC_REQBUFS, &v4l2cam->req);
+        return -1;
+    }
+
+    v4l2cam->buffers =(video_buff*) mymalloc(v4l2cam->buffer_count * sizeof(video_buff));
+    for (buffer_index = 0; buffer_index < v4l2cam->buffer_count; buffer_index++) {
+        v4l2cam->buffers[buffer_index].size = size_norm;
+        v4l2cam->buffers[buffer_index].ptr =(unsigned char*) mymalloc(size_norm);
+    }
+
+    for (buffer_index = 0; buffer_index < v4l2cam->buffer_count; buffer_index++) {
+        memset(&buf, 0, sizeof(struct v4l2_buffer));
+
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_USERPTR;
+        buf.index = buffer_index;
+        buf.m.userptr = (unsigned long)v4l2cam->buffers[buffer_index].ptr;
+        buf.length = v4l2cam->buffers[buffer_index].size;
+
+        if (xioctl(v4l2cam, VIDIOC_QBUF, &buf) == -1) {
+            MOTION_LOG(NTC, TYPE_VIDEO, SHOW_ERRNO
+                ,_("Error queueing userptr buffer %d.  Using mmap"), buffer_index);
+            v4l2cam->req.count = 0;
+            xioctl(v4l2cam, VIDIOC_REQBUFS, &v4l2cam->req);
+            for (buffer_index = 0; buffer_index < v4l2cam->buffer_count; buffer_index++) {
+                free(v4l2cam->buffers[buffer_index].ptr);
+            }
+            free(v4l2cam->buffers);
+            v4l2cam->buffers = NULL;
+            return -1;
+        }
+    }
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("Capturing into userptr buffers: frames=%d"), v4l2cam->buffer_count);
+
+    return 0;
+}
+
+/*
+ * The scaled decode needs a jpeg palette and a device size that divides
+ * down to a multiple of 8.  Otherwise the device is set back to the
+ * configured size and the images are used as they are.
+ */
+static int v4l2_set_scale(ctx_cam *cam)
+{
+    ctx_v4l2cam *v4l2cam = cam->v4l2cam;
+    int scale = v4l2cam->mjpeg_scale;
+
+    if (scale == 1) {
+        return 0;
+    }
+
+    if (((v4l2cam->pixfmt_src == V4L2_PIX_FMT_MJPEG) ||
+         (v4l2cam->pixfmt_src == V4L2_PIX_FMT_JPEG) ||
+         (v4l2cam->pixfmt_src == V4L2_PIX_FMT_PJPG)) &&
+        ((v4l2cam->width % (scale * 8)) == 0) &&
+        ((v4l2cam->height % (scale * 8)) == 0)) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("Decoding %dx%d at %dx%d for detection")
+            ,v4l2cam->width, v4l2cam->height
+            ,v4l2cam->width / scale, v4l2cam->height / scale);
+        return 0;
+    }
+
+    MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+        ,_("mjpeg_scale needs a jpeg palette and a size that divides by %d.  Using 1")
+        ,scale * 8);
+    v4l2cam->mjpeg_scale = 1;
+    v4l2cam->width = cam->conf->width;
+    v4l2cam->height = cam->conf->height;
+
+    return v4l2_set_pixfmt(v4l2cam, v4l2cam->pixfmt_src);
+}
+
 /* Set the memory mapping from device to Motion*/
 static int v4l2_set_mmap(ctx_v4l2cam *v4l2cam)
 {
@@ -626,6 +744,16 @@ static int v4l2_set_mmap(ctx_v4l2cam *v4l2cam)
         return -1;
     }
 
+    if (v4l2_set_userptr(v4l2cam) == 0) {
+        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(v4l2cam, VIDIOC_STREAMON, &type) == -1) {
+            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO
+                ,_("Error starting stream. VIDIOC_STREAMON"));
+            return -1;
+        }
+        return 0;
+    }
+
     memset(&v4l2cam->req, 0, sizeof(struct v4l2_requestbuffers));
 
     v4l2cam->req.count = MMAP_BUFFERS;
@@ -717,13 +845,54 @@ static int v4l2_set_mmap(ctx_v4l2cam *v4l2cam)
 /* Assign the resulting sizes to the camera context items */
 static void v4l2_set_imgs(ctx_cam *cam)
 {
-    cam->imgs.width = cam->v4l2cam->width;
-    cam->imgs.height = cam->v4l2cam->height;
+    cam->imgs.width = cam->v4l2cam->width / cam->v4l2cam->mjpeg_scale;
+    cam->imgs.height = cam->v4l2cam->height / cam->v4l2cam->mjpeg_scale;
     cam->imgs.motionsize = cam->imgs.width * cam->imgs.height;
     cam->imgs.size_norm = (cam->imgs.motionsize * 3) / 2;
-    cam->conf->width = cam->v4l2cam->width;
-    cam->conf->height = cam->v4l2cam->height;
+    cam->conf->width = cam->imgs.width;
+    cam->conf->height = cam->imgs.height;
+
+    /* The full size image is the high resolution image for pictures and movies */
+    if (cam->v4l2cam->mjpeg_scale > 1) {
+        cam->imgs.width_high = cam->v4l2cam->width;
+        cam->imgs.height_high = cam->v4l2cam->height;
+    }
+
+}
+
+/* Give the buffer that was last dequeued back to the device */
+static int v4l2_capture_requeue(ctx_v4l2cam *v4l2cam)
+{
+    sigset_t set, old;
+
+    if (v4l2cam->pframe < 0) {
+        return 0;
+    }
+
+    /* Block signals during IOCTL */
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGALRM);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    /* The buffer may have been swapped into the image ring since it was dequeued */
+    if (v4l2cam->req.memory == V4L2_MEMORY_USERPTR) {
+        v4l2cam->buf.m.userptr = (unsigned long)v4l2cam->buffers[v4l2cam->buf.index].ptr;
+        v4l2cam->buf.length = v4l2cam->buffers[v4l2cam->buf.index].size;
+    }
+    if (xioctl(v4l2cam, VIDIOC_QBUF, &v4l2cam->buf) == -1) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
+        pthread_sigmask(SIG_UNBLOCK, &old, NULL);
+        return -1;
+    }
+    v4l2cam->pframe = -1;
 
+    pthread_sigmask(SIG_UNBLOCK, &old, NULL);
+
+    return 0;
 }
 
 /* Capture the image into the buffer */
@@ -732,6 +901,10 @@ static int v4l2_capture_buffer(ctx_v4l2cam *v4l2cam)
     int retcd;
     sigset_t set, old;
 
+    if (v4l2_capture_requeue(v4l2cam) != 0) {
+        return -1;
+    }
+
     /* Block signals during IOCTL */
     sigemptyset(&set);
     sigaddset(&set, SIGCHLD);
@@ -741,18 +914,10 @@ static int v4l2_capture_buffer(ctx_v4l2cam *v4l2cam)
     sigaddset(&set, SIGHUP);
     pthread_sigmask(SIG_BLOCK, &set, &old);
 
-    if (v4l2cam->pframe >= 0) {
-        if (xioctl(v4l2cam, VIDIOC_QBUF, &v4l2cam->buf) == -1) {
-            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
-            pthread_sigmask(SIG_UNBLOCK, &old, NULL);
-            return -1;
-        }
-    }
-
     memset(&v4l2cam->buf, 0, sizeof(struct v4l2_buffer));
 
     v4l2cam->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    v4l2cam->buf.memory = V4L2_MEMORY_MMAP;
+    v4l2cam->buf.memory = v4l2cam->req.memory;
     v4l2cam->buf.bytesused = 0;
 
     if (xioctl(v4l2cam, VIDIOC_DQBUF, &v4l2cam->buf) == -1) {
@@ -797,11 +962,20 @@ static int v4l2_capture_buffer(ctx_v4l2cam *v4l2cam)
 }
 
 /* Convert captured image to the standard motion pixel format*/
-static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, unsigned char *img_norm)
+static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, ctx_image_data *img_data)
 {
-    int shift;
+    int shift, retcd, need_high;
+    unsigned char *img_norm = img_data->image_norm;
+    unsigned char *scratch;
     video_buff *the_buffer = &v4l2cam->buffers[v4l2cam->buf.index];
 
+    /* The common buffer belongs to motion_loop when converting on the capture thread */
+    if (v4l2cam->scratch != NULL) {
+        scratch = v4l2cam->scratch;
+    } else {
+        scratch = cam->imgs.common_buffer;
+    }
+
     shift = 0;
     /*The FALLTHROUGH is a special comment required by compiler. */
     switch (v4l2cam->pixfmt_src) {
@@ -822,6 +996,16 @@ static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, unsigned cha
         return 0;
 
     case V4L2_PIX_FMT_YUV420:
+        /*
+         * With userptr the buffer and the ring slot are the same size so
+         * the captured image goes into the ring and the slot's old image
+         * is queued to the device next.
+         */
+        if (v4l2cam->req.memory == V4L2_MEMORY_USERPTR) {
+            img_data->image_norm = the_buffer->ptr;
+            the_buffer->ptr = img_norm;
+            return 0;
+        }
         memcpy(img_norm, the_buffer->ptr, the_buffer->content_length);
         return 0;
 
@@ -830,6 +1014,17 @@ static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, unsigned cha
     case V4L2_PIX_FMT_JPEG:
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_MJPEG:
+        if (v4l2cam->mjpeg_scale > 1) {
+            need_high = __atomic_load_n(&v4l2cam->need_high, __ATOMIC_RELAXED);
+            retcd = vid_mjpegtoyuv420p_scaled(img_norm
+                , need_high ? img_data->image_high : NULL
+                , the_buffer->ptr, v4l2cam->width, v4l2cam->height
+                , the_buffer->content_length, v4l2cam->mjpeg_scale);
+            if (!need_high) {
+                img_data->flags |= IMAGE_NOHIGH;
+            }
+            return retcd;
+        }
         return vid_mjpegtoyuv420p(img_norm, the_buffer->ptr, v4l2cam->width, v4l2cam->height
                                     ,the_buffer->content_length);
 
@@ -840,16 +1035,15 @@ static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, unsigned cha
     case V4L2_PIX_FMT_SGRBG8:
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_SBGGR8:    /* bayer */
-        vid_bayer2rgb24(cam->imgs.common_buffer, the_buffer->ptr, v4l2cam->width, v4l2cam->height);
-        vid_rgb24toyuv420p(img_norm, cam->imgs.common_buffer, v4l2cam->width, v4l2cam->height);
+        vid_bayer2yuv420p(img_norm, the_buffer->ptr, v4l2cam->width, v4l2cam->height);
         return 0;
 
     case V4L2_PIX_FMT_SPCA561:
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_SN9C10X:
-        vid_sonix_decompress(img_norm, the_buffer->ptr, v4l2cam->width, v4l2cam->height);
-        vid_bayer2rgb24(cam->imgs.common_buffer, img_norm, v4l2cam->width, v4l2cam->height);
-        vid_rgb24toyuv420p(img_norm, cam->imgs.common_buffer, v4l2cam->width, v4l2cam->height);
+        /* The demosaic reads the rows around the one it writes so it can not be done in place */
+        vid_sonix_decompress(scratch, the_buffer->ptr, v4l2cam->width, v4l2cam->height);
+        vid_bayer2yuv420p(img_norm, scratch, v4l2cam->width, v4l2cam->height);
         return 0;
 
     case V4L2_PIX_FMT_Y12:
@@ -857,8 +1051,10 @@ static int v4l2_capture_convert(ctx_cam *cam, ctx_v4l2cam *v4l2cam, unsigned cha
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_Y10:
         shift += 2;
-        vid_y10torgb24(cam->imgs.common_buffer, the_buffer->ptr, v4l2cam->width, v4l2cam->height, shift);
-        vid_rgb24toyuv420p(img_norm, cam->imgs.common_buffer, v4l2cam->width, v4l2cam->height);
+        if (v4l2cam->grey_shift >= 0) {
+            shift = v4l2cam->grey_shift;
+        }
+        vid_grey16toyuv420p(img_norm, the_buffer->ptr, v4l2cam->width, v4l2cam->height, shift);
         return 0;
 
     case V4L2_PIX_FMT_GREY:
@@ -881,6 +1077,10 @@ static int v4l2_device_init(ctx_cam *cam)
     cam->v4l2cam->pframe = -1;
     cam->v4l2cam->finish = &cam->finish_cam;
     cam->v4l2cam->buffers = NULL;
+    cam->v4l2cam->queue = NULL;
+    cam->v4l2cam->scratch = NULL;
+    cam->v4l2cam->need_high = TRUE;
+    cam->v4l2cam->handler_finished = TRUE;
 
     cam->v4l2cam->params =(struct ctx_params*) mymalloc(sizeof(struct ctx_params));
     memset(cam->v4l2cam->params, 0, sizeof(struct ctx_params));
@@ -894,6 +1094,10 @@ static int v4l2_device_init(ctx_cam *cam)
     util_parms_add_default(cam->v4l2cam->params, "palette", "17");
     util_parms_add_default(cam->v4l2cam->params, "norm", "0");
     util_parms_add_default(cam->v4l2cam->params, "frequency", "0");
+    util_parms_add_default(cam->v4l2cam->params, "grey_shift", "-1");
+    util_parms_add_default(cam->v4l2cam->params, "userptr", "0");
+    util_parms_add_default(cam->v4l2cam->params, "capture_thread", "0");
+    util_parms_add_default(cam->v4l2cam->params, "mjpeg_scale", "1");
 
 
     for (indx = 0; indx < cam->v4l2cam->params->params_count; indx++) {
@@ -909,12 +1113,44 @@ static int v4l2_device_init(ctx_cam *cam)
         if (mystreq(cam->v4l2cam->params->params_array[indx].param_name,"frequency")) {
             cam->v4l2cam->frequency =  atol(cam->v4l2cam->params->params_array[indx].param_value);
         }
+        if (mystreq(cam->v4l2cam->params->params_array[indx].param_name,"grey_shift")) {
+            cam->v4l2cam->grey_shift =  atoi(cam->v4l2cam->params->params_array[indx].param_value);
+        }
+        if (mystreq(cam->v4l2cam->params->params_array[indx].param_name,"userptr")) {
+            cam->v4l2cam->userptr =  atoi(cam->v4l2cam->params->params_array[indx].param_value);
+        }
+        if (mystreq(cam->v4l2cam->params->params_array[indx].param_name,"capture_thread")) {
+            cam->v4l2cam->capture_thread =  atoi(cam->v4l2cam->params->params_array[indx].param_value);
+        }
+        if (mystreq(cam->v4l2cam->params->params_array[indx].param_name,"mjpeg_scale")) {
+            cam->v4l2cam->mjpeg_scale =  atoi(cam->v4l2cam->params->params_array[indx].param_value);
+        }
+    }
+
+    /* A shift of 16 or more would leave none of the bits of the 16 bit grey */
+    if ((cam->v4l2cam->grey_shift < -1) || (cam->v4l2cam->grey_shift > 15)) {
+        MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+            ,_("grey_shift must be from -1 to 15.  Using -1"));
+        cam->v4l2cam->grey_shift = -1;
     }
 
     cam->v4l2cam->height = cam->conf->height;
     cam->v4l2cam->width = cam->conf->width;
     cam->v4l2cam->fps =cam->conf->framerate;
 
+    /* With mjpeg_scale the device is asked for the configured size times the scale */
+    if ((cam->v4l2cam->mjpeg_scale == 2) || (cam->v4l2cam->mjpeg_scale == 4) ||
+        (cam->v4l2cam->mjpeg_scale == 8)) {
+        cam->v4l2cam->width *= cam->v4l2cam->mjpeg_scale;
+        cam->v4l2cam->height *= cam->v4l2cam->mjpeg_scale;
+    } else {
+        if (cam->v4l2cam->mjpeg_scale != 1) {
+            MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+                ,_("mjpeg_scale must be 1, 2, 4 or 8.  Using 1"));
+        }
+        cam->v4l2cam->mjpeg_scale = 1;
+    }
+
     return 0;
 }
 
@@ -1118,6 +1354,267 @@ static void v4l2_set_fps(ctx_v4l2cam *v4l2cam)
     return;
 }
 
+/*
+ * Wait up to a second for the device to have an image so that the
+ * capture thread can notice when it is to stop.  Returns 0 when an image
+ * can be dequeued.
+ */
+static int v4l2_capture_wait(ctx_v4l2cam *v4l2cam)
+{
+    fd_set fds;
+    struct timeval tv;
+
+    FD_ZERO(&fds);
+    FD_SET(v4l2cam->fd_device, &fds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    if (select(v4l2cam->fd_device + 1, &fds, NULL, NULL, &tv) > 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Wall clock time of the image just dequeued.  Drivers stamp the buffer
+ * with the monotonic clock when it is filled so the age of the image is
+ * taken off the current time.
+ */
+static void v4l2_capture_time(ctx_v4l2cam *v4l2cam, struct timespec *imgts)
+{
+    struct timespec ts_mono;
+    int64_t age;
+
+    clock_gettime(CLOCK_REALTIME, imgts);
+
+    if ((v4l2cam->buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts_mono);
+    age = ((int64_t)(ts_mono.tv_sec - v4l2cam->buf.timestamp.tv_sec) * 1000000000) +
+        ts_mono.tv_nsec - ((int64_t)v4l2cam->buf.timestamp.tv_usec * 1000);
+    if ((age < 0) || (age > 1000000000)) {
+        return;
+    }
+
+    age = ((int64_t)imgts->tv_sec * 1000000000) + imgts->tv_nsec - age;
+    imgts->tv_sec = age / 1000000000;
+    imgts->tv_nsec = age % 1000000000;
+}
+
+/*
+ * Capture thread.  Images are dequeued, converted and put on a queue of
+ * V4L2_QUEUE_SIZE images as soon as the device has them so that the
+ * buffers go back to the device no matter how long motion_loop takes.
+ * The queue has one producer and one consumer and each side only moves
+ * its own index.  When the queue is full the new image is dropped.
+ */
+static void *v4l2_handler(void *arg)
+{
+    ctx_cam *cam = (ctx_cam *)arg;
+    ctx_v4l2cam *v4l2cam = cam->v4l2cam;
+    ctx_v4l2cam_frame *frame;
+    ctx_image_data img_data;
+    unsigned int head;
+    int retcd;
+
+    mythreadname_set("v4", v4l2cam->threadnbr, cam->conf->camera_name.c_str());
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)v4l2cam->threadnbr));
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("V4L2 capture thread [%d] started"), v4l2cam->threadnbr);
+
+    while (v4l2cam->handler_stop == FALSE) {
+        v4l2_device_select(cam);
+
+        if (v4l2_capture_wait(v4l2cam) != 0) {
+            continue;
+        }
+
+        retcd = v4l2_capture_buffer(v4l2cam);
+        if (retcd < 0) {
+            break;
+        } else if (retcd > 0) {
+            continue;
+        }
+
+        head = __atomic_load_n(&v4l2cam->queue_head, __ATOMIC_RELAXED);
+        if ((head - __atomic_load_n(&v4l2cam->queue_tail, __ATOMIC_ACQUIRE)) >= V4L2_QUEUE_SIZE) {
+            if (v4l2_capture_requeue(v4l2cam) != 0) {
+                break;
+            }
+            continue;
+        }
+
+        frame = &v4l2cam->queue[head % V4L2_QUEUE_SIZE];
+        v4l2_capture_time(v4l2cam, &frame->imgts);
+
+        memset(&img_data, 0, sizeof(ctx_image_data));
+        img_data.image_norm = frame->image;
+        img_data.image_high = frame->image_high;
+        retcd = v4l2_capture_convert(cam, v4l2cam, &img_data);
+        frame->image = img_data.image_norm;
+        frame->flags = img_data.flags;
+
+        /* The device gets the buffer back before the wait for the next image */
+        if (v4l2_capture_requeue(v4l2cam) != 0) {
+            break;
+        }
+        if (retcd != 0) {
+            continue;
+        }
+
+        __atomic_store_n(&v4l2cam->queue_head, head + 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&v4l2cam->mutex);
+            pthread_cond_signal(&v4l2cam->cond_frame);
+        pthread_mutex_unlock(&v4l2cam->mutex);
+    }
+
+    if (v4l2cam->handler_stop == FALSE) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
+            ,_("V4L2 capture thread stopping on device error"));
+    }
+
+    pthread_mutex_lock(&v4l2cam->mutex);
+        v4l2cam->handler_finished = TRUE;
+        pthread_cond_signal(&v4l2cam->cond_frame);
+    pthread_mutex_unlock(&v4l2cam->mutex);
+
+    pthread_mutex_lock(&cam->motapp->global_lock);
+        cam->motapp->threads_running--;
+    pthread_mutex_unlock(&cam->motapp->global_lock);
+
+    MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, _("V4L2 capture thread exiting"));
+
+    return NULL;
+}
+
+static int v4l2_start_handler(ctx_cam *cam)
+{
+    ctx_v4l2cam *v4l2cam = cam->v4l2cam;
+    int indx, retcd, size_norm, size_high;
+
+    size_high = (v4l2cam->width * v4l2cam->height * 3) / 2;
+    size_norm = size_high / (v4l2cam->mjpeg_scale * v4l2cam->mjpeg_scale);
+
+    v4l2cam->queue = (ctx_v4l2cam_frame *)mymalloc(V4L2_QUEUE_SIZE * sizeof(ctx_v4l2cam_frame));
+    for (indx = 0; indx < V4L2_QUEUE_SIZE; indx++) {
+        v4l2cam->queue[indx].image = (unsigned char *)mymalloc(size_norm);
+        memset(v4l2cam->queue[indx].image, 0x80, size_norm);
+        v4l2cam->queue[indx].image_high = NULL;
+        if (v4l2cam->mjpeg_scale > 1) {
+            v4l2cam->queue[indx].image_high = (unsigned char *)mymalloc(size_high);
+            memset(v4l2cam->queue[indx].image_high, 0x80, size_high);
+        }
+    }
+    v4l2cam->scratch = (unsigned char *)mymalloc(v4l2cam->width * v4l2cam->height);
+    v4l2cam->queue_head = 0;
+    v4l2cam->queue_tail = 0;
+    v4l2cam->handler_stop = FALSE;
+    v4l2cam->handler_finished = FALSE;
+
+    pthread_mutex_init(&v4l2cam->mutex, NULL);
+    pthread_cond_init(&v4l2cam->cond_frame, NULL);
+
+    pthread_mutex_lock(&cam->motapp->global_lock);
+        v4l2cam->threadnbr = ++cam->motapp->threads_running;
+    pthread_mutex_unlock(&cam->motapp->global_lock);
+
+    retcd = pthread_create(&v4l2cam->thread_id, NULL, &v4l2_handler, cam);
+    if (retcd != 0) {
+        MOTION_LOG(ALR, TYPE_VIDEO, NO_ERRNO, _("Error starting V4L2 capture thread"));
+        pthread_mutex_lock(&cam->motapp->global_lock);
+            cam->motapp->threads_running--;
+        pthread_mutex_unlock(&cam->motapp->global_lock);
+        v4l2cam->handler_stop = TRUE;
+        v4l2cam->handler_finished = TRUE;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Stop the capture thread and release its queue */
+static void v4l2_stop_handler(ctx_v4l2cam *v4l2cam)
+{
+    int indx;
+
+    if (v4l2cam->queue == NULL) {
+        return;
+    }
+
+    /* The thread may have ended on its own after a device error */
+    if (v4l2cam->handler_stop == FALSE) {
+        v4l2cam->handler_stop = TRUE;
+        pthread_join(v4l2cam->thread_id, NULL);
+    }
+    pthread_mutex_destroy(&v4l2cam->mutex);
+    pthread_cond_destroy(&v4l2cam->cond_frame);
+
+    for (indx = 0; indx < V4L2_QUEUE_SIZE; indx++) {
+        free(v4l2cam->queue[indx].image);
+        free(v4l2cam->queue[indx].image_high);
+    }
+    free(v4l2cam->queue);
+    v4l2cam->queue = NULL;
+    free(v4l2cam->scratch);
+    v4l2cam->scratch = NULL;
+}
+
+/*
+ * Take the oldest image from the capture thread, waiting up to a second
+ * for one.  The image is swapped into the ring slot rather than copied.
+ */
+static int v4l2_queue_next(ctx_v4l2cam *v4l2cam, ctx_image_data *img_data)
+{
+    ctx_v4l2cam_frame *frame;
+    unsigned char *image;
+    struct timespec ts;
+    unsigned int tail;
+
+    tail = __atomic_load_n(&v4l2cam->queue_tail, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&v4l2cam->queue_head, __ATOMIC_ACQUIRE) == tail) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec++;
+        pthread_mutex_lock(&v4l2cam->mutex);
+            while ((__atomic_load_n(&v4l2cam->queue_head, __ATOMIC_ACQUIRE) == tail) &&
+                (v4l2cam->handler_finished == FALSE)) {
+                if (pthread_cond_timedwait(&v4l2cam->cond_frame, &v4l2cam->mutex, &ts) != 0) {
+                    break;
+                }
+            }
+        pthread_mutex_unlock(&v4l2cam->mutex);
+
+        if (__atomic_load_n(&v4l2cam->queue_head, __ATOMIC_ACQUIRE) == tail) {
+            if (v4l2cam->handler_finished) {
+                return -1;
+            }
+            return 1;
+        }
+    }
+
+    frame = &v4l2cam->queue[tail % V4L2_QUEUE_SIZE];
+    image = img_data->image_norm;
+    img_data->image_norm = frame->image;
+    frame->image = image;
+    if (frame->image_high != NULL) {
+        image = img_data->image_high;
+        img_data->image_high = frame->image_high;
+        frame->image_high = image;
+    }
+    img_data->flags |= frame->flags;
+    img_data->imgts = frame->imgts;
+
+    __atomic_store_n(&v4l2cam->queue_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
 #endif /* HAVE_V4L2 */
 
 void v4l2_cleanup(ctx_cam *cam)
@@ -1134,6 +1631,8 @@ void v4l2_cleanup(ctx_cam *cam)
             return;
         }
 
+        v4l2_stop_handler(cam->v4l2cam);
+
         type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
         if (cam->v4l2cam->fd_device != -1) {
@@ -1145,7 +1644,11 @@ void v4l2_cleanup(ctx_cam *cam)
 
         if (cam->v4l2cam->buffers != NULL) {
             for (indx = 0; indx < (int)cam->v4l2cam->req.count; indx++){
-                munmap(cam->v4l2cam->buffers[indx].ptr, cam->v4l2cam->buffers[indx].size);
+                if (cam->v4l2cam->req.memory == V4L2_MEMORY_USERPTR) {
+                    free(cam->v4l2cam->buffers[indx].ptr);
+                } else {
+                    munmap(cam->v4l2cam->buffers[indx].ptr, cam->v4l2cam->buffers[indx].size);
+                }
             }
             free(cam->v4l2cam->buffers);
             cam->v4l2cam->buffers = NULL;
@@ -1190,12 +1693,14 @@ int v4l2_start(ctx_cam *cam)
         if (retcd == 0) v4l2_set_norm(cam->v4l2cam);
         if (retcd == 0) v4l2_set_frequency(cam->v4l2cam);
         if (retcd == 0) retcd = v4l2_set_palette(cam->v4l2cam);
+        if (retcd == 0) retcd = v4l2_set_scale(cam);
         if (retcd == 0) v4l2_set_fps(cam->v4l2cam);
         if (retcd == 0) retcd = v4l2_ctrls_count(cam->v4l2cam);
         if (retcd == 0) v4l2_ctrls_list(cam->v4l2cam);
         if (retcd == 0) v4l2_ctrls_set(cam->v4l2cam);
         if (retcd == 0) retcd = v4l2_set_mmap(cam->v4l2cam);
         if (retcd == 0) v4l2_set_imgs(cam);
+        if ((retcd == 0) && (cam->v4l2cam->capture_thread)) retcd = v4l2_start_handler(cam);
         if (retcd < 0) {
             v4l2_cleanup(cam);
             return retcd;
@@ -1213,6 +1718,17 @@ int v4l2_next(ctx_cam *cam, ctx_image_data *img_data)
     #ifdef HAVE_V4L2
         int retcd;
 
+        __atomic_store_n(&cam->v4l2cam->need_high, mlp_need_full(cam), __ATOMIC_RELAXED);
+
+        if (cam->v4l2cam->queue != NULL) {
+            retcd = v4l2_queue_next(cam->v4l2cam, img_data);
+            if (retcd != 0) {
+                return retcd;
+            }
+            rotate_map(cam, img_data);
+            return 0;
+        }
+
         v4l2_device_select(cam);
 
         retcd = v4l2_capture_buffer(cam->v4l2cam);
@@ -1220,7 +1736,7 @@ int v4l2_next(ctx_cam *cam, ctx_image_data *img_data)
             return retcd;
         }
 
-        retcd = v4l2_capture_convert(cam, cam->v4l2cam, img_data->image_norm);
+        retcd = v4l2_capture_convert(cam, cam->v4l2cam, img_data);
         if (retcd != 0) {
             return retcd;
         }
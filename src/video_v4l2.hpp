@@ -33,6 +33,13 @@ typedef struct palette_item_struct{
     char            fourcc[5];
 } palette_item;
 
+struct ctx_v4l2cam_frame {
+    unsigned char   *image;          /* Converted image, swapped with the ring slot when consumed */
+    unsigned char   *image_high;     /* Full size image when mjpeg_scale is used */
+    unsigned int    flags;           /* IMAGE_NOHIGH when image_high was not decoded */
+    struct timespec imgts;           /* Time the image was captured */
+};
+
 struct ctx_v4l2cam_ctrl {
     char            *ctrl_name;       /* The name as provided by the device */
     char            *ctrl_iddesc;     /* A motion description of the ID number for the control*/
@@ -54,6 +61,10 @@ struct ctx_v4l2cam {
     int                     height;
     unsigned long           frequency;
     int                     palette;
+    int                     grey_shift;            /*Bits to drop from Y10/Y12, -1 keeps the top 8 bits*/
+    int                     userptr;               /*Capture YUV420 into buffers swapped with the image ring*/
+    int                     capture_thread;        /*Dequeue and convert on a thread of its own*/
+    int                     mjpeg_scale;           /*Decode jpeg at 1/mjpeg_scale for detection*/
     int                     fps;
     int                     pixfmt_src;
     int                     buffer_count;
@@ -65,6 +76,17 @@ struct ctx_v4l2cam {
     video_buff              *buffers;
     int                     pframe;
     volatile unsigned int   *finish;                /* End the thread */
+    ctx_v4l2cam_frame       *queue;                 /* Images from the capture thread */
+    unsigned int            queue_head;             /* Next slot the capture thread fills */
+    unsigned int            queue_tail;             /* Next slot motion_loop takes */
+    unsigned char           *scratch;               /* Conversion buffer of the capture thread */
+    int                     need_high;              /* Set by motion_loop when the full size image may be saved */
+    pthread_t               thread_id;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond_frame;             /* Signalled when an image is queued */
+    int                     threadnbr;
+    volatile int            handler_stop;
+    volatile int            handler_finished;
     #ifdef HAVE_V4L2
         struct v4l2_capability cap;
         struct v4l2_format src_fmt;
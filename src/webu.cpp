@@ -706,6 +706,13 @@ static mhdrslt webu_answer_get(struct webui_ctx *webui)
             MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO ,_("send page failed."));
         }
 
+    } else if (webui->uri_cmd1 == "heatmap.json") {
+        webu_json_heatmap(webui);
+        retcd = webu_mhd_send(webui);
+        if (retcd == MHD_NO) {
+            MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO ,_("send page failed."));
+        }
+
     } else {
         if (webui->motapp->cam_list[0]->conf->webcontrol_interface == 3) {
             webu_html_user(webui);
@@ -295,3 +295,42 @@ void webu_json_config(struct webui_ctx *webui)
     webui->resp_page += "}";
 
 }
+
+/* Report the count of changed pixels in each block of the motion grid */
+void webu_json_heatmap(struct webui_ctx *webui)
+{
+    struct ctx_stream *stream = &webui->cam->stream;
+    int *diffs;
+    int indx, cols, rows;
+
+    webui->resp_type = WEBUI_RESP_JSON;
+
+    /* Take a copy so the motion loop is not held while the page is built */
+    pthread_mutex_lock(&stream->mutex);
+        cols = 0;
+        rows = 0;
+        diffs = NULL;
+        if (stream->heatmap != NULL) {
+            cols = stream->heatmap_cols;
+            rows = stream->heatmap_rows;
+            diffs =(int*) mymalloc(cols * rows * sizeof(*diffs));
+            memcpy(diffs, stream->heatmap, cols * rows * sizeof(*diffs));
+        }
+    pthread_mutex_unlock(&stream->mutex);
+
+    webui->resp_page += "{\"block_size\" : " + std::to_string(MOTION_BLOCK_SIZE);
+    webui->resp_page += ",\"cols\" : " + std::to_string(cols);
+    webui->resp_page += ",\"rows\" : " + std::to_string(rows);
+
+    webui->resp_page += ",\"diffs\" : [";
+    for (indx = 0; indx < (cols * rows); indx++) {
+        if (indx != 0) {
+            webui->resp_page += ",";
+        }
+        webui->resp_page += std::to_string(diffs[indx]);
+    }
+    webui->resp_page += "]}";
+
+    free(diffs);
+
+}
@@ -21,5 +21,6 @@
 #define _INCLUDE_WEBU_JSON_H_
 
     void webu_json_config(struct webui_ctx *webui);
+    void webu_json_heatmap(struct webui_ctx *webui);
 
 #endif
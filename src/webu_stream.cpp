@@ -453,6 +453,10 @@ void webu_stream_init(struct ctx_cam *cam)
     cam->stream.secondary.cnct_count = 0;
     cam->stream.source.consumed = true;
 
+    cam->stream.heatmap = NULL;
+    cam->stream.heatmap_cols = 0;
+    cam->stream.heatmap_rows = 0;
+
 }
 
 /* Free the stream buffers and mutex for shutdown */
@@ -492,6 +496,13 @@ void webu_stream_deinit(struct ctx_cam *cam)
         cam->stream.secondary.jpeg_data = NULL;
     }
 
+    if (cam->stream.heatmap != NULL){
+        free(cam->stream.heatmap);
+        cam->stream.heatmap = NULL;
+    }
+    cam->stream.heatmap_cols = 0;
+    cam->stream.heatmap_rows = 0;
+
 }
 
 /* Get a normal image from the motion loop and compress it*/
@@ -637,3 +648,28 @@ void webu_stream_getimg(struct ctx_cam *cam, struct ctx_image_data *img_data)
         if (cam->stream.secondary.cnct_count > 0)   webu_stream_getimg_secondary(cam);
     pthread_mutex_unlock(&cam->stream.mutex);
 }
+
+/* Copy the block diffs from the motion loop for the web heatmap */
+void webu_stream_heatmap(struct ctx_cam *cam)
+{
+    int cnt;
+
+    /*This is on the motion_loop thread */
+
+    if (cam->imgs.block_diffs == NULL) {
+        return;
+    }
+
+    cnt = cam->imgs.block_cols * cam->imgs.block_rows;
+
+    pthread_mutex_lock(&cam->stream.mutex);
+        if ((cam->stream.heatmap_cols != cam->imgs.block_cols) ||
+            (cam->stream.heatmap_rows != cam->imgs.block_rows)) {
+            free(cam->stream.heatmap);
+            cam->stream.heatmap =(int*) mymalloc(cnt * sizeof(*cam->stream.heatmap));
+            cam->stream.heatmap_cols = cam->imgs.block_cols;
+            cam->stream.heatmap_rows = cam->imgs.block_rows;
+        }
+        memcpy(cam->stream.heatmap, cam->imgs.block_diffs, cnt * sizeof(*cam->stream.heatmap));
+    pthread_mutex_unlock(&cam->stream.mutex);
+}
@@ -25,6 +25,7 @@
     void webu_stream_init(struct ctx_cam *cam);
     void webu_stream_deinit(struct ctx_cam *cam);
     void webu_stream_getimg(struct ctx_cam *cam, struct ctx_image_data *img_data);
+    void webu_stream_heatmap(struct ctx_cam *cam);
 
     mhdrslt webu_stream_main(struct webui_ctx *webui);
 